@@ -0,0 +1,62 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "btree/NodeSearch.h"
+
+// Compares the in-node search implementations across a range of node sizes
+int main()
+{
+    constexpr size_t lookups = 1 << 22;
+    const std::pair<const char *, node_search::SearchFunc> impls[] = {
+            {"linear", node_search::linear},
+            {"binary", node_search::binary},
+            {"sse4.2", node_search::supports_sse42() ? node_search::sse42 : nullptr},
+            {"avx2", node_search::supports_avx2() ? node_search::avx2 : nullptr},
+    };
+
+    std::mt19937_64 rng(42);
+    for(size_t count : {4, 16, 64, 168, 512})
+    {
+        std::vector<uint64_t> keys(count);
+        for(auto &key : keys)
+        {
+            key = rng() >> 1;
+        }
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<uint64_t> needles(4096);
+        for(auto &needle : needles)
+        {
+            needle = rng() >> 1;
+        }
+
+        std::cout << "keys: " << count << "\n";
+        for(const auto &[name, func] : impls)
+        {
+            if(!func)
+            {
+                std::cout << "  " << name << ": unsupported\n";
+                continue;
+            }
+
+            size_t checksum = 0;
+            auto begin = std::chrono::steady_clock::now();
+            for(size_t a = 0; a < lookups; a++)
+            {
+                checksum += func(keys.data(), keys.size(), needles[a % needles.size()]);
+            }
+            auto end = std::chrono::steady_clock::now();
+
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+            std::cout << "  " << name << ": " << static_cast<double>(ns) / lookups << "ns/search (checksum " << checksum << ")\n";
+        }
+    }
+
+    return 0;
+}
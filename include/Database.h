@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <string_view>
+#include <unordered_map>
 #include "table/Table.h"
 #include "table/TableStorage.h"
 
@@ -14,11 +15,20 @@ public:
 	std::shared_ptr<Table> load_table(tid_t id);
 	std::vector<tid_t> list_table_ids();
 	std::shared_ptr<Table> create_table(std::string name, std::vector<ColumnMetadata> columns);
+	void create_index(tid_t table_id, std::string name, std::vector<cid_t> columns, std::vector<cid_t> included = {});
 	[[nodiscard]] std::optional<tid_t> lookup_table(std::string_view name) const;
 
+    /*!
+     * Makes every change so far durable. Tables are flushed into the filesystem, which then commits them.
+     *
+     * @return True on success, false if the changes may not have reached storage
+     */
+    bool commit();
+
 private:
     std::unique_ptr<Filesystem> filesystem;
     std::unique_ptr<TableStorage> tables;
+    std::unordered_map<tid_t, std::shared_ptr<Table>> open_tables; // Tables are kept open, as each has its own node caches
 };
 
 #endif // TESTDB_DATABASE
\ No newline at end of file
@@ -53,12 +53,17 @@ public:
             ORDER,
             BY,
             ASC,
+            INDEX,
+            ON,
+            BETWEEN,
+            AND,
+            INCLUDE,
             TokenCount, //Keep at end
         };
 
         [[nodiscard]] const std::string &str() const
         {
-            static std::array<std::string, 37> types = {
+            static std::array<std::string, 42> types = {
                     "SELECT",
                     "INSERT",
                     "SHOW",
@@ -96,6 +101,11 @@ public:
                     "ORDER",
                     "BY",
                     "ASC",
+                    "INDEX",
+                    "ON",
+                    "BETWEEN",
+                    "AND",
+                    "INCLUDE",
             };
             static_assert(std::tuple_size<decltype(types)>::value == Type::TokenCount, "types needs updating");
             return types[type];
@@ -25,6 +25,8 @@ enum class Opcode : uint8_t
     FRAME_MARKER,
     FILTER_MUTUAL,
     FLIP,
+    COMP_BETWEEN,
+    AND,
 };
 
 #endif //TESTDB_OPCODE_H
@@ -41,6 +41,7 @@ private:
     void show_query(Statement *stmt);
     void desc_query(Statement *stmt);
     void create_query(Statement *stmt);
+    void create_index_query(Statement *stmt);
     void delete_query(Statement *stmt);
     void table_name(Statement *stmt);
     void table_or_subquery(Statement *stmt);
@@ -51,6 +52,7 @@ private:
 
     void expr(Statement *stmt, std::string &output);
     void expr_(Statement *stmt, std::string &output);
+    void expr_l1(Statement *stmt, std::string &output);
     void expr_l2(Statement *stmt, std::string &output);
     void expr_l2_(Statement *stmt, std::string &output);
     void in(Statement *stmt, std::string &output);
@@ -8,10 +8,13 @@
 #include <utility>
 #include <vector>
 #include <memory>
+#include <limits>
 #include "Variable.h"
 #include "Stack.h"
+#include "StringPool.h"
 
 class Table;
+class IndexCursor;
 class Statement;
 class Database;
 typedef std::vector<Variable> row_t;
@@ -34,6 +37,13 @@ private:
     bool run_update_cycle();
 
     size_t exec(Statement *stmt, std::string_view bytecode);
+    void first_row();
+    void next_row();
+
+    // Moves on to the next row found through an index, from the cursor or the candidates found up front
+    void next_candidate();
+    std::vector<row_t> derive_rows(std::string_view bytecode);
+    bool plan_index_scan();
 
     inline void push_state()
     {
@@ -61,14 +71,34 @@ private:
             stmt = nullptr;
             table = nullptr;
             row = 0;
-            max_rows = 1;
+            has_row = false;
+            max_rows = std::numeric_limits<size_t>::max();
+            indexed = false;
+            cursor.reset();
+            candidates.clear();
+            candidate = 0;
+            covering = false;
+            covered.clear();
+            covered_row.clear();
+            covered_positions.clear();
+            derived.clear();
         }
 
         bool finalised;
         Statement *stmt;
         std::shared_ptr<Table> table;
-        size_t row;
-        size_t max_rows;
+        size_t row; // Id of the row being evaluated
+        bool has_row; // False once every row has been visited
+        size_t max_rows; // Number of rows left to return
+        bool indexed; // If set, only the rows found through an index are visited, from 'cursor' if it's set or else 'candidates'
+        std::shared_ptr<IndexCursor> cursor; // Walks a single range of the index lazily, as it can't find a row twice
+        std::vector<size_t> candidates; // Found up front when several ranges are scanned, in table order without duplicates
+        size_t candidate; // The next of 'candidates' to visit
+        bool covering; // If set, the index holds every column used, so columns are read from 'covered_row' rather than the table
+        std::vector<row_t> covered; // The index's values for each of 'candidates', indexed columns first then included ones
+        row_t covered_row; // The index's values for the row being evaluated
+        std::vector<size_t> covered_positions; // Column id to position within 'covered_row'
+        std::vector<row_t> derived; // Rows produced by a subquery in the FROM clause, visited in place of a table's
         std::vector<size_t> frames;
     };
 
@@ -76,6 +106,7 @@ private:
     State state;
     std::vector<State> state_stack;
     Stack<Variable> stack;
+    StringPool strings; // Strings loaded from tables, kept until the next statement is evaluated
 
     // Dependencies
     std::shared_ptr<Database> database;
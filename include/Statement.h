@@ -17,12 +17,14 @@ struct Statement
 {
     struct Link
     {
-        Link(uint8_t *bytecode_pos, std::string_view column_name)
-        : bytecode_pos(bytecode_pos),
+        Link(std::string *bytecode, size_t bytecode_pos, std::string_view column_name)
+        : bytecode(bytecode),
+          bytecode_pos(bytecode_pos),
           column_name(column_name)
         {}
 
-        uint8_t *bytecode_pos;
+        std::string *bytecode;
+        size_t bytecode_pos; // Offset rather than a pointer, as the bytecode may be reallocated as it grows
         std::string_view column_name;
     };
 
@@ -46,8 +48,11 @@ struct Statement
         nested_statements.clear();
         column_definitions.clear();
         new_table_name.clear();
+        new_index_name.clear();
         column_ids.clear();
+        included_column_ids.clear();
         accessed_columns.clear();
+        selects_all = false;
         rows_returned = 0;
         order = Order::Ascending;
     }
@@ -70,8 +75,11 @@ struct Statement
 
     std::vector<ColumnMetadata> column_definitions;
     std::string new_table_name;
+    std::string new_index_name; // Set if this is a CREATE INDEX, with the columns in column_ids
+    std::vector<cid_t> included_column_ids; // Extra columns to store in a new index, from its INCLUDE list
 
     std::vector<Link> accessed_columns;
+    bool selects_all = false; // Set if the result columns include '*'
 
     size_t rows_returned;
     Order order;
@@ -0,0 +1,58 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#ifndef TESTDB_STRINGPOOL_H
+#define TESTDB_STRINGPOOL_H
+
+
+#include <deque>
+#include <string>
+#include "Variable.h"
+
+/*!
+ * Holds strings which have been loaded from storage, as Variables don't own their strings.
+ * Strings stay valid until the pool is rewound past them or cleared, so the owner decides
+ * how long loaded values live, e.g. for a single statement.
+ */
+class StringPool
+{
+public:
+    // Keeps a copy of a string, returning a Variable which refers to it
+    inline Variable hold(std::string str)
+    {
+        // A deque never moves its elements when appending, so earlier strings stay put
+        auto &held = strings.emplace_back(std::move(str));
+        return Variable(held.data(), held.size());
+    }
+
+    // Gets a position which the pool can later be rewound to, releasing anything held after it
+    [[nodiscard]] inline size_t mark() const
+    {
+        return strings.size();
+    }
+
+    inline void rewind(size_t position)
+    {
+        if(position < strings.size())
+        {
+            strings.resize(position);
+        }
+    }
+
+    inline void clear()
+    {
+        strings.clear();
+    }
+
+    [[nodiscard]] inline size_t size() const
+    {
+        return strings.size();
+    }
+
+private:
+    std::deque<std::string> strings;
+};
+
+
+#endif //TESTDB_STRINGPOOL_H
@@ -27,6 +27,13 @@ public:
 
     }
 
+    Variable &operator=(const Variable &o)
+    {
+        type = o.type;
+        store = o.store;
+        return *this;
+    }
+
     explicit Variable(int64_t val)
     {
         store.int64 = val;
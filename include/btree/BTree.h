@@ -13,27 +13,251 @@
 #include <map>
 #include <cassert>
 #include <memory>
+#include <functional>
+#include <span>
 #include "filesystem/Filesystem.h"
 #include "btree/Node.h"
 #include "btree/NodeStore.h"
 
+/*!
+ * A B+tree mapping keys to values. Values are only stored in leaves,
+ * and each leaf links to its right sibling so that ordered scans don't need
+ * to go back through the root.
+ *
+ * Keys are unique unless the tree is created with duplicates allowed, in which
+ * case entries are ordered by key then value, and each key/value pair is unique.
+ *
+ * Keys are a fixed number of 64-bit words, set when the tree is created, and are
+ * compared word by word. So composite keys can be built by encoding each part into
+ * words which order the same way as the part does, most significant part first,
+ * and seeking to a shorter key finds the first key starting with it.
+ *
+ * A tree created in copy-on-write mode never modifies the nodes of the version readers
+ * can see. Each change copies the path from the root down to what it touches, and then
+ * publishes the new root, so snapshots of earlier versions stay consistent while the
+ * tree keeps being written to.
+ */
 class Tree
 {
 public:
-    Tree();
-    bool create(Filesystem::Handle file);
+    using Key = std::span<const uint64_t>;
+
+    /*!
+     * Walks the leaves of the tree in key order. Modifying the tree
+     * invalidates any iterators over it.
+     */
+    class Iterator
+    {
+    public:
+        /*!
+         * Positions the iterator at the first key which is >= key
+         *
+         * @param key The key to seek to
+         * @return True if there's such a key, false if the iterator is now at the end
+         */
+        bool seek(uint64_t key);
+
+        /*!
+         * Positions the iterator at the first key which is >= key. The key may be shorter than
+         * the tree's keys, in which case the rest of it is treated as zero.
+         *
+         * @param key The key, or leading part of a key, to seek to
+         * @return True if there's such a key, false if the iterator is now at the end
+         */
+        bool seek(Key key);
+
+        /*!
+         * Advances to the next key, following the leaf's sibling link if needed
+         *
+         * @return True if there's another key, false if the iterator is now at the end
+         */
+        bool next();
+
+        [[nodiscard]] bool valid() const;
+        // The first word of the current key
+        [[nodiscard]] uint64_t key() const;
+
+        // All of the current key. Only valid until the iterator moves.
+        [[nodiscard]] Key full_key() const;
+        [[nodiscard]] uint64_t value() const;
+
+        // Checks if the current key begins with the given words
+        [[nodiscard]] bool starts_with(Key prefix) const;
+
+    private:
+        friend class Tree;
+        Iterator(Tree *tree, uint64_t root);
+        void skip_empty();
+
+        // Finds the leaf after the current one by going back up through its ancestors
+        NodePtr next_leaf();
+
+        Tree *tree;
+        uint64_t root; // The root the iterator started from, which isn't always the current one for snapshots
+        NodePtr leaf;
+        size_t position = 0;
+
+        // The path down to the leaf, with which child was taken at each level. Only kept for copy-on-write
+        // trees, where leaves' sibling links aren't kept up to date as leaves are copied.
+        std::vector<std::pair<NodePtr, size_t>> parents;
+    };
+
+    /*!
+     * A read-only view of a copy-on-write tree as it was when the snapshot was taken. The tree can carry
+     * on being modified, including from another thread while the snapshot's being read, and the snapshot
+     * keeps seeing the same entries. The nodes it can see aren't reused until it's destroyed, so it should
+     * be let go of once it's no longer needed. It mustn't outlive the tree.
+     */
+    class Snapshot
+    {
+    public:
+        Snapshot(Snapshot &&o) noexcept;
+        Snapshot(const Snapshot&)=delete;
+        void operator=(const Snapshot&)=delete;
+        ~Snapshot();
+
+        std::optional<uint64_t> search(uint64_t key);
+        std::optional<uint64_t> search(Key key);
+        Iterator begin();
+        Iterator seek(uint64_t key);
+        Iterator seek(Key key);
+
+    private:
+        friend class Tree;
+        explicit Snapshot(Tree *tree);
+
+        Tree *tree;
+        uint64_t root = 0;
+        uint64_t generation;
+    };
+
+    /*!
+     * @param cache_capacity Maximum number of nodes to keep in memory, unless more than that are in use at once
+     */
+    explicit Tree(size_t cache_capacity = NodeStore::DefaultCapacity);
+    bool create(Filesystem::Handle file, uint64_t order = 0, bool duplicates = false, uint64_t key_width = 1, bool copy_on_write = false);
     bool open(Filesystem::Handle file);
-    std::optional<uint64_t> search(uint64_t val);
+
+    // Finds the value for a key. With duplicates, this is the smallest value for that key.
+    std::optional<uint64_t> search(uint64_t key);
+    std::optional<uint64_t> search(Key key);
+
+    // Gets the first word of the largest key in the tree
+    std::optional<uint64_t> last();
     void insert(uint64_t key, uint64_t val);
+    void insert(Key key, uint64_t val);
+
+    /*!
+     * Builds the tree bottom-up from sorted input, in a single pass. Much faster than
+     * repeatedly calling insert, as nodes are packed and written out as they fill up.
+     *
+     * @param source Called to get each key/value pair. Entries must be strictly ascending. Returns false when exhausted.
+     * @param fill_factor How full to pack each node, from 0.5 to 1.0. Leave room if more inserts are expected.
+     * @return True on success, false if the tree isn't empty
+     */
+    bool bulk_load(const std::function<bool(uint64_t &key, uint64_t &val)> &source, double fill_factor = 1.0);
+
+    // As above, for keys of any width. The source writes each key into the given buffer of key_width() words.
+    bool bulk_load(const std::function<bool(uint64_t *key, uint64_t &val)> &source, double fill_factor = 1.0);
+
+    /*!
+     * Inserts a run of entries into a tree which may already have some. Entries beyond the
+     * current largest key are appended down the rightmost path, which is only walked once for
+     * the whole run, and full nodes there are left packed as new ones are started to their right.
+     * Any entry that isn't beyond the largest key so far is inserted the usual way.
+     *
+     * @throws std::logic_error If an entry is already in the tree
+     * @param source Called to get each key/value pair. Returns false when exhausted.
+     */
+    void insert_sorted(const std::function<bool(uint64_t &key, uint64_t &val)> &source);
+
+    // As above, for keys of any width. The source writes each key into the given buffer of key_width() words.
+    void insert_sorted(const std::function<bool(uint64_t *key, uint64_t &val)> &source);
     void in_order();
-    bool erase(uint64_t key);
+
+    /*!
+     * Removes an entry from the tree
+     *
+     * @param key The key to remove
+     * @param val With duplicates, the value of the entry to remove. Otherwise it's ignored.
+     * @return True if an entry was removed, false if there wasn't one
+     */
+    bool erase(uint64_t key, uint64_t val = 0);
+    bool erase(Key key, uint64_t val = 0);
+    [[nodiscard]] uint64_t order() const;
+    [[nodiscard]] uint64_t height();
+
+    // Number of entries in the tree
+    [[nodiscard]] uint64_t size() const;
+    [[nodiscard]] bool duplicates() const;
+    [[nodiscard]] uint64_t key_width() const;
+    [[nodiscard]] bool copy_on_write() const;
+
+    /*!
+     * Takes a snapshot of the tree as it is now
+     *
+     * @throws std::logic_error If the tree wasn't created in copy-on-write mode
+     * @return The snapshot
+     */
+    Snapshot snapshot();
+    [[nodiscard]] NodeStore::CacheStats cache_stats() const;
+
+    // Number of node slots used by the tree's file, including any freed by erasing
+    [[nodiscard]] uint64_t node_count() const;
+
+    /*!
+     * Moves nodes into the slots freed by erasing, so that the tree takes up as few slots as possible
+     *
+     * @throws std::logic_error If there are snapshots of the tree
+     * @return The number of slots reclaimed
+     */
+    uint64_t compact();
+
+    // Checkpoints the tree, writing back any modified nodes
+    void flush();
+
+    // Gets an iterator positioned at the smallest key
+    Iterator begin();
+
+    // Gets an iterator positioned at the first key >= key
+    Iterator seek(uint64_t key);
+    Iterator seek(Key key);
 
 private:
-    void rebalance_node(NodePtr &node, size_t position, bool &doDelete);
-    bool erase(NodePtr &node, size_t depth, uint64_t key, bool &doDelete, size_t position);
+    friend class ConcurrentTree;
+
+    // A key and value pair, used for separators so duplicate keys can be told apart
+    struct Entry
+    {
+        std::vector<uint64_t> key;
+        uint64_t val;
+    };
+
+    std::optional<uint64_t> search_from(uint64_t root, Key key);
+    Iterator seek_from(uint64_t root, Key key);
+    NodePtr find_leaf(uint64_t root, const uint64_t *key, uint64_t val, std::vector<std::pair<NodePtr, size_t>> *parents = nullptr);
+
+    // Gets the root ready to be modified, copying it first in copy-on-write trees
+    NodePtr modify_root();
+
+    // Loads a child which is about to be modified. If it has to be copied, the parent is pointed at the copy.
+    NodePtr modify_child(NodePtr &node, size_t position);
+    bool locate(const NodePtr &node, const uint64_t *key, uint64_t val, size_t &location) const;
+    [[nodiscard]] bool less(const uint64_t *key_a, uint64_t val_a, const uint64_t *key_b, uint64_t val_b) const;
+    [[nodiscard]] size_t min_keys() const;
+    bool erase(NodePtr &node, const uint64_t *key, uint64_t val);
+    void rebalance_node(NodePtr &node, NodePtr &child, size_t position);
     void recurse(NodePtr &node, size_t level, std::map<size_t, std::vector<uint64_t>> &levels);
-    void insert_btree(NodePtr &node, uint64_t key, uint64_t val, uint64_t &median, NodePtr &right_child, bool &is_taller);
-    void split_node(NodePtr &node, uint64_t key, uint64_t val, NodePtr &right_child, size_t insert_pos, NodePtr &right_node, uint64_t &median);
+    void insert_btree(NodePtr &node, const uint64_t *key, uint64_t val, Entry &separator, NodePtr &right_node);
+    void insert_node(NodePtr &node, const uint64_t *key, uint64_t val, uint64_t right_child, size_t insert_pos, Entry &separator, NodePtr &right_node);
+    void split_node(NodePtr &node, const uint64_t *key, uint64_t val, uint64_t right_child, size_t insert_pos, Entry &separator, NodePtr &right_node);
+    // Gets the path down the right edge of the tree ready for appending, leaf first
+    std::vector<NodePtr> rightmost_path();
+
+    // Fixes up the tree's root and right edge after appending along a path from rightmost_path
+    void finish_append(std::vector<NodePtr> &rightmost);
+    void bulk_push_separator(std::vector<NodePtr> &open, size_t level, uint64_t left, const Entry &separator, uint64_t right, size_t target);
+    void bulk_fix_right_edge();
 
     NodeStore store;
 };
@@ -0,0 +1,111 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#ifndef TESTDB_CONCURRENTTREE_H
+#define TESTDB_CONCURRENTTREE_H
+
+#include <optional>
+#include <vector>
+#include "btree/BTree.h"
+#include "btree/NodeLatch.h"
+
+/*!
+ * A B+tree which many threads can search, insert into and erase from at once. It uses
+ * the same node format as Tree, and keys must be unique.
+ *
+ * Readers use optimistic lock coupling. They never write to shared memory besides pinning
+ * nodes in the cache; instead each node's version is checked after reading it, and the
+ * search starts over from the root if a writer changed anything along the way.
+ *
+ * Writers use latch crabbing. They latch nodes on the way down, letting go of everything
+ * above a node as soon as it's certain that the node won't split, so only the part of the
+ * tree that can actually change stays latched.
+ *
+ * Erasing doesn't rebalance, so nodes are never freed while other threads might be reading
+ * them. Underfull and even empty nodes stay in the tree, searches just pass over them. Nothing
+ * merges them later either: Tree's erase only rebalances the nodes on the path to the key it
+ * erases, and compact moves nodes without merging them.
+ */
+class ConcurrentTree
+{
+public:
+    using Key = Tree::Key;
+
+    /*!
+     * @param cache_capacity Maximum number of nodes to keep in memory, unless more than that are in use at once
+     */
+    explicit ConcurrentTree(size_t cache_capacity = NodeStore::DefaultCapacity);
+    bool create(Filesystem::Handle file, uint64_t order = 0, uint64_t key_width = 1);
+
+    // Opens an existing tree. Fails if it allows duplicate keys or is copy-on-write.
+    bool open(Filesystem::Handle file);
+
+    std::optional<uint64_t> search(uint64_t key);
+    std::optional<uint64_t> search(Key key);
+
+    /*!
+     * Adds a key to the tree
+     *
+     * @throws std::logic_error If the key is already in the tree
+     * @param key The key to add
+     * @param val The value to go with it
+     */
+    void insert(uint64_t key, uint64_t val);
+    void insert(Key key, uint64_t val);
+
+    /*!
+     * Removes a key from the tree
+     *
+     * @param key The key to remove
+     * @return True if it was removed, false if it wasn't in the tree
+     */
+    bool erase(uint64_t key);
+    bool erase(Key key);
+
+    [[nodiscard]] uint64_t height();
+
+    // Number of entries in the tree
+    [[nodiscard]] uint64_t size();
+    [[nodiscard]] NodeStore::CacheStats cache_stats() const;
+
+    // Checkpoints the tree, writing back any modified nodes. Must not run alongside any other operation.
+    void flush();
+
+private:
+    // Makes one attempt at a search, returning false if it was interrupted by a writer and needs to restart
+    OPTIMISTIC_READ bool try_search(const uint64_t *key, std::optional<uint64_t> &result);
+
+    /*!
+     * Finds a key within a node which a writer may be changing, without latching it. As with Node::search,
+     * 'location' is set to where the key is or would go. The result means nothing unless the node's version
+     * still validates afterwards, so this only makes sure it doesn't read out of bounds.
+     */
+    OPTIMISTIC_READ static bool optimistic_search(const Node &node, const uint64_t *key, size_t &location);
+
+    // Latches taken by a writer on the way down, released when it's done
+    struct WriteLatches
+    {
+        explicit WriteLatches(NodeLatch &root_latch);
+        ~WriteLatches();
+
+        /*!
+         * Latches a node below the last one, releasing everything above it if it's safe to
+         *
+         * @param node The next node down
+         * @param inserting True if the node might split, in which case its parent stays latched unless it has room to spare
+         */
+        void push(NodePtr node, bool inserting);
+        void release_above();
+
+        NodeLatch *root_latch;
+        std::vector<NodePtr> nodes;
+    };
+
+    Tree tree;
+
+    // Guards which node is the root. Readers validate it like a node, writers hold it while the root might change.
+    NodeLatch root_latch;
+};
+
+#endif //TESTDB_CONCURRENTTREE_H
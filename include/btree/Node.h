@@ -9,142 +9,188 @@
 #include <cstdint>
 #include <algorithm>
 #include <string>
+#include <vector>
+#include <cstring>
+#include "NodeLatch.h"
+#include "NodeSearch.h"
+#include "NodePtr.h"
+#include "NodeStoreHeader.h"
 
-static constexpr auto NodeOrder = 5;
-
-class NodeStore;
 struct Node;
-class NodePtr
+using NodePtr = BasicNodePtr<Node>;
+
+struct Node
 {
-public:
-    NodePtr()
-    : NodePtr(nullptr, nullptr)
-    {
+    // Identifies stores of this node type
+    static constexpr uint64_t Format = 0;
 
-    }
+    Node()=default;
 
-    NodePtr(NodeStore *store, Node *node)
-    : store(store), node(node)
+    explicit Node(uint64_t order, uint64_t key_width = 1)
+    : order(order),
+      key_width(key_width),
+      list((order - 1) * key_width),
+      values(order - 1),
+      children(order)
     {
 
     }
 
-    NodePtr(const NodePtr&)=delete;
-    void operator=(const NodePtr&)=delete;
-    NodePtr(NodePtr&&o) noexcept
-            : store(o.store),
-              node(o.node)
+    explicit Node(const NodeStoreHeader &header)
+    : Node(header.order, header.key_width)
     {
-        o.store = nullptr;
-    }
 
-    NodePtr &operator=(NodePtr&& o) noexcept
-    {
-        release();
-        store = o.store;
-        node = o.node;
-        o.store = nullptr;
-        return *this;
     }
 
-    ~NodePtr()
+    // On-disk node layout: id, count, leaf, next, keys[(order - 1) * key_width], values[order - 1], children[order]
+    static constexpr uint64_t Size(uint64_t order, uint64_t key_width = 1)
     {
-        release();
+        return (4 + (order - 1) * (key_width + 1) + order) * sizeof(uint64_t);
     }
 
-    void release();
-
-    Node *operator->()
+    static constexpr uint64_t OrderForSize(uint64_t size, uint64_t key_width = 1)
     {
-        return node;
+        return (size / sizeof(uint64_t) - 3 + key_width) / (key_width + 2);
     }
 
-    bool valid()
+    /*!
+     * Fills in the node layout for a new store
+     *
+     * @param header The new store's header, with the node size and key width set
+     * @param order Maximum children per node. If 0, the largest order that fits in a node is used.
+     * @return True on success, false if the order won't fit
+     */
+    static bool Layout(NodeStoreHeader &header, uint64_t order)
     {
-        return node != nullptr;
+        header.key_width = std::max<uint64_t>(header.key_width, 1);
+        header.order = order ? order : OrderForSize(header.node_size, header.key_width);
+        return header.order >= 3 && Size(header.order, header.key_width) <= header.node_size;
     }
 
-private:
-    NodeStore *store;
-    Node *node;
-};
-
-struct Node
-{
     uint64_t id = 0;
-    uint64_t list[NodeOrder - 1]{};
-    uint64_t values[NodeOrder - 1]{};
-    uint64_t children[NodeOrder]{};
+    uint64_t order = 0;
+    uint64_t key_width = 1; // Words per key. Keys are stored back to back in 'list'.
+    std::vector<uint64_t> list;
+    std::vector<uint64_t> values; // Only used by leaves
+    std::vector<uint64_t> children; // Only used by internal nodes
     uint64_t count = 0;
+    bool leaf = true;
+    uint64_t next = 0; // Right sibling, for leaves
+    bool dirty = false; // Modified since it was last written. Set this when changing fields directly.
+    NodeLatch latch; // Only used by ConcurrentTree
 
     bool operator==(const Node &other) const
     {
-        if(other.count != count)
+        if(other.count != count || other.key_width != key_width)
             return false;
-        if(!std::equal(std::begin(other.list), std::begin(other.list) + count, std::begin(list)))
+        if(!std::equal(std::begin(other.list), std::begin(other.list) + count * key_width, std::begin(list)))
             return false;
         if(!std::equal(std::begin(other.children), std::begin(other.children) + count + 1, std::begin(children)))
             return false;
         return true;
     }
 
+    // Number of children, which is zero for leaves
+    [[nodiscard]] size_t child_count() const
+    {
+        return leaf ? 0 : count + 1;
+    }
+
+    // Empties the node so its slot can be reused, linking it to the next free slot
+    void make_free(uint64_t next_free)
+    {
+        count = 0;
+        leaf = true;
+        next = next_free;
+        dirty = true;
+    }
+
+    void read(const char *data, const NodeStoreHeader &header)
+    {
+        *this = Node(header);
+        uint64_t fields[4];
+        data = read_words(data, fields, 4);
+        id = fields[0];
+        count = fields[1];
+        leaf = fields[2];
+        next = fields[3];
+        data = read_words(data, list.data(), list.size());
+        data = read_words(data, values.data(), values.size());
+        read_words(data, children.data(), children.size());
+    }
+
+    void write(char *data) const
+    {
+        const uint64_t fields[4] = {id, count, leaf, next};
+        data = write_words(data, fields, 4);
+        data = write_words(data, list.data(), list.size());
+        data = write_words(data, values.data(), values.size());
+        write_words(data, children.data(), children.size());
+    }
+
+    [[nodiscard]] const uint64_t *key(size_t position) const
+    {
+        return list.data() + position * key_width;
+    }
+
+    void set_key(size_t position, const uint64_t *key)
+    {
+        std::copy(key, key + key_width, list.begin() + position * key_width);
+    }
+
     void erase(size_t position)
     {
         assert(position < count);
-        for(size_t a = position; a < NodeOrder - 2; a++)
+        std::copy(list.begin() + (position + 1) * key_width, list.begin() + count * key_width, list.begin() + position * key_width);
+        for(size_t a = position; a < order - 2; a++)
         {
-            list[a] = list[a + 1];
             values[a] = values[a + 1];
         }
-        for(size_t a = position; a < NodeOrder - 2; a++)
+        for(size_t a = position; a < order - 2; a++)
         {
             children[a + 1] = children[a + 2];
         }
 
         count--;
+        dirty = true;
     }
 
-    void insert(uint64_t val, uint64_t val2, uint64_t right_child, size_t insert_pos)
+    void insert(const uint64_t *key, uint64_t val2, uint64_t right_child, size_t insert_pos)
     {
-        assert(insert_pos < NodeOrder);
+        assert(insert_pos < order);
+        std::copy_backward(list.begin() + insert_pos * key_width, list.begin() + count * key_width, list.begin() + (count + 1) * key_width);
         size_t index;
         for(index = count; index > insert_pos; index--)
         {
-            list[index] = list[index - 1];
             values[index] = values[index - 1];
             children[index + 1] = children[index];
         }
 
-        list[index] = val;
+        set_key(index, key);
         values[index] = val2;
         children[index + 1] = right_child;
         count++;
+        dirty = true;
     }
 
 
     [[nodiscard]] bool is_full() const
     {
-        return count == NodeOrder - 1;
+        return count == order - 1;
     }
 
-    bool search(uint64_t val, size_t &location)
+    bool search(const uint64_t *key, size_t &location)
     {
-        location = 0;
-        while(location < count && val > list[location])
-        {
-            location++;
-        }
-
-        return location < count && val == list[location];
+        location = node_search::lower_bound(list.data(), count, key_width, key);
+        return location < count && node_search::compare(key, this->key(location), key_width) == 0;
     }
 
     //Note: Overwrites last child
     void merge_right(NodePtr &right)
     {
-        assert(right->count);
+        std::copy(right->list.begin(), right->list.begin() + right->count * key_width, list.begin() + count * key_width);
         for(size_t a = 0; a < right->count; a++)
         {
-            list[count + a] = right->list[a];
             values[count + a] = right->values[a];
         }
         for(size_t a = 0; a < right->count + 1; a++)
@@ -153,6 +199,20 @@ struct Node
         }
 
         count += right->count;
+        dirty = true;
+    }
+
+private:
+    static const char *read_words(const char *data, uint64_t *out, size_t count)
+    {
+        memcpy(out, data, count * sizeof(uint64_t));
+        return data + count * sizeof(uint64_t);
+    }
+
+    static char *write_words(char *data, const uint64_t *in, size_t count)
+    {
+        memcpy(data, in, count * sizeof(uint64_t));
+        return data + count * sizeof(uint64_t);
     }
 };
 
@@ -0,0 +1,104 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#ifndef TESTDB_NODELATCH_H
+#define TESTDB_NODELATCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+// Optimistic reads race with writers by design, and are only trusted once the version they started from
+// validates. ThreadSanitizer can't see that, so the functions doing them are left out of its checks.
+#if defined(__SANITIZE_THREAD__)
+#define OPTIMISTIC_READ __attribute__((no_sanitize("thread")))
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define OPTIMISTIC_READ __attribute__((no_sanitize("thread")))
+#endif
+#endif
+#ifndef OPTIMISTIC_READ
+#define OPTIMISTIC_READ
+#endif
+
+/*!
+ * A versioned latch guarding a single tree node, for optimistic lock coupling.
+ *
+ * Writers take the latch exclusively, and bump the version when they release it.
+ * Readers don't take it at all. They note the version before reading the node, and
+ * check it's unchanged afterwards, starting over if a writer got in the way.
+ *
+ * Copying a node gives it a fresh latch, as the latch belongs to wherever the node lives.
+ */
+class NodeLatch
+{
+public:
+    NodeLatch()=default;
+
+    NodeLatch(const NodeLatch&)
+    {
+
+    }
+
+    NodeLatch &operator=(const NodeLatch&)
+    {
+        return *this;
+    }
+
+    /*!
+     * Starts an optimistic read, waiting for any writer to finish first
+     *
+     * @return The version to pass to validate() once the read is done
+     */
+    uint64_t read_lock() const
+    {
+        uint64_t version;
+        while((version = word.load(std::memory_order_acquire)) & Locked)
+        {
+            std::this_thread::yield();
+        }
+        return version;
+    }
+
+    /*!
+     * Checks that nothing was written since read_lock()
+     *
+     * @param version What read_lock() returned
+     * @return True if everything read since then is consistent, false if the read needs to restart
+     */
+    [[nodiscard]] bool validate(uint64_t version) const
+    {
+        // Keep the reads of the node from being moved after the version check
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return word.load(std::memory_order_relaxed) == version;
+    }
+
+    // Takes the latch exclusively, for modifying the node
+    void lock()
+    {
+        uint64_t version = word.load(std::memory_order_relaxed);
+        while(true)
+        {
+            if(!(version & Locked) && word.compare_exchange_weak(version, version | Locked, std::memory_order_acquire))
+            {
+                return;
+            }
+            std::this_thread::yield();
+            version = word.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Releases the latch, moving on to the next version so readers of the old one restart
+    void unlock()
+    {
+        word.fetch_add(Locked, std::memory_order_release);
+    }
+
+private:
+    // The bottom bit is set while locked. Adding it again on unlock clears it and carries into the version.
+    static constexpr uint64_t Locked = 1;
+    std::atomic<uint64_t> word = 0;
+};
+
+#endif //TESTDB_NODELATCH_H
@@ -0,0 +1,88 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#ifndef TESTDB_NODEPTR_H
+#define TESTDB_NODEPTR_H
+
+#include <atomic>
+#include <cstdint>
+
+// A slot in a node store's cache, holding one node
+template<typename NodeType>
+struct NodeFrame
+{
+    NodeType node; // Id 0 if the frame is unused
+    std::atomic<uint64_t> pins = 0; // Number of live NodePtrs referencing this node
+    std::atomic<bool> referenced = false; // Set on access, cleared as the clock hand passes
+};
+
+// Keeps a node loaded and pinned in its store's cache for as long as it's held
+template<typename NodeType>
+class BasicNodePtr
+{
+public:
+    BasicNodePtr()
+    : BasicNodePtr(nullptr)
+    {
+
+    }
+
+    // Takes over a pin which the store has already added to the frame
+    explicit BasicNodePtr(NodeFrame<NodeType> *frame)
+    : frame(frame)
+    {
+
+    }
+
+    BasicNodePtr(const BasicNodePtr&)=delete;
+    void operator=(const BasicNodePtr&)=delete;
+    BasicNodePtr(BasicNodePtr&&o) noexcept
+            : frame(o.frame)
+    {
+        o.frame = nullptr;
+    }
+
+    BasicNodePtr &operator=(BasicNodePtr&& o) noexcept
+    {
+        release();
+        frame = o.frame;
+        o.frame = nullptr;
+        return *this;
+    }
+
+    ~BasicNodePtr()
+    {
+        release();
+    }
+
+    // Unpins the node. It stays cached until its frame is needed for another.
+    void release()
+    {
+        if(frame)
+        {
+            frame->pins.fetch_sub(1, std::memory_order_release);
+            frame = nullptr;
+        }
+    }
+
+    NodeType *operator->() const
+    {
+        return &frame->node;
+    }
+
+    NodeType &operator*() const
+    {
+        return frame->node;
+    }
+
+    [[nodiscard]] bool valid() const
+    {
+        return frame != nullptr;
+    }
+
+private:
+    NodeFrame<NodeType> *frame;
+};
+
+#endif //TESTDB_NODEPTR_H
@@ -0,0 +1,77 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#ifndef TESTDB_NODESEARCH_H
+#define TESTDB_NODESEARCH_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace node_search
+{
+    /*!
+     * Finds the position of the first key which is not less than the needle,
+     * within a sorted list of keys. Equivalent to std::lower_bound.
+     *
+     * @param keys The sorted keys to search
+     * @param count The number of keys
+     * @param key The key to search for
+     * @return The index of the first key >= key, or count if there is none
+     */
+    using SearchFunc = size_t (*)(const uint64_t *keys, size_t count, uint64_t key);
+
+    size_t linear(const uint64_t *keys, size_t count, uint64_t key);
+    size_t binary(const uint64_t *keys, size_t count, uint64_t key);
+    size_t sse42(const uint64_t *keys, size_t count, uint64_t key);
+    size_t avx2(const uint64_t *keys, size_t count, uint64_t key);
+
+    [[nodiscard]] bool supports_sse42();
+    [[nodiscard]] bool supports_avx2();
+
+    /*!
+     * Gets the fastest implementation supported by the current CPU.
+     * Resolved once on first use.
+     */
+    [[nodiscard]] SearchFunc best();
+
+    inline size_t lower_bound(const uint64_t *keys, size_t count, uint64_t key)
+    {
+        static const SearchFunc func = best();
+        return func(keys, count, key);
+    }
+
+    /*!
+     * Compares two keys made up of several words, word by word
+     *
+     * @param a The first key
+     * @param b The second key
+     * @param width The number of words in each key
+     * @return Negative if a < b, 0 if they're equal, positive if a > b
+     */
+    inline int compare(const uint64_t *a, const uint64_t *b, size_t width)
+    {
+        for(size_t word = 0; word < width; word++)
+        {
+            if(a[word] != b[word])
+            {
+                return a[word] < b[word] ? -1 : 1;
+            }
+        }
+        return 0;
+    }
+
+    /*!
+     * As lower_bound, but for keys made up of several words. Keys are stored
+     * back to back, and compared word by word.
+     *
+     * @param keys The sorted keys to search
+     * @param count The number of keys
+     * @param width The number of words in each key
+     * @param key The key to search for
+     * @return The index of the first key >= key, or count if there is none
+     */
+    size_t lower_bound(const uint64_t *keys, size_t count, size_t width, const uint64_t *key);
+}
+
+#endif //TESTDB_NODESEARCH_H
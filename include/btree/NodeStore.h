@@ -7,97 +7,364 @@
 
 
 #include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <stdexcept>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include "filesystem/Filesystem.h"
 #include "Node.h"
+#include "NodeStoreHeader.h"
 
-struct NodeStoreHeader
-{
-    uint64_t root = 0;
-    uint64_t height = 0;
-    uint64_t node_count = 1;
-};
-
-class NodeStore
+/*!
+ * Loads and stores tree nodes within a file. Recently used nodes are kept in a
+ * fixed number of in-memory frames, which are recycled using the CLOCK algorithm
+ * once they're no longer referenced by any NodePtr. Modified nodes are only
+ * written back when evicted or flushed.
+ *
+ * The node type decides how nodes are laid out on disk, so stores of different
+ * node formats share the same caching.
+ *
+ * Loading, allocating and freeing nodes is thread safe. Cache hits only take a shared
+ * lock, so readers don't serialise on the store. Keeping the nodes themselves consistent
+ * is up to the tree, as are the header counters returned by reference. Flushing, compacting
+ * and closing must not run alongside anything else using the store's nodes.
+ *
+ * In copy-on-write mode, nodes which are part of the last published version of the tree
+ * are never modified. The tree shadows them instead, copying each node it's about to
+ * change, and then publishes the new root in one step. Snapshots read from a published
+ * version without any node latches, and the slots of nodes replaced since then aren't
+ * reused until every snapshot that can still see them has been released.
+ */
+template<typename NodeType>
+class BasicNodeStore
 {
 public:
-    ~NodeStore()
+    using Ptr = BasicNodePtr<NodeType>;
+    using Frame = NodeFrame<NodeType>;
+
+    // Default number of cached nodes. With page sized nodes this is around 1MB.
+    static constexpr size_t DefaultCapacity = 256;
+
+    struct CacheStats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t writes = 0;
+    };
+
+    explicit BasicNodeStore(size_t capacity = DefaultCapacity)
+    : capacity(std::max<size_t>(capacity, 1))
+    {
+
+    }
+
+    BasicNodeStore(const BasicNodeStore&)=delete;
+    void operator=(const BasicNodeStore&)=delete;
+
+    ~BasicNodeStore()
     {
         close();
     }
 
-    bool create(Filesystem::Handle file_)
+    /*!
+     * Initialises a new node store within a file.
+     *
+     * @param file_ The file to store nodes in
+     * @param order Maximum children per node, if the node format has a fixed number of keys. If 0, the largest that fits in a filesystem page is used.
+     * @param duplicates True if the tree may contain duplicate keys
+     * @param key_width The number of words in each key, if the node format has fixed size keys
+     * @param copy_on_write True to copy published nodes rather than modifying them, so that snapshots can be taken
+     * @return True on success, false if the order won't fit within a page
+     */
+    bool create(Filesystem::Handle file_, uint64_t order = 0, bool duplicates = false, uint64_t key_width = 1, bool copy_on_write = false)
     {
         assert(file_.is_open());
+        std::unique_lock lock(mutex);
+        close_locked();
         file = std::move(file_);
-        file.seek(0);
-        file.write(reinterpret_cast<char *>(&header), sizeof(header));
+        header = NodeStoreHeader();
+        header.node_size = file.page_size();
+        header.key_width = key_width;
+        header.duplicates = duplicates;
+        header.format = NodeType::Format;
+        header.copy_on_write = copy_on_write;
+        if(!NodeType::Layout(header, order))
+        {
+            return false;
+        }
+
+        write_header();
         return true;
     }
 
+    /*!
+     * Opens an existing node store. If the file is empty, a new store is created within it.
+     *
+     * @param file_ The file to load nodes from
+     * @return True on success, false on failure
+     */
     bool open(Filesystem::Handle file_)
     {
         assert(file_.is_open());
+        close();
+        file_.seek(0);
+        if(file_.read(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header))
+        {
+            return create(std::move(file_));
+        }
+
         file = std::move(file_);
-        file.seek(0);
-        file.read(reinterpret_cast<char *>(&header), sizeof(header));
-        return true;
+        header.key_width = std::max<uint64_t>(header.key_width, 1); // Stores from before composite keys have zero here
+        header.published_root = header.root;
+        return header.node_size != 0 && header.format == NodeType::Format;
     }
 
     void close()
     {
-        if(file.is_open())
+        assert(snapshots.empty());
+        reclaim();
+        std::unique_lock lock(mutex);
+        close_locked();
+    }
+
+    // Writes back every modified node in id order, so the writes are sequential, followed by the header
+    void flush()
+    {
+        reclaim();
+        std::unique_lock lock(mutex);
+        flush_locked();
+    }
+
+    // Allocates a new node, reusing a freed slot if there is one
+    Ptr alloc()
+    {
+        std::unique_lock lock(mutex);
+        if(header.free_head)
         {
-            file.seek(0);
-            file.write(reinterpret_cast<char *>(&header), sizeof(header));
-            file.close();
+            auto node = load_locked(header.free_head);
+            assert(node.valid());
+            header.free_head = node->next;
+            header.free_count--;
+
+            const uint64_t id = node->id;
+            *node = NodeType(header);
+            node->id = id;
+            node->dirty = true;
+            mark_fresh(id);
+            return node;
         }
+
+        auto &frame = cache_node(alloc_node());
+        mark_fresh(frame.node.id);
+        return Ptr(&frame);
     }
 
-    NodePtr alloc()
+    /*!
+     * Returns a node's slot to the free list. The node must no longer be referenced by the tree.
+     * In copy-on-write mode, published nodes are only freed once no snapshot can see them.
+     */
+    void free(Ptr &node)
     {
-        NodePtr ptr{this, &cache_node(alloc_node())};
-        return ptr;
+        if(shared(node))
+        {
+            retired[header.generation].emplace_back(node->id);
+            return;
+        }
+
+        std::unique_lock lock(mutex);
+        free_locked(node);
     }
 
-    void free(Node *node)
+    [[nodiscard]] bool copy_on_write() const
     {
-        write_node(node);
-        uncache_node(node);
+        return header.copy_on_write;
     }
 
-    NodePtr load_root()
+    // Checks if a node is part of the published version, so mustn't be modified in copy-on-write mode
+    [[nodiscard]] bool shared(const Ptr &node) const
     {
-        return load(header.root);
+        return header.copy_on_write && !fresh.contains(node->id);
     }
 
-    NodePtr load(uint64_t id)
+    /*!
+     * Gets a version of a node which can be modified. Outside of copy-on-write mode, or if the node
+     * was created since the last publish, that's the node itself. Otherwise it's a new copy, and the
+     * original is retired. Whatever references the node must be updated to point at the copy.
+     *
+     * @param node The node about to be modified
+     * @return The node to modify instead
+     */
+    Ptr shadow(Ptr node)
     {
-        if(!id)
+        if(!node.valid() || !shared(node))
         {
-            return {nullptr, nullptr};
+            return node;
         }
 
-        // Check in-memory working set first
-        auto const iter = nodes.find(id);
-        if(iter != nodes.end())
+        auto copy = alloc();
+        const uint64_t id = copy->id;
+        *copy = *node;
+        copy->id = id;
+        copy->dirty = true;
+        retired[header.generation].emplace_back(node->id);
+        return copy;
+    }
+
+    /*!
+     * Publishes the current root as a new version in copy-on-write mode, making it what new snapshots
+     * see. Slots retired by earlier versions are freed if no snapshot can see them any more.
+     */
+    void publish()
+    {
+        if(!header.copy_on_write)
         {
-            return {this, &iter->second};
+            return;
         }
 
-        // Couldn't find it, fallback to disk
-        Node ret;
-        if(id < header.node_count && read_node(id, &ret))
         {
-            return {this, &cache_node(ret)};
+            std::lock_guard lock(snapshot_mutex);
+            header.published_root = header.root;
+            header.generation++;
+        }
+        fresh.clear();
+        reclaim();
+    }
+
+    /*!
+     * Registers a snapshot of the last published version
+     *
+     * @param root Set to the version's root
+     * @return The version's generation, to pass to release_snapshot()
+     */
+    uint64_t acquire_snapshot(uint64_t &root)
+    {
+        assert(header.copy_on_write);
+        std::lock_guard lock(snapshot_mutex);
+        root = header.published_root;
+        snapshots.insert(header.generation);
+        return header.generation;
+    }
+
+    // Lets go of a snapshot. Anything only it could see is freed on the next publish or flush.
+    void release_snapshot(uint64_t generation)
+    {
+        std::lock_guard lock(snapshot_mutex);
+        auto iter = snapshots.find(generation);
+        assert(iter != snapshots.end());
+        snapshots.erase(iter);
+    }
+
+    /*!
+     * Moves nodes from the end of the file into free slots, so that the live nodes
+     * are packed at the start and the free list is empty, then truncates the file so the
+     * filesystem can reuse the space. Every live node is visited.
+     *
+     * @return The number of slots reclaimed
+     */
+    uint64_t compact()
+    {
+        if(!snapshots.empty())
+        {
+            throw std::logic_error("Can't compact while there are snapshots");
+        }
+        reclaim();
+
+        std::unique_lock lock(mutex);
+        const uint64_t live = header.node_count - 1 - header.free_count;
+
+        // Free slots within the live range are where nodes past it get moved to
+        std::vector<uint64_t> targets;
+        for(uint64_t id = header.free_head; id;)
+        {
+            auto node = load_locked(id);
+            if(id <= live)
+            {
+                targets.emplace_back(id);
+            }
+            id = node->next;
+        }
+
+        uint64_t prev_leaf = 0;
+        if(header.root)
+        {
+            header.root = relocate(header.root, live, targets, prev_leaf);
+        }
+        assert(targets.empty());
+
+        const uint64_t reclaimed = header.free_count;
+        header.node_count = live + 1;
+        header.free_head = 0;
+        header.free_count = 0;
+        header.published_root = header.root;
+        fresh.clear();
+
+        // Forget about anything cached from past the new end, so the ids can be allocated again
+        for(auto &frame : frames)
+        {
+            if(frame.node.id >= header.node_count)
+            {
+                assert(!frame.pins);
+                nodes.erase(frame.node.id);
+                frame.node = NodeType();
+                frame.referenced = false;
+            }
+        }
+
+        // Hand the slots past the new end back to the filesystem
+        (void)file.truncate(header.node_count * header.node_size);
+        return reclaimed;
+    }
+
+    Ptr load_root()
+    {
+        return load(root());
+    }
+
+    Ptr load(uint64_t id)
+    {
+        if(!id)
+        {
+            return Ptr();
+        }
+
+        // Check in-memory working set first, which only needs a shared lock
+        {
+            std::shared_lock lock(mutex);
+            if(auto node = find_cached(id); node.valid())
+            {
+                return node;
+            }
         }
 
-        return {nullptr, nullptr};
+        // Another thread may have loaded it before we got the exclusive lock
+        std::unique_lock lock(mutex);
+        return load_locked(id);
     }
 
-    void set_root(NodePtr &node)
+    [[nodiscard]] CacheStats cache_stats() const
     {
-        header.root = node->id;
+        std::shared_lock lock(mutex);
+        CacheStats ret = stats;
+        ret.hits = hits;
+        return ret;
+    }
+
+    // The root's id, which may be read while another thread sets it
+    [[nodiscard]] uint64_t root() const
+    {
+        return std::atomic_ref(const_cast<uint64_t &>(header.root)).load(std::memory_order_acquire);
+    }
+
+    void set_root(const Ptr &node)
+    {
+        std::atomic_ref(header.root).store(node.valid() ? node->id : 0, std::memory_order_release);
     }
 
     uint64_t &height()
@@ -105,42 +372,346 @@ public:
         return header.height;
     }
 
+    [[nodiscard]] uint64_t order() const
+    {
+        return header.order;
+    }
+
+    uint64_t &size()
+    {
+        return header.size;
+    }
+
+    [[nodiscard]] uint64_t size() const
+    {
+        return header.size;
+    }
+
+    [[nodiscard]] bool duplicates() const
+    {
+        return header.duplicates;
+    }
+
+    [[nodiscard]] uint64_t key_width() const
+    {
+        return header.key_width;
+    }
+
+    // Bytes per node on disk
+    [[nodiscard]] uint64_t node_size() const
+    {
+        return header.node_size;
+    }
+
+    // Number of node slots in the file, including free ones
+    [[nodiscard]] uint64_t node_count() const
+    {
+        return header.node_count - 1;
+    }
+
+    [[nodiscard]] uint64_t free_count() const
+    {
+        return header.free_count;
+    }
+
+    static constexpr uint64_t NodeSize(uint64_t order, uint64_t key_width = 1)
+    {
+        return NodeType::Size(order, key_width);
+    }
+
+    static constexpr uint64_t OrderForSize(uint64_t size, uint64_t key_width = 1)
+    {
+        return NodeType::OrderForSize(size, key_width);
+    }
+
 private:
-    Node alloc_node()
+    void close_locked()
+    {
+        if(file.is_open())
+        {
+            flush_locked();
+            assert(std::none_of(frames.begin(), frames.end(), [](const Frame &frame) { return frame.pins.load(); }));
+            frames.clear();
+            nodes.clear();
+            hand = 0;
+            file.close();
+        }
+    }
+
+    void flush_locked()
+    {
+        std::vector<NodeType *> dirty;
+        for(auto &frame : frames)
+        {
+            if(frame.node.id && frame.node.dirty)
+            {
+                dirty.emplace_back(&frame.node);
+            }
+        }
+
+        std::sort(dirty.begin(), dirty.end(), [](const NodeType *a, const NodeType *b) { return a->id < b->id; });
+        for(auto node : dirty)
+        {
+            write_node(node);
+        }
+        write_header();
+    }
+
+    void free_locked(Ptr &node)
     {
-        Node node;
+        node->make_free(header.free_head);
+        header.free_head = node->id;
+        header.free_count++;
+    }
+
+    // New nodes aren't part of any published version, so can be modified in place until the next publish
+    void mark_fresh(uint64_t id)
+    {
+        if(header.copy_on_write)
+        {
+            fresh.insert(id);
+        }
+    }
+
+    // Frees retired slots which no snapshot can see. A slot retired in a generation is visible to snapshots of that generation or older.
+    void reclaim()
+    {
+        uint64_t oldest;
+        {
+            // Slots retired since the last publish are still part of the published version
+            std::lock_guard lock(snapshot_mutex);
+            oldest = snapshots.empty() ? header.generation : std::min(header.generation, *snapshots.begin());
+        }
+
+        while(!retired.empty() && retired.begin()->first < oldest)
+        {
+            for(auto id : retired.begin()->second)
+            {
+                auto node = load(id);
+                std::unique_lock lock(mutex);
+                free_locked(node);
+            }
+            retired.erase(retired.begin());
+        }
+    }
+
+    // Pins a node if it's cached. Needs at least a shared lock.
+    Ptr find_cached(uint64_t id)
+    {
+        auto const iter = nodes.find(id);
+        if(iter == nodes.end())
+        {
+            return Ptr();
+        }
+
+        auto &frame = frames[iter->second];
+        frame.pins++;
+        frame.referenced.store(true, std::memory_order_relaxed);
+        hits.fetch_add(1, std::memory_order_relaxed);
+        return Ptr(&frame);
+    }
+
+    // Loads a node, from disk if needed. Needs the exclusive lock.
+    Ptr load_locked(uint64_t id)
+    {
+        if(auto node = find_cached(id); node.valid())
+        {
+            return node;
+        }
+
+        // Couldn't find it, fallback to disk
+        stats.misses++;
+        NodeType ret;
+        if(id < header.node_count && read_node(id, &ret))
+        {
+            return Ptr(&cache_node(std::move(ret)));
+        }
+
+        return Ptr();
+    }
+
+    // Moves a subtree's nodes to within the first 'live' slots, returning the subtree's new root id
+    uint64_t relocate(uint64_t id, uint64_t live, std::vector<uint64_t> &targets, uint64_t &prev_leaf)
+    {
+        auto node = load_locked(id);
+        if(id > live)
+        {
+            assert(!targets.empty());
+            auto target = load_locked(targets.back());
+            targets.pop_back();
+
+            const uint64_t new_id = target->id;
+            *target = std::move(*node);
+            target->id = new_id;
+            target->dirty = true;
+
+            // The old slot will be past the end of the file, so never needs writing
+            node->make_free(0);
+            node->dirty = false;
+            node = std::move(target);
+        }
+
+        if(node->leaf)
+        {
+            // Leaves are visited in key order, so fix up the previous leaf's link in case either moved
+            if(prev_leaf)
+            {
+                auto prev = load_locked(prev_leaf);
+                if(prev->next != node->id)
+                {
+                    prev->next = node->id;
+                    prev->dirty = true;
+                }
+            }
+            prev_leaf = node->id;
+            return node->id;
+        }
+
+        for(size_t a = 0; a < node->child_count(); a++)
+        {
+            const uint64_t child = relocate(node->children[a], live, targets, prev_leaf);
+            if(child != node->children[a])
+            {
+                node->children[a] = child;
+                node->dirty = true;
+            }
+        }
+        return node->id;
+    }
+
+    // New nodes aren't written until they're flushed or evicted
+    NodeType alloc_node()
+    {
+        NodeType node(header);
         node.id = header.node_count++;
-        assert(write_node(&node));
+        node.dirty = true;
         return node;
     }
 
-    bool read_node(uint64_t id, Node *in)
+    bool read_node(uint64_t id, NodeType *in)
     {
-        file.seek(sizeof(NodeStoreHeader) + ((id - 1) * sizeof(Node)));
-        file.read(reinterpret_cast<char *>(in), sizeof(Node));
+        // Parse the node straight out of the filesystem's page if it can hand it out, rather than copying it
+        file.seek(id * header.node_size);
+        if(const char *data = file.view(header.node_size))
+        {
+            in->read(data, header);
+            return true;
+        }
+
+        scratch.resize(header.node_size);
+        if(file.read(scratch.data(), header.node_size) != header.node_size)
+        {
+            return false;
+        }
+
+        in->read(scratch.data(), header);
         return true;
     }
 
-    bool write_node(Node *out)
+    bool write_node(NodeType *out)
     {
-        file.seek(sizeof(NodeStoreHeader) + ((out->id - 1) * sizeof(Node)));
-        file.write(reinterpret_cast<char *>(out), sizeof(Node));
+        // Always write the whole slot so each node fills exactly one page
+        scratch.assign(header.node_size, 0);
+        out->write(scratch.data());
+
+        // Nodes can be written out of order, so pad out the file if this one's past the end
+        const uint64_t offset = out->id * header.node_size;
+        uint64_t end = file.seek(offset);
+        if(end < offset)
+        {
+            std::vector<char> padding(header.node_size);
+            for(; end < offset; end += header.node_size)
+            {
+                file.write(padding.data(), padding.size());
+            }
+        }
+
+        file.write(scratch.data(), header.node_size);
+        out->dirty = false;
+        stats.writes++;
         return true;
     }
 
-    Node &cache_node(Node node)
+    void write_header()
+    {
+        // Pad the header out to a full node slot, so that node 1 starts on the next page
+        std::vector<char> buffer(header.node_size);
+        memcpy(buffer.data(), &header, sizeof(header));
+        file.seek(0);
+        file.write(buffer.data(), buffer.size());
+    }
+
+    // Puts a node in a frame, pinned once for the caller's NodePtr
+    Frame &cache_node(NodeType node)
     {
-        return nodes.emplace(node.id, node).first->second;
+        size_t index = acquire_frame();
+        auto &frame = frames[index];
+        frame.node = std::move(node);
+        frame.pins = 1;
+        frame.referenced = true;
+        nodes.emplace(frame.node.id, index);
+        return frame;
     }
 
-    void uncache_node(Node *node)
+    // Finds a frame for a new node, writing back and evicting an unpinned node if the cache is full
+    size_t acquire_frame()
     {
-        nodes.erase(node->id);
+        if(frames.size() < capacity)
+        {
+            frames.emplace_back();
+            return frames.size() - 1;
+        }
+
+        // Two sweeps are enough to find a victim if any frame is unpinned
+        for(size_t scanned = 0; scanned < frames.size() * 2; scanned++)
+        {
+            size_t index = hand;
+            auto &frame = frames[index];
+            hand = (hand + 1) % frames.size();
+            if(frame.pins.load(std::memory_order_acquire))
+            {
+                continue;
+            }
+            if(frame.referenced)
+            {
+                frame.referenced = false;
+                continue;
+            }
+
+            if(frame.node.dirty)
+            {
+                write_node(&frame.node);
+            }
+            nodes.erase(frame.node.id);
+            stats.evictions++;
+            return index;
+        }
+
+        // Everything is pinned, so go over capacity rather than fail. Frames are in a deque, so existing nodes don't move.
+        frames.emplace_back();
+        return frames.size() - 1;
     }
 
     NodeStoreHeader header;
     Filesystem::Handle file;
-    std::unordered_map<uint64_t, Node> nodes;
+    std::deque<Frame> frames;
+    std::unordered_map<uint64_t, size_t> nodes; // Node id to frame index
+    size_t capacity;
+    size_t hand = 0; // Next frame for the clock to consider evicting
+    CacheStats stats; // Hits aren't counted here, as they happen under the shared lock
+    std::atomic<uint64_t> hits = 0;
+    std::vector<char> scratch;
+
+    // Shared for cache hits, exclusive for anything that changes which nodes are cached or touches the file
+    mutable std::shared_mutex mutex;
+
+    // Copy-on-write state. Only the writer touches the fresh and retired sets, snapshots may be taken from any thread.
+    std::unordered_set<uint64_t> fresh; // Nodes created since the last publish
+    std::map<uint64_t, std::vector<uint64_t>> retired; // Slots replaced in each generation, waiting for snapshots of it to go
+    std::multiset<uint64_t> snapshots; // Generation of each live snapshot
+    std::mutex snapshot_mutex;
 };
 
+using NodeStore = BasicNodeStore<Node>;
+
 #endif //TESTDB_NODESTORE_H
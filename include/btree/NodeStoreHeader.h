@@ -0,0 +1,29 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#ifndef TESTDB_NODESTOREHEADER_H
+#define TESTDB_NODESTOREHEADER_H
+
+#include <cstdint>
+
+// Stored in the first slot of a node store's file
+struct NodeStoreHeader
+{
+    uint64_t root = 0;
+    uint64_t height = 0;
+    uint64_t node_count = 1;
+    uint64_t order = 0; // Maximum children per node, for node formats with a fixed number of keys
+    uint64_t node_size = 0; // Bytes reserved per node on disk. The header occupies slot 0.
+    uint64_t free_head = 0; // First freed node slot. Each free node's 'next' links to the one after.
+    uint64_t free_count = 0;
+    uint64_t size = 0; // Number of entries in the tree
+    uint64_t duplicates = 0; // Non-zero if keys can repeat, in which case entries are ordered by key then value
+    uint64_t key_width = 1; // Words per key, for node formats with fixed size keys
+    uint64_t format = 0; // Which node type the store holds, so a store can't be opened as the wrong kind of tree
+    uint64_t copy_on_write = 0; // Non-zero if nodes in the published tree are copied rather than modified
+    uint64_t generation = 0; // Bumped each time a copy-on-write store publishes a new version
+    uint64_t published_root = 0; // Root of the last published version, which snapshots read from
+};
+
+#endif //TESTDB_NODESTOREHEADER_H
@@ -0,0 +1,317 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#ifndef TESTDB_STRINGNODE_H
+#define TESTDB_STRINGNODE_H
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "NodePtr.h"
+#include "NodeStoreHeader.h"
+
+struct StringNode;
+using StringNodePtr = BasicNodePtr<StringNode>;
+
+/*!
+ * A tree node holding variable length byte string keys, for StringTree.
+ *
+ * On disk each node is a slotted page. The header is followed by the prefix shared by
+ * every key in the node, which is only stored once, then a directory of 16-bit cell offsets
+ * in key order. The cells follow, each holding the rest of a key after the prefix, and the
+ * value (leaves) or right child (internal nodes) that goes with it:
+ *
+ *   id, next, leftmost child, count, leaf, prefix length | prefix | slots[count] | cells | unused
+ *   cell: suffix length (16 bits), suffix, value or child (64 bits)
+ *
+ * In memory the keys are kept whole, and the page is rebuilt when the node is written out.
+ * A node is full once its encoded form would no longer fit in a page, so how many keys fit
+ * depends on how long they are and how much of them they have in common.
+ */
+struct StringNode
+{
+    // Identifies stores of this node type
+    static constexpr uint64_t Format = 1;
+
+    // Bytes used by the fixed part of the page
+    static constexpr size_t HeaderSize = 3 * sizeof(uint64_t) + 3 * sizeof(uint16_t);
+
+    // Bytes used by each key besides its suffix: the slot, suffix length and value or child
+    static constexpr size_t CellOverhead = 2 * sizeof(uint16_t) + sizeof(uint64_t);
+
+    StringNode()=default;
+
+    explicit StringNode(const NodeStoreHeader &)
+    {
+
+    }
+
+    /*!
+     * Fills in the node layout for a new store. Keys are variable length, so there's no fixed order.
+     *
+     * @param header The new store's header, with the node size set
+     * @param order Unused
+     * @return True on success, false if pages are too small or too large to address with 16-bit offsets
+     */
+    static bool Layout(NodeStoreHeader &header, uint64_t)
+    {
+        header.order = 0;
+        return header.node_size <= UINT16_MAX && MaxKeySize(header.node_size) >= 16;
+    }
+
+    /*!
+     * The longest key a page can hold. Keys are limited to a quarter of a page, so a node
+     * that overflows can always be split into two halves which fit, and internal nodes
+     * always have room for several separators.
+     *
+     * @param node_size Bytes per node
+     * @return The maximum key length, in bytes
+     */
+    static constexpr size_t MaxKeySize(size_t node_size)
+    {
+        return node_size < HeaderSize + 4 * CellOverhead ? 0 : (node_size - HeaderSize) / 4 - CellOverhead;
+    }
+
+    static size_t common_prefix(std::string_view a, std::string_view b)
+    {
+        const size_t len = std::min(a.size(), b.size());
+        return std::mismatch(a.begin(), a.begin() + len, b.begin()).first - a.begin();
+    }
+
+    uint64_t id = 0;
+    bool leaf = true;
+    uint64_t next = 0; // Right sibling, for leaves
+    bool dirty = false; // Modified since it was last written. Set this when changing fields directly.
+    std::vector<std::string> keys;
+    std::vector<uint64_t> values; // One per key, only used by leaves
+    std::vector<uint64_t> children; // One more than there are keys, only used by internal nodes
+    size_t key_bytes = 0; // Total length of the keys, kept up to date by insert and erase
+
+    [[nodiscard]] size_t count() const
+    {
+        return keys.size();
+    }
+
+    // Number of children, which is zero for leaves
+    [[nodiscard]] size_t child_count() const
+    {
+        return leaf ? 0 : children.size();
+    }
+
+    // Length of the prefix shared by every key. Keys are sorted, so it's the prefix shared by the first and last.
+    [[nodiscard]] size_t prefix_size() const
+    {
+        return keys.empty() ? 0 : common_prefix(keys.front(), keys.back());
+    }
+
+    // Bytes needed to write the node out
+    [[nodiscard]] size_t size() const
+    {
+        const size_t prefix = prefix_size();
+        return HeaderSize + prefix + keys.size() * (CellOverhead - prefix) + key_bytes;
+    }
+
+    /*!
+     * Finds where a key is, or would go
+     *
+     * @param key The key to look for
+     * @param location Set to the position of the first key which is >= key
+     * @return True if the key was found at that position
+     */
+    bool search(std::string_view key, size_t &location) const
+    {
+        auto iter = std::lower_bound(keys.begin(), keys.end(), key, [](const std::string &a, std::string_view b) { return std::string_view(a) < b; });
+        location = iter - keys.begin();
+        return iter != keys.end() && *iter == key;
+    }
+
+    // Inserts a key at the given position, along with its value, or the child to its right if this is an internal node
+    void insert(size_t position, std::string key, uint64_t val_or_child)
+    {
+        assert(position <= keys.size());
+        key_bytes += key.size();
+        keys.insert(keys.begin() + position, std::move(key));
+        if(leaf)
+        {
+            values.insert(values.begin() + position, val_or_child);
+        }
+        else
+        {
+            children.insert(children.begin() + position + 1, val_or_child);
+        }
+        dirty = true;
+    }
+
+    // Removes a key, and its value or the child to its right
+    void erase(size_t position)
+    {
+        assert(position < keys.size());
+        key_bytes -= keys[position].size();
+        keys.erase(keys.begin() + position);
+        if(leaf)
+        {
+            values.erase(values.begin() + position);
+        }
+        else
+        {
+            children.erase(children.begin() + position + 1);
+        }
+        dirty = true;
+    }
+
+    /*!
+     * Moves the upper part of the node into an empty node of the same kind. For leaves the keys
+     * from 'position' onwards move along with their values. For internal nodes the key at
+     * 'position' is removed to become the separator, and the keys and children after it move.
+     *
+     * @param position Where to split the node
+     * @param to The node to move the upper part into
+     * @return The removed separator, or an empty string for leaves
+     */
+    std::string split(size_t position, StringNode &to)
+    {
+        assert(to.keys.empty() && to.leaf == leaf && position < keys.size());
+        std::string separator;
+        if(!leaf)
+        {
+            to.children.assign(children.begin() + position + 1, children.end());
+            children.resize(position + 1);
+            separator = std::move(keys[position]);
+            key_bytes -= separator.size();
+            keys.erase(keys.begin() + position);
+        }
+        else
+        {
+            to.values.assign(values.begin() + position, values.end());
+            values.resize(position);
+        }
+
+        for(size_t a = position; a < keys.size(); a++)
+        {
+            key_bytes -= keys[a].size();
+            to.key_bytes += keys[a].size();
+        }
+        to.keys.assign(std::make_move_iterator(keys.begin() + position), std::make_move_iterator(keys.end()));
+        keys.resize(position);
+        dirty = to.dirty = true;
+        return separator;
+    }
+
+    // Appends a right sibling's keys. For internal nodes, the parent's separator between the two goes in the middle.
+    void merge_right(StringNode &right, std::string separator)
+    {
+        assert(right.leaf == leaf);
+        if(!leaf)
+        {
+            key_bytes += separator.size();
+            keys.emplace_back(std::move(separator));
+            children.insert(children.end(), right.children.begin(), right.children.end());
+        }
+        else
+        {
+            values.insert(values.end(), right.values.begin(), right.values.end());
+            next = right.next;
+        }
+        key_bytes += right.key_bytes;
+        keys.insert(keys.end(), std::make_move_iterator(right.keys.begin()), std::make_move_iterator(right.keys.end()));
+        dirty = true;
+    }
+
+    // Empties the node so its slot can be reused, linking it to the next free slot
+    void make_free(uint64_t next_free)
+    {
+        keys.clear();
+        values.clear();
+        children.clear();
+        key_bytes = 0;
+        leaf = true;
+        next = next_free;
+        dirty = true;
+    }
+
+    void read(const char *data, const NodeStoreHeader &)
+    {
+        *this = StringNode();
+        uint64_t leftmost;
+        uint16_t count, is_leaf, prefix;
+        const char *pos = data;
+        pos = read_field(pos, id);
+        pos = read_field(pos, next);
+        pos = read_field(pos, leftmost);
+        pos = read_field(pos, count);
+        pos = read_field(pos, is_leaf);
+        pos = read_field(pos, prefix);
+        leaf = is_leaf;
+        if(!leaf)
+        {
+            children.emplace_back(leftmost);
+        }
+
+        const std::string_view shared(pos, prefix);
+        const char *slots = pos + prefix;
+        keys.reserve(count);
+        for(size_t a = 0; a < count; a++)
+        {
+            uint16_t offset, suffix;
+            read_field(slots + a * sizeof(uint16_t), offset);
+            const char *cell = read_field(data + offset, suffix);
+
+            uint64_t val_or_child;
+            read_field(cell + suffix, val_or_child);
+            keys.emplace_back(shared);
+            keys.back().append(cell, suffix);
+            key_bytes += keys.back().size();
+            (leaf ? values : children).emplace_back(val_or_child);
+        }
+    }
+
+    // Writes the node into a page, which must be at least size() bytes
+    void write(char *data) const
+    {
+        const size_t prefix = prefix_size();
+        char *pos = data;
+        pos = write_field(pos, id);
+        pos = write_field(pos, next);
+        pos = write_field(pos, leaf ? uint64_t(0) : children.front());
+        pos = write_field(pos, static_cast<uint16_t>(keys.size()));
+        pos = write_field(pos, static_cast<uint16_t>(leaf));
+        pos = write_field(pos, static_cast<uint16_t>(prefix));
+        if(prefix)
+        {
+            memcpy(pos, keys.front().data(), prefix);
+        }
+        char *slots = pos + prefix;
+
+        char *cell = slots + keys.size() * sizeof(uint16_t);
+        for(size_t a = 0; a < keys.size(); a++)
+        {
+            const size_t suffix = keys[a].size() - prefix;
+            write_field(slots + a * sizeof(uint16_t), static_cast<uint16_t>(cell - data));
+            cell = write_field(cell, static_cast<uint16_t>(suffix));
+            memcpy(cell, keys[a].data() + prefix, suffix);
+            cell = write_field(cell + suffix, leaf ? values[a] : children[a + 1]);
+        }
+    }
+
+private:
+    template<typename T>
+    static const char *read_field(const char *data, T &out)
+    {
+        memcpy(&out, data, sizeof(T));
+        return data + sizeof(T);
+    }
+
+    template<typename T>
+    static char *write_field(char *data, const T &in)
+    {
+        memcpy(data, &in, sizeof(T));
+        return data + sizeof(T);
+    }
+};
+
+#endif //TESTDB_STRINGNODE_H
@@ -0,0 +1,139 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#ifndef TESTDB_STRINGTREE_H
+#define TESTDB_STRINGTREE_H
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include "filesystem/Filesystem.h"
+#include "btree/StringNode.h"
+#include "btree/NodeStore.h"
+
+using StringNodeStore = BasicNodeStore<StringNode>;
+
+/*!
+ * A B+tree mapping variable length byte string keys to values. Keys are unique,
+ * and are compared byte by byte as unsigned values, with a shorter key ordering
+ * before any longer key that it's a prefix of.
+ *
+ * Nodes are filled by bytes rather than by number of keys, and the prefix common to
+ * a node's keys is only stored once, so keys which share long prefixes (emails on the
+ * same domain, reference numbers, etc) pack densely. Separators in internal nodes are
+ * cut down to the shortest string which still divides the two leaves, which keeps the
+ * upper levels of the tree small.
+ */
+class StringTree
+{
+public:
+    /*!
+     * Walks the leaves of the tree in key order. Modifying the tree
+     * invalidates any iterators over it.
+     */
+    class Iterator
+    {
+    public:
+        /*!
+         * Positions the iterator at the first key which is >= key
+         *
+         * @param key The key to seek to
+         * @return True if there's such a key, false if the iterator is now at the end
+         */
+        bool seek(std::string_view key);
+
+        /*!
+         * Advances to the next key, following the leaf's sibling link if needed
+         *
+         * @return True if there's another key, false if the iterator is now at the end
+         */
+        bool next();
+
+        [[nodiscard]] bool valid() const;
+
+        // The current key. Only valid until the iterator moves.
+        [[nodiscard]] std::string_view key() const;
+        [[nodiscard]] uint64_t value() const;
+
+    private:
+        friend class StringTree;
+        explicit Iterator(StringTree *tree);
+        void skip_empty();
+
+        StringTree *tree;
+        StringNodePtr leaf;
+        size_t position = 0;
+    };
+
+    /*!
+     * @param cache_capacity Maximum number of nodes to keep in memory, unless more than that are in use at once
+     */
+    explicit StringTree(size_t cache_capacity = StringNodeStore::DefaultCapacity);
+    bool create(Filesystem::Handle file);
+    bool open(Filesystem::Handle file);
+
+    std::optional<uint64_t> search(std::string_view key);
+
+    /*!
+     * Adds a key to the tree
+     *
+     * @throws std::logic_error If the key is already in the tree
+     * @throws std::length_error If the key is longer than max_key_size()
+     * @param key The key to add
+     * @param val The value to go with it
+     */
+    void insert(std::string_view key, uint64_t val);
+
+    /*!
+     * Removes a key from the tree. Nodes are merged with a sibling once they've
+     * emptied out enough for the two to fit in one node.
+     *
+     * @param key The key to remove
+     * @return True if it was removed, false if it wasn't in the tree
+     */
+    bool erase(std::string_view key);
+
+    [[nodiscard]] uint64_t height();
+
+    // Number of entries in the tree
+    [[nodiscard]] uint64_t size() const;
+
+    // The longest key which can be inserted
+    [[nodiscard]] size_t max_key_size() const;
+    [[nodiscard]] StringNodeStore::CacheStats cache_stats() const;
+
+    // Number of node slots used by the tree's file, including any freed by erasing
+    [[nodiscard]] uint64_t node_count() const;
+
+    // Checkpoints the tree, writing back any modified nodes
+    void flush();
+
+    // Gets an iterator positioned at the smallest key
+    Iterator begin();
+
+    // Gets an iterator positioned at the first key >= key
+    Iterator seek(std::string_view key);
+
+private:
+    /*!
+     * Picks the shortest separator for a leaf split, which is as much of the right leaf's first key
+     * as is needed to tell it apart from the left leaf's last key. Anything >= it goes right.
+     */
+    static std::string shortest_separator(std::string_view left_last, std::string_view right_first);
+
+    // Finds the child of an internal node which would hold a key
+    static size_t child_position(const StringNodePtr &node, std::string_view key);
+
+    // Picks where to split an overflowing node, so that each half has around the same number of bytes
+    static size_t split_position(const StringNodePtr &node);
+    StringNodePtr find_leaf(std::string_view key);
+    void insert(StringNodePtr &node, std::string_view key, uint64_t val, std::string &separator, StringNodePtr &right_node);
+    void split(StringNodePtr &node, std::string &separator, StringNodePtr &right_node);
+    bool erase(StringNodePtr &node, std::string_view key);
+    void merge_child(StringNodePtr &node, size_t position);
+
+    StringNodeStore store;
+};
+
+#endif //TESTDB_STRINGTREE_H
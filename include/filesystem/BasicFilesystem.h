@@ -10,25 +10,58 @@
 #include <memory>
 #include "filesystem/Filesystem.h"
 #include "FilesystemBacking.h"
+#include "filesystem/PagePool.h"
+#include "filesystem/WriteAheadLog.h"
 
 struct FILE_HEADER
 {
+    // Files without both of these were made by another version, with a different layout
+    static constexpr uint64_t Magic = 0x53464c5153524646; // "FFRSQLFS"
+    static constexpr uint64_t Version = 1;
+
+    uint64_t magic = Magic;
+    uint64_t version = Version;
     uint64_t stream_count = 0;
+    uint64_t bitmap_page = 0; // First page of the free space bitmap, if any page has been freed yet
+    uint64_t stream_page = 0; // First page of the stream headers which don't fit in the first page, if any
 } __attribute__((packed));
 
 #define PAGE_SIZE 0x1000
 struct PAGE_HEADER;
 struct STREAM_HEADER;
+struct PAGE_TABLE;
+struct StreamHandle;
 class BasicFilesystem : public Filesystem
 {
 public:
-    explicit BasicFilesystem(std::unique_ptr<FilesystemBacking> backing);
+    // Streams grow by extents of contiguous pages, each as long as the stream so far, up to this many pages
+    static constexpr uint64_t MaxExtentPages = 64;
+
+    // Pages prefetched ahead of a stream being read sequentially. The window starts small, and doubles for each page read in order.
+    static constexpr uint64_t InitialReadAhead = 4;
+    static constexpr uint64_t MaxReadAhead = 32;
+
+    // Commits checkpoint the filesystem once its write-ahead log has grown past this many bytes
+    static constexpr uint64_t CheckpointLogSize = 32 * 1024 * 1024;
+
+    /*!
+     * With a write-ahead log, commit() only has to append the changed pages to the log and sync
+     * it, rather than sync every page back to the backing. Pages are written back lazily, and
+     * changes which haven't been committed yet are kept in memory until they are. Anything
+     * committed but not written back when the process stopped is recovered from the log here.
+     *
+     * @param backing Where the filesystem is stored, which must have been formatted
+     * @param cache_budget Bytes of pages to keep cached in memory
+     * @param log Where to keep the write-ahead log, or null to not have one
+     */
+    explicit BasicFilesystem(std::unique_ptr<FilesystemBacking> backing, size_t cache_budget = PagePool::DefaultBudget, std::unique_ptr<FilesystemBacking> log = nullptr);
     ~BasicFilesystem() override;
     BasicFilesystem(BasicFilesystem&&)=delete;
     BasicFilesystem(const Filesystem&)=delete;
     void operator=(BasicFilesystem&&)=delete;
     void operator=(const BasicFilesystem&&)=delete;
 
+    // Writes an empty filesystem to the start of the backing
     static bool Format(const std::unique_ptr<FilesystemBacking> &backing);
     Filesystem::Handle open(const std::string &name, bool create) override;
     void close(void *handle) override;
@@ -36,20 +69,104 @@ public:
     void write(void *handle, const char *buf, uint64_t len) override;
     uint64_t seek(void *handle, uint64_t position) override;
     uint64_t tell(void *handle) override;
+    bool truncate(void *handle, uint64_t size) override;
+    bool remove(const std::string &name) override;
+    const char *view(void *handle, uint64_t len) override;
+    uint64_t page_size() override;
+    void flush() override;
+    bool commit() override;
+
+    /*!
+     * The first half of commit(), which gets the changes into the log without waiting for them to
+     * become durable. Threads sharing a filesystem can call this while holding their lock on it,
+     * then wait_durable() once they've let go, so their commits are synced together.
+     *
+     * Without a log, changes are written back and synced here instead.
+     *
+     * @return What to pass to wait_durable(), or nothing on failure
+     */
+    std::optional<uint64_t> log_commit();
+
+    /*!
+     * The second half of commit(). Safe to call from several threads at once.
+     *
+     * @param lsn What log_commit() returned
+     * @return True once the commit is durable, false if the log couldn't be synced
+     */
+    bool wait_durable(uint64_t lsn);
+    [[nodiscard]] PagePool::Stats cache_stats() const;
+
+    // The write-ahead log's counters, which are all zero if there's no log
+    [[nodiscard]] WriteAheadLog::Stats log_stats() const;
 
 private:
+    // Reads the file header and stream table. Fails if the backing wasn't formatted by this version.
     bool load();
     bool create(const std::string &name);
 
+    // Writes back every committed page, then starts the write-ahead log over
+    bool checkpoint();
+
+    // Copies the sizes of streams which have grown into the stream table
+    void write_stream_sizes();
+
+    // Gets a stream's page table, loading it from its map pages the first time
+    PAGE_TABLE *page_table(const STREAM_HEADER &stream);
+
+    // Adds a newly allocated page to the end of a stream's page table, and its map pages
+    void append_page_table(PAGE_TABLE &table, uint64_t page);
+
     PAGE_HEADER read_page_header(uint64_t index);
     STREAM_HEADER read_stream_header(uint64_t index);
+
+    // Gets the page and offset which a stream's header is kept at
+    std::pair<uint64_t, uint64_t> stream_header_location(uint64_t index) const;
+
+    // Copies the file header into the first page, whenever it changes
+    void write_file_header();
     void write_stream_header(uint64_t index, const STREAM_HEADER &header);
     void write_page_header(const PAGE_HEADER &header);
+
+    // Allocates a page on its own, at the end of the file
     uint64_t alloc_page(uint64_t previous_page);
 
-    std::vector<STREAM_HEADER> streams;
+    // Allocates the next page of a stream from its current extent, starting a new extent if that's used up
+    uint64_t alloc_stream_page(uint64_t stream_id, uint64_t previous_page);
+
+    // Sets up a newly allocated page in the pool, without reading it
+    void init_page(uint64_t page, uint64_t previous_page);
+
+    // Called as a read moves onto a page, to keep the pages after it prefetched if the stream's being read in order
+    void read_ahead(StreamHandle &handle);
+
+    // Loads the free space bitmap from its pages
+    void load_free_map();
+
+    /*!
+     * Finds the first run of free pages
+     *
+     * @param max_length The most pages wanted
+     * @return The first page of the run and its length, up to max_length. The length is 0 if there are no free pages.
+     */
+    std::pair<uint64_t, uint64_t> find_free_run(uint64_t max_length);
+
+    // Marks a page as free or in use, in memory and in the bitmap pages
+    void set_free(uint64_t page, bool free);
+
+    // Frees every page of a stream's page map past the first 'keep' entries, shortening the map to match
+    void truncate_page_map(const STREAM_HEADER &stream, PAGE_TABLE &table, uint64_t keep);
+
+    std::vector<STREAM_HEADER> streams; // Extents and sizes are kept up to date here, as handles only have copies
+    std::vector<std::unique_ptr<PAGE_TABLE>> page_tables; // Indexed by stream id, shared by the stream's handles
     std::unique_ptr<FilesystemBacking> backing;
+    std::unique_ptr<WriteAheadLog> wal; // Null if changes aren't logged
+    PagePool pool; // Every page access goes through here, rather than to the backing
     FILE_HEADER fs_header;
+    uint64_t page_count = 0; // Pages in the filesystem, including any not written back yet
+    std::vector<uint64_t> free_map; // One bit per page, set if the page is free
+    std::vector<uint64_t> bitmap_pages; // Where free_map is stored, in order
+    std::vector<uint64_t> stream_pages; // Where the stream headers past the first page are stored, in order
+    uint64_t free_count = 0;
 };
 
 
@@ -83,6 +83,23 @@ public:
             return fs->tell(ref);
         }
 
+        uint64_t page_size()
+        {
+            return fs->page_size();
+        }
+
+        // Shrinks the stream to 'size' bytes, see Filesystem::truncate
+        bool truncate(uint64_t size)
+        {
+            return fs->truncate(ref, size);
+        }
+
+        // Gets the next 'len' bytes of the stream without copying them, see Filesystem::view
+        const char *view(uint64_t len)
+        {
+            return fs->view(ref, len);
+        }
+
 
     private:
         Filesystem *fs;
@@ -96,6 +113,59 @@ public:
     virtual void write(void *handle, const char *buf, uint64_t len) = 0;
     virtual uint64_t seek(void *handle, uint64_t position) = 0;
     virtual uint64_t tell(void *handle) = 0;
+
+    /*!
+     * Shrinks a stream, giving the pages past its new end back to the filesystem. The position
+     * is moved back to the new end if it was past it. Doesn't do anything if the stream is
+     * already no bigger than 'size'.
+     *
+     * @param handle The stream
+     * @param size The new size, in bytes
+     * @return True on success, false if the stream is open in another handle
+     */
+    virtual bool truncate(void *handle, uint64_t size) = 0;
+
+    /*!
+     * Deletes a stream, giving all of its pages back to the filesystem
+     *
+     * @param name The stream to delete
+     * @return True on success, false if there's no such stream, or it's open
+     */
+    virtual bool remove(const std::string &name) = 0;
+
+    /*!
+     * Gets a pointer to the next bytes of a stream and moves past them, like read but without
+     * copying. Only possible if the bytes are all within one page, and the filesystem has
+     * the page in memory. The pointer is valid until the next call into the filesystem.
+     *
+     * @param handle The stream
+     * @param len The number of bytes needed
+     * @return The bytes, or nullptr if they can't be viewed in place, in which case the position is unchanged
+     */
+    virtual const char *view(void *, uint64_t)
+    {
+        return nullptr;
+    }
+
+    // Usable bytes per page, excluding any per-page bookkeeping
+    virtual uint64_t page_size() = 0;
+
+    // Writes anything the filesystem has cached through to its storage
+    virtual void flush()
+    {
+
+    }
+
+    /*!
+     * Makes every change so far durable, so that it survives a crash
+     *
+     * @return True on success, false if the changes may not have reached storage
+     */
+    virtual bool commit()
+    {
+        flush();
+        return true;
+    }
 };
 
 
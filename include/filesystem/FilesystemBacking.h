@@ -5,9 +5,24 @@
 #ifndef TESTDB_FILESYSTEMBACKING_H
 #define TESTDB_FILESYSTEMBACKING_H
 
+#include <cassert>
+#include <cstring>
 #include <fstream>
 #include <string>
 
+// One read or write in a batch
+struct IoRequest
+{
+    uint64_t offset = 0;
+    char *buf = nullptr;
+    uint64_t len = 0;
+};
+
+/*!
+ * The storage underneath a filesystem. Data can either be accessed through a cursor, with
+ * seekg then read or write, or positionally with read_at and write_at. The positional calls
+ * don't touch the cursor, so they can be used without having to track where it's been left.
+ */
 class FilesystemBacking
 {
 public:
@@ -15,11 +30,99 @@ public:
     [[nodiscard]] virtual bool open(const std::string &path, bool create) = 0;
     [[nodiscard]] virtual bool write(const char *buf, uint64_t buflen) = 0;
     [[nodiscard]] virtual bool read(char *buf, uint64_t buflen) = 0;
+
+    /*!
+     * Reads from a given offset, leaving the cursor where it is
+     *
+     * @param offset Where to read from
+     * @param buf Where to read into
+     * @param buflen How many bytes to read
+     * @return True on success, false on failure, including if the range goes past the end
+     */
+    [[nodiscard]] virtual bool read_at(uint64_t offset, char *buf, uint64_t buflen) = 0;
+
+    /*!
+     * Writes at a given offset, leaving the cursor where it is. Writing past the end extends the file.
+     *
+     * @param offset Where to write to
+     * @param buf The data to write
+     * @param buflen How many bytes to write
+     * @return True on success, false on failure
+     */
+    [[nodiscard]] virtual bool write_at(uint64_t offset, const char *buf, uint64_t buflen) = 0;
+
+    // The size of the file, in bytes
+    [[nodiscard]] virtual uint64_t size() = 0;
+
+    /*!
+     * Carries out several positional reads. Backings which can have more than one request in
+     * flight at once issue them all together, otherwise they're done one after another.
+     *
+     * @param requests The reads
+     * @param count How many there are
+     * @return True if every read succeeded
+     */
+    [[nodiscard]] virtual bool read_batch(const IoRequest *requests, size_t count)
+    {
+        bool ok = true;
+        for(size_t a = 0; a < count; a++)
+        {
+            ok &= read_at(requests[a].offset, requests[a].buf, requests[a].len);
+        }
+        return ok;
+    }
+
+    /*!
+     * Carries out several positional writes, like read_batch
+     *
+     * @param requests The writes. The buffers aren't modified.
+     * @param count How many there are
+     * @return True if every write succeeded
+     */
+    [[nodiscard]] virtual bool write_batch(const IoRequest *requests, size_t count)
+    {
+        bool ok = true;
+        for(size_t a = 0; a < count; a++)
+        {
+            ok &= write_at(requests[a].offset, requests[a].buf, requests[a].len);
+        }
+        return ok;
+    }
+
+    // True if batches have their requests in flight at once, so a batch takes not much longer than one request
+    [[nodiscard]] virtual bool queues_io() const
+    {
+        return false;
+    }
     [[nodiscard]] virtual uint64_t tellg() = 0;
     virtual void seekg(int64_t pos, std::ios_base::seekdir base) = 0;
     [[nodiscard]] virtual bool good() const = 0;
     [[nodiscard]] virtual bool is_open() const = 0;
     virtual void close() = 0;
+
+    /*!
+     * Hints that a range is about to be read, so the backing can start loading it in the
+     * background. Backings which can't read asynchronously ignore it.
+     *
+     * @param offset Where the range starts
+     * @param len How many bytes it covers
+     */
+    virtual void prefetch(uint64_t, uint64_t)
+    {
+
+    }
+
+    /*!
+     * Waits until everything written so far is on stable storage, so that it survives a crash
+     * or power loss. Backings which don't keep anything past the life of the process have
+     * nothing to do.
+     *
+     * @return True on success, false if the data may not have reached storage
+     */
+    [[nodiscard]] virtual bool sync()
+    {
+        return true;
+    }
 };
 
 class DiskBacking : public FilesystemBacking
@@ -56,6 +159,44 @@ public:
         return file.good();
     }
 
+    [[nodiscard]] bool read_at(uint64_t offset, char *buf, uint64_t buflen) override
+    {
+        // fstream only has the one cursor, so put it back afterwards
+        const auto orig = file.tellg();
+        file.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+        file.read(buf, static_cast<std::streamsize>(buflen));
+        const bool ok = file.good();
+        file.clear();
+        file.seekg(orig, std::ios::beg);
+        return ok;
+    }
+
+    [[nodiscard]] bool write_at(uint64_t offset, const char *buf, uint64_t buflen) override
+    {
+        const auto orig = file.tellg();
+        file.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+        file.write(buf, static_cast<std::streamsize>(buflen));
+        const bool ok = file.good();
+        file.seekg(orig, std::ios::beg);
+        return ok;
+    }
+
+    [[nodiscard]] uint64_t size() override
+    {
+        const auto orig = file.tellg();
+        file.seekg(0, std::ios::end);
+        const uint64_t end = file.tellg();
+        file.seekg(orig, std::ios::beg);
+        return end;
+    }
+
+    // fstream can't ask for an fsync, so this only gets the data as far as the OS
+    [[nodiscard]] bool sync() override
+    {
+        file.flush();
+        return file.good();
+    }
+
     [[nodiscard]] uint64_t tellg() override
     {
         assert(file.is_open());
@@ -122,6 +263,33 @@ public:
         return true;
     }
 
+    [[nodiscard]] bool read_at(uint64_t offset, char *buf, uint64_t buflen) override
+    {
+        if(offset + buflen > buffer.size())
+        {
+            return false;
+        }
+
+        memcpy(buf, buffer.data() + offset, buflen);
+        return true;
+    }
+
+    [[nodiscard]] bool write_at(uint64_t offset, const char *buf, uint64_t buflen) override
+    {
+        if(offset + buflen > buffer.size())
+        {
+            buffer.resize(offset + buflen);
+        }
+
+        memcpy(buffer.data() + offset, buf, buflen);
+        return true;
+    }
+
+    [[nodiscard]] uint64_t size() override
+    {
+        return buffer.size();
+    }
+
     [[nodiscard]] uint64_t tellg() override
     {
         return cursor;
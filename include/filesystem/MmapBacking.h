@@ -0,0 +1,58 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#ifndef TESTDB_MMAPBACKING_H
+#define TESTDB_MMAPBACKING_H
+
+#include "filesystem/FilesystemBacking.h"
+
+/*!
+ * Backs a filesystem with a memory mapped file. Reads and writes are plain copies to
+ * and from the mapping, so they don't need any system calls.
+ *
+ * The mapping grows in chunks as the file is written past its end, so it's rarely remapped.
+ * The file itself is only extended to the end of the last OS page written, as mapping past
+ * the end of the file is fine as long as those pages aren't touched. That way a crash never
+ * leaves an unused tail which would be taken for part of the file when it's reopened.
+ * The file is trimmed back to exactly what was written when it's closed.
+ */
+class MmapBacking : public FilesystemBacking
+{
+public:
+    MmapBacking()=default;
+    MmapBacking(const MmapBacking&)=delete;
+    void operator=(const MmapBacking&)=delete;
+    ~MmapBacking() override;
+
+    [[nodiscard]] bool open(const std::string &path, bool create) override;
+    [[nodiscard]] bool write(const char *buf, uint64_t buflen) override;
+    [[nodiscard]] bool read(char *buf, uint64_t buflen) override;
+    [[nodiscard]] bool read_at(uint64_t offset, char *buf, uint64_t buflen) override;
+    [[nodiscard]] bool write_at(uint64_t offset, const char *buf, uint64_t buflen) override;
+    [[nodiscard]] uint64_t size() override;
+    [[nodiscard]] uint64_t tellg() override;
+    void seekg(int64_t pos, std::ios_base::seekdir base) override;
+    [[nodiscard]] bool good() const override;
+    [[nodiscard]] bool is_open() const override;
+    void close() override;
+    void prefetch(uint64_t offset, uint64_t len) override;
+    [[nodiscard]] bool sync() override;
+
+private:
+    // Makes sure the mapping and the file cover at least 'needed' bytes, growing them if necessary
+    bool reserve(uint64_t needed);
+
+    // The mapping grows by at least this much at a time, so that appending a page at a time doesn't remap every time
+    static constexpr uint64_t MinGrowth = 1024 * 1024;
+
+    int fd = -1;
+    char *map = nullptr;
+    uint64_t length = 0; // Bytes written to the file, which may be less than is mapped
+    uint64_t capacity = 0; // Bytes mapped
+    uint64_t file_size = 0; // Bytes the file has been extended to, 'length' rounded up to a whole OS page
+    uint64_t cursor = 0;
+    bool failed = false;
+};
+
+#endif //TESTDB_MMAPBACKING_H
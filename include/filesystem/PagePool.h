@@ -0,0 +1,172 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#ifndef TESTDB_PAGEPOOL_H
+#define TESTDB_PAGEPOOL_H
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+class FilesystemBacking;
+class WriteAheadLog;
+
+/*!
+ * A cache of fixed size page frames sitting in front of a filesystem's backing, so
+ * repeated reads and writes to the same pages don't go to storage every time.
+ *
+ * Frames are handed out pinned, and can't be evicted until every PageRef to them is gone.
+ * Once the pool is at its budget, the CLOCK algorithm picks which unpinned frame to reuse:
+ * the hand sweeps round the frames, giving each recently used frame a second chance by
+ * clearing its referenced bit, and takes the first frame it finds which hasn't been used
+ * since the last sweep. Modified frames are marked dirty, and written back when they're
+ * evicted or the pool is flushed.
+ *
+ * If every frame is pinned when another is needed, the pool goes over its budget rather than fail.
+ * The same goes for dirty frames which fail to write back, as they're never dropped until they've been written.
+ *
+ * With a write-ahead log attached, changes have to be logged before they can be written back.
+ * Frames with changes that haven't been logged yet can't be evicted, much like pinned frames,
+ * and logged frames are only written back once the log is durable past them. The backing only
+ * ever sees committed pages, so replaying the log after a crash is all that's needed to recover.
+ */
+class PagePool
+{
+public:
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t writebacks = 0;
+        uint64_t prefetched = 0; // Pages read or passed on to the backing ahead of being fetched
+    };
+
+    // Keeps a frame pinned in memory while in use
+    class PageRef
+    {
+    public:
+        PageRef()=default;
+        PageRef(const PageRef&)=delete;
+        void operator=(const PageRef&)=delete;
+        PageRef(PageRef &&o) noexcept;
+        PageRef &operator=(PageRef &&o) noexcept;
+        ~PageRef();
+
+        [[nodiscard]] bool valid() const
+        {
+            return pool != nullptr;
+        }
+
+        // The page's bytes. Call mark_dirty() after changing them.
+        [[nodiscard]] char *data() const;
+        void mark_dirty();
+        void release();
+
+    private:
+        friend class PagePool;
+        PageRef(PagePool *pool, size_t frame);
+
+        PagePool *pool = nullptr;
+        size_t frame = 0;
+    };
+
+    // 8MB, or 2048 frames of 4KB
+    static constexpr size_t DefaultBudget = 8 * 1024 * 1024;
+
+    // The fewest frames a pool will have, whatever its budget
+    static constexpr size_t MinFrames = 8;
+
+    /*!
+     * @param backing Where pages are read from and written back to
+     * @param page_size Bytes per page, and so per frame
+     * @param budget Memory to use for frames, in bytes
+     */
+    PagePool(FilesystemBacking &backing, uint64_t page_size, size_t budget = DefaultBudget);
+    PagePool(const PagePool&)=delete;
+    void operator=(const PagePool&)=delete;
+
+    // Has every change logged to 'log' before it's written back, from now on
+    void attach_log(WriteAheadLog *log);
+
+    /*!
+     * Logs every frame changed since it was last logged, as one commit
+     *
+     * @return Where the commit ends in the log, for WriteAheadLog::wait_durable, or nothing if it couldn't be logged
+     */
+    std::optional<uint64_t> log_changes();
+
+    /*!
+     * Gets a page, reading it from the backing if it's not already cached
+     *
+     * @param page The page index
+     * @return The page, pinned until the reference is released
+     */
+    PageRef fetch(uint64_t page);
+
+    /*!
+     * Gets a frame for a page which is new, so there's nothing to read. It's zero filled and already dirty.
+     *
+     * @param page The page index
+     * @return The page, pinned until the reference is released
+     */
+    PageRef create(uint64_t page);
+
+    /*!
+     * Gets pages which are about to be fetched on their way. If the backing can queue I/O, they're
+     * read into frames in one batch. Otherwise the backing is asked to start loading them in the
+     * background, with physically contiguous pages asked for together. Pages which are already
+     * cached are skipped.
+     *
+     * @param pages The pages, in the order they'll be fetched
+     * @param count How many pages there are
+     */
+    void prefetch(const uint64_t *pages, size_t count);
+
+    /*!
+     * Writes every dirty frame back, in page order, as one batch. With a log attached, changes
+     * need logging first, as they're written back whether they've been logged or not.
+     *
+     * @return True on success, false if any write failed
+     */
+    bool flush();
+
+    [[nodiscard]] Stats stats() const;
+
+    // Number of frames the budget allows
+    [[nodiscard]] size_t capacity() const;
+
+    // Number of frames currently in use
+    [[nodiscard]] size_t size() const;
+
+private:
+    struct Frame
+    {
+        std::unique_ptr<char[]> data;
+        uint64_t page = 0;
+        uint32_t pins = 0;
+        bool referenced = false;
+        bool dirty = false;
+        bool unlogged = false; // Changed since it was last logged, which keeps it in memory
+        uint64_t lsn = 0; // Where its last image ends in the log, which must be durable before it's written back
+    };
+
+    // Finds a frame to put a page in, evicting another page if the pool is full
+    size_t take_frame(uint64_t page);
+    bool write_back(Frame &frame);
+
+    FilesystemBacking &backing;
+    WriteAheadLog *log = nullptr;
+    uint64_t last_lsn = 0; // Where the last commit logged ends
+    uint64_t page_size;
+    size_t frame_budget;
+    std::vector<Frame> frames;
+    std::unordered_map<uint64_t, size_t> page_to_frame;
+    size_t hand = 0;
+    Stats counters;
+};
+
+#endif //TESTDB_PAGEPOOL_H
@@ -0,0 +1,51 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#ifndef TESTDB_POSIXBACKING_H
+#define TESTDB_POSIXBACKING_H
+
+#include <atomic>
+#include "filesystem/FilesystemBacking.h"
+
+/*!
+ * Backs a filesystem with a file descriptor, using pread and pwrite. Each call says where
+ * it reads or writes, rather than going through a shared stream position like fstream, so
+ * positional reads and writes can be issued from several threads at once without locking.
+ *
+ * The cursor used by read, write and seekg is only kept for the stateful half of the interface,
+ * and is built on top of the positional calls.
+ */
+class PosixBacking : public FilesystemBacking
+{
+public:
+    PosixBacking()=default;
+    PosixBacking(const PosixBacking&)=delete;
+    void operator=(const PosixBacking&)=delete;
+    ~PosixBacking() override;
+
+    [[nodiscard]] bool open(const std::string &path, bool create) override;
+    [[nodiscard]] bool write(const char *buf, uint64_t buflen) override;
+    [[nodiscard]] bool read(char *buf, uint64_t buflen) override;
+    [[nodiscard]] bool read_at(uint64_t offset, char *buf, uint64_t buflen) override;
+    [[nodiscard]] bool write_at(uint64_t offset, const char *buf, uint64_t buflen) override;
+    [[nodiscard]] uint64_t size() override;
+    [[nodiscard]] uint64_t tellg() override;
+    void seekg(int64_t pos, std::ios_base::seekdir base) override;
+    [[nodiscard]] bool good() const override;
+    [[nodiscard]] bool is_open() const override;
+    void close() override;
+    void prefetch(uint64_t offset, uint64_t len) override;
+    [[nodiscard]] bool sync() override;
+
+protected:
+    // Raises the tracked length to 'end' if it's past it, without losing a larger length from another writer
+    void extend(uint64_t end);
+
+    int fd = -1;
+    std::atomic<uint64_t> length = 0; // Tracked rather than asking the OS, as concurrent writers may extend it
+    uint64_t cursor = 0;
+    bool failed = false;
+};
+
+#endif //TESTDB_POSIXBACKING_H
@@ -0,0 +1,54 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#ifndef TESTDB_URINGBACKING_H
+#define TESTDB_URINGBACKING_H
+
+#include <memory>
+#include <mutex>
+#include "filesystem/PosixBacking.h"
+
+/*!
+ * A PosixBacking which carries out batches of reads and writes through io_uring, so a whole
+ * batch is in flight at once rather than one request at a time. Single reads and writes still
+ * use pread and pwrite, as there's nothing to overlap them with.
+ *
+ * The ring is set up with raw system calls. If the kernel doesn't support io_uring, or it's
+ * been disabled, the backing carries on without it and batches are done one request at a time.
+ */
+class UringBacking : public PosixBacking
+{
+public:
+    // Most requests submitted to the kernel at once. Bigger batches are split up.
+    static constexpr unsigned QueueDepth = 64;
+
+    UringBacking();
+    ~UringBacking() override;
+
+    [[nodiscard]] bool open(const std::string &path, bool create) override;
+    void close() override;
+    [[nodiscard]] bool read_batch(const IoRequest *requests, size_t count) override;
+    [[nodiscard]] bool write_batch(const IoRequest *requests, size_t count) override;
+    [[nodiscard]] bool queues_io() const override;
+
+private:
+    struct Ring;
+
+    /*!
+     * Submits requests to the ring and waits for them all to complete. Any that only partly
+     * complete are finished off with pread or pwrite. If the kernel takes only some of them,
+     * those are waited for, then the ring is dropped and the rest are done with pread or pwrite.
+     *
+     * @param opcode IORING_OP_READ or IORING_OP_WRITE
+     * @param requests The requests
+     * @param count How many there are
+     * @return True if every request succeeded
+     */
+    bool submit(uint8_t opcode, const IoRequest *requests, size_t count);
+
+    std::unique_ptr<Ring> ring; // Null if io_uring isn't available
+    std::mutex ring_mutex; // The ring's queues are only used by one batch at a time
+};
+
+#endif //TESTDB_URINGBACKING_H
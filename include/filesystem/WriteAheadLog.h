@@ -0,0 +1,114 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#ifndef TESTDB_WRITEAHEADLOG_H
+#define TESTDB_WRITEAHEADLOG_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include "filesystem/FilesystemBacking.h"
+
+/*!
+ * A redo log for a filesystem's pages, kept in its own backing. Each commit appends an image
+ * of every page it changed followed by a commit record, and is durable once the log has been
+ * synced past it. The filesystem's own backing can then be written back lazily, as after a
+ * crash the committed images are copied back over it by recover(). Anything logged after the
+ * last complete commit record, such as a commit torn part way through being written, is ignored.
+ *
+ * Syncing is shared between commits. A thread waiting for its commit to become durable either
+ * finds a sync already covering it, or becomes the leader and syncs everything appended so
+ * far, including the commits of any threads which arrived while the previous sync was running.
+ * Under load, many commits go out with a single sync.
+ *
+ * Once every logged page has been written back and synced, reset() starts the log over. Rather
+ * than truncating it, the log's epoch is bumped, and records left over from older epochs are
+ * ignored when it's read back.
+ */
+class WriteAheadLog
+{
+public:
+    struct Stats
+    {
+        uint64_t commits = 0;
+        uint64_t pages = 0; // Page images logged
+        uint64_t syncs = 0;
+    };
+
+    // A page to log, along with the rest of its commit
+    struct PageImage
+    {
+        uint64_t page = 0;
+        const char *data = nullptr;
+    };
+
+    /*!
+     * @param backing Where the log is stored
+     * @param page_size Bytes per page image
+     */
+    WriteAheadLog(std::unique_ptr<FilesystemBacking> backing, uint64_t page_size);
+    WriteAheadLog(const WriteAheadLog&)=delete;
+    void operator=(const WriteAheadLog&)=delete;
+
+    /*!
+     * Copies every committed page image in the log back into the filesystem's backing, then
+     * starts the log over. Must be called before anything else, even for a new log, which
+     * has its header written here.
+     *
+     * @param target The filesystem's backing
+     * @return True on success, false if the log belongs to a different page size or couldn't be replayed
+     */
+    bool recover(FilesystemBacking &target);
+
+    /*!
+     * Appends a commit to the log, without waiting for it to become durable. Commits are
+     * appended whole, so they're never interleaved with one another.
+     *
+     * @param pages The pages it changed
+     * @param count How many there are
+     * @return Where the commit ends in the log, to pass to wait_durable(), or nothing if the write failed
+     */
+    std::optional<uint64_t> append(const PageImage *pages, size_t count);
+
+    /*!
+     * Waits until the log has been synced up to a point, syncing it if no other thread is
+     *
+     * @param lsn What append() returned
+     * @return True once it's durable, false if the sync failed
+     */
+    bool wait_durable(uint64_t lsn);
+
+    /*!
+     * Starts the log over. Only call this once everything logged so far has been written back
+     * to the filesystem's backing and synced, and with no commits in progress.
+     *
+     * @return True on success, false if the new epoch couldn't be made durable
+     */
+    bool reset();
+
+    // Bytes of records in the log since it was last started over
+    [[nodiscard]] uint64_t size() const;
+    [[nodiscard]] Stats stats() const;
+
+private:
+    // Appends a record to 'buf', with its checksum covering both its header and body
+    void encode(std::string &buf, uint64_t type, uint64_t page, const char *body) const;
+
+    std::unique_ptr<FilesystemBacking> backing;
+    uint64_t page_size;
+    uint64_t epoch = 0;
+    uint64_t tail = 0; // Where the next record goes in the backing
+
+    // Log sequence numbers count bytes appended across every epoch, so they keep increasing when the log is reset
+    uint64_t appended = 0;
+    uint64_t durable = 0;
+    bool syncing = false; // Set while a leader is syncing, with the lock released
+    Stats counters;
+    mutable std::mutex mutex;
+    std::condition_variable synced;
+};
+
+#endif //TESTDB_WRITEAHEADLOG_H
@@ -47,6 +47,12 @@ public:
         return 0;
 	}
 
+    // Makes the effects of every statement so far durable. See Database::commit.
+    bool commit()
+    {
+        return database->commit();
+    }
+
 private:
     Statement stmt;
 
@@ -16,14 +16,24 @@ inline bool deserialize(serializer::Serializer &serializer, ColumnMetadata &str)
     return serializer.extract(str.id) && serializer.extract(str.name) && serializer.extract(str.type) && serializer.extract(str.constraints);
 }
 
+inline void serialize(serializer::Serializer &serializer, const IndexMetadata &index)
+{
+    serializer << index.name << index.columns << index.included;
+}
+
+inline bool deserialize(serializer::Serializer &serializer, IndexMetadata &index)
+{
+    return serializer.extract(index.name) && serializer.extract(index.columns) && serializer.extract(index.included);
+}
+
 inline void serialize(serializer::Serializer &serializer, const TableMetadata &meta)
 {
-    serializer << meta.id << meta.name << meta.columns;
+    serializer << meta.id << meta.name << meta.columns << meta.indexes;
 }
 
 inline bool deserialize(serializer::Serializer &serializer, TableMetadata &meta)
 {
-    return serializer.extract(meta.id) && serializer.extract(meta.name) && serializer.extract(meta.columns);
+    return serializer.extract(meta.id) && serializer.extract(meta.name) && serializer.extract(meta.columns) && serializer.extract(meta.indexes);
 }
 
 #endif //TESTDB_TABLE_H
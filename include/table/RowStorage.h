@@ -6,24 +6,80 @@
 #define TESTDB_ROWSTORAGE_H
 
 
+#include <string>
 #include "filesystem/Filesystem.h"
 #include "TableMetadata.h"
 #include "Variable.h"
+#include "StringPool.h"
 
 class RowStorage
 {
 public:
-    RowStorage(TableMetadata metadata, Filesystem::Handle index, Filesystem::Handle data);
+    /*!
+     * @param metadata The table's columns
+     * @param index Log of erased rows
+     * @param data Fixed size rows, with a word per column
+     * @param strings Heap of STRING column values, which rows refer to by offset. Space from
+     * strings which are replaced or erased is reused by later ones of a similar size.
+     */
+    RowStorage(TableMetadata metadata, Filesystem::Handle index, Filesystem::Handle data, Filesystem::Handle strings);
 
     rid_t store(const std::vector<Variable> &row);
     void erase(rid_t row_id);
-    std::vector<Variable> load(rid_t row_id);
+
+    /*!
+     * Loads a row
+     *
+     * @param row_id The row to load
+     * @param pool Holds the row's STRING values, which stay valid for as long as the pool keeps them
+     * @return The row's values
+     */
+    std::vector<Variable> load(rid_t row_id, StringPool &pool);
     void update(rid_t row_id, const std::vector<Variable> &row);
 private:
+    // Heap strings are kept in slots, each of which is this followed by 'capacity' bytes
+    struct StringHeader
+    {
+        uint64_t capacity;
+        uint64_t len; // For free slots, the next free slot of the same size plus one, or zero
+    };
+
+    // Free slots are kept in lists by size, each slot's capacity being MIN_CAPACITY times a power of two.
+    // The heap starts with the offset plus one of the first free slot of each size.
+    static constexpr uint64_t MIN_CAPACITY = 16;
+    static constexpr size_t SIZE_CLASSES = 48;
+
+    // Finds the smallest size class which can hold a string of 'len' bytes
+    static size_t size_class(uint64_t len);
+
+    // Stores a string in a free slot, or on the end of the heap, returning its offset
+    uint64_t store_string(const Variable &value);
+
+    // Overwrites the string in a slot if the new one fits, otherwise frees the slot and stores it elsewhere. Returns its offset.
+    uint64_t replace_string(uint64_t offset, const Variable &value);
+
+    // Adds a slot to the free list for its size
+    void free_string(uint64_t offset);
+
+    // Reads a string from the heap
+    std::string load_string(uint64_t offset);
+
+    StringHeader read_header(uint64_t offset);
+    void write_header(uint64_t offset, const StringHeader &header);
+
+    /*!
+     * Converts a row to the words stored for it. STRING columns are stored as their slot's offset in the heap plus one.
+     *
+     * @param row The row's values
+     * @param words The row's current words, or zeros for a new row. Updated to the new words.
+     */
+    void encode_row(const std::vector<Variable> &row, std::vector<uint64_t> &words);
+
     size_t row_size;
     TableMetadata metadata;
     Filesystem::Handle index;
     Filesystem::Handle data;
+    Filesystem::Handle strings;
 };
 
 
@@ -14,11 +14,32 @@
 #include <algorithm>
 #include <list>
 #include "Variable.h"
+#include "StringPool.h"
 #include "btree/BTree.h"
+#include "btree/StringTree.h"
 #include "filesystem/Filesystem.h"
 #include "TableMetadata.h"
 #include "RowStorage.h"
 
+/*!
+ * Walks the rows within a range of keys in one of a table's indexes one at a time, in key order,
+ * so only as much of the index is read as is used. Any change to the table invalidates it.
+ */
+class IndexCursor
+{
+public:
+    virtual ~IndexCursor()=default;
+
+    /*!
+     * Moves on to the next row in the range
+     *
+     * @param covered If set, filled with the row's values for the index's columns then its
+     * included columns, read from the index itself
+     * @return The row's id, or nothing once the range has been used up
+     */
+    [[nodiscard]] virtual std::optional<rid_t> next(std::vector<Variable> *covered)=0;
+};
+
 class Table
 {
 public:
@@ -35,12 +56,73 @@ public:
 
     virtual ~Table()=default;
     [[nodiscard]] virtual rid_t insert(const std::vector<Variable> &values)=0;
+
+    /*!
+     * Inserts several rows at once. Nothing is inserted if any of the rows is rejected.
+     *
+     * @param rows The rows to insert
+     * @return The new rows' ids, in the same order
+     */
+    [[nodiscard]] virtual std::vector<rid_t> insert_rows(const std::vector<std::vector<Variable>> &rows)=0;
     virtual void erase(rid_t row_id)=0;
-    [[nodiscard]] virtual Variable load(rid_t row_id, cid_t col_id)=0;
+
+    /*!
+     * Loads a column's value from a row
+     *
+     * @param row_id The row to load from
+     * @param col_id The column to load
+     * @param pool Holds the value if it's a string, which stays valid for as long as the pool keeps it
+     * @return The value
+     */
+    [[nodiscard]] virtual Variable load(rid_t row_id, cid_t col_id, StringPool &pool)=0;
     virtual void update(rid_t row_id, cid_t col_id, Variable value)=0;
     virtual void clear()=0;
     [[nodiscard]] virtual rid_t get_row_count() const=0;
 
+    /*!
+     * Finds the first row which exists at or after a given row id. Row ids aren't
+     * contiguous once rows have been erased, so this is used to walk the table.
+     *
+     * @param row_id The row id to start from
+     * @return The row id, or nothing if there are no more rows
+     */
+    [[nodiscard]] virtual std::optional<rid_t> next_row(rid_t row_id)=0;
+
+    /*!
+     * Creates an index over one or more columns, adding all of the existing rows to it
+     *
+     * @param name The name of the index
+     * @param col_ids The columns to index, most significant first
+     * @param included Extra columns to store in the index without being part of the key
+     */
+    virtual void create_index(std::string name, std::vector<cid_t> col_ids, std::vector<cid_t> included = {})=0;
+
+    /*!
+     * Gets a cursor over the rows within a range of keys, using an index. Only the matching
+     * part of the index is read. The bounds can cover just the leading columns of the index,
+     * in which case rows are matched on those columns alone.
+     *
+     * @param index_pos The position of the index in the table's metadata
+     * @param lower The smallest values to look for, one per leading column
+     * @param upper The largest values to look for, the same length as lower
+     * @param pool Holds any string values the cursor reads from the index, which stay valid for as long as the pool keeps them. Needed if they're read.
+     * @return The cursor, positioned before the first matching row
+     */
+    [[nodiscard]] virtual std::unique_ptr<IndexCursor> index_cursor(size_t index_pos, const std::vector<Variable> &lower, const std::vector<Variable> &upper, StringPool *pool = nullptr)=0;
+
+    /*!
+     * Finds all of the rows within a range of keys at once, as index_cursor would walk them
+     *
+     * @param covered If set, filled with each matching row's values for the index's columns then its
+     * included columns, read from the index itself
+     * @param pool Holds any string values put in 'covered'. Needed if 'covered' is set.
+     * @return The matching row ids, in key order
+     */
+    [[nodiscard]] std::vector<rid_t> index_scan(size_t index_pos, const std::vector<Variable> &lower, const std::vector<Variable> &upper, std::vector<std::vector<Variable>> *covered = nullptr, StringPool *pool = nullptr);
+
+    // Writes anything the table has cached out to the filesystem, ready to be committed
+    virtual void flush()=0;
+
 protected:
     TableMetadata metadata;
 };
@@ -48,59 +130,63 @@ protected:
 class TreeTable : public Table
 {
 public:
+    explicit TreeTable(TableMetadata meta, Filesystem *filesystem);
+
+    [[nodiscard]] rid_t insert(const std::vector<Variable> &row) override;
+    [[nodiscard]] std::vector<rid_t> insert_rows(const std::vector<std::vector<Variable>> &rows) override;
+    void erase(rid_t row_id) override;
+    [[nodiscard]] Variable load(rid_t row_id, cid_t col_id, StringPool &pool) override;
+    void update(rid_t row_id, cid_t col_id, Variable new_val) override;
+    void clear() override;
+    [[nodiscard]] rid_t get_row_count() const override;
+    [[nodiscard]] std::optional<rid_t> next_row(rid_t row_id) override;
+    void create_index(std::string name, std::vector<cid_t> col_ids, std::vector<cid_t> included) override;
+    [[nodiscard]] std::unique_ptr<IndexCursor> index_cursor(size_t index_pos, const std::vector<Variable> &lower, const std::vector<Variable> &upper, StringPool *pool) override;
+    void flush() override;
 
-    explicit TreeTable(TableMetadata meta, Filesystem *filesystem)
-    : Table(std::move(meta)), filesystem(filesystem)
-    {
-        auto data_index = filesystem->open(metadata.name + ".index", true);
-        auto data_data = filesystem->open(metadata.name + ".data", true);
-        auto index_tree = filesystem->open(metadata.name + ".tree", true);
-        row_store = std::make_unique<RowStorage>(metadata, std::move(data_index), std::move(data_data));
-        index.open(std::move(index_tree));
-    }
-
-    [[nodiscard]] rid_t insert(const std::vector<Variable> &row) override
-    {
-        auto id = row_store->store(row);
-        index.insert(current_rid + 1, id);
-        return current_rid++;
-    }
+private:
+    // Walks a range of one of the table's index trees
+    class RangeCursor;
 
-    void erase(rid_t row_id) override
+    // The tree behind an index. Only one of the two is set.
+    struct IndexTree
     {
+        std::unique_ptr<Tree> words; // For INT only indexes, keyed on a word per stored column with duplicates allowed
+        std::unique_ptr<StringTree> bytes; // For indexes with STRING columns, keyed on the encoded columns then the row id
+    };
 
-    }
-
-    [[nodiscard]] Variable load(rid_t row_id, cid_t col_id) override
-    {
-        auto store_id = index.search(row_id + 1);
-        if(!store_id)
-        {
-            throw DatabaseError("Row not found");
-        }
+    // Maps a column value to a word of an index key. Words compare in the same order as the values.
+    static uint64_t encode_key(const Variable &value);
 
-        return row_store->load(store_id.value() - 1).at(col_id); //todo return whole thing
-    }
+    // Appends a column value to a byte string index key. Byte strings compare in the same order as the values, and no encoding is a prefix of another.
+    static void encode_key(const Variable &value, std::string &key);
 
-    void update(rid_t row_id, cid_t col_id, Variable new_val) override
-    {
+    // Reverses encode_key, reading a value of the given type from the front of 'key' and advancing past it
+    static Variable decode_key(uint64_t word);
+    static Variable decode_key(Variable::Type type, std::string_view &key, StringPool &pool);
 
-    }
+    // Builds a row's key within an index, from each of the indexed columns in turn, followed by any included columns
+    static std::vector<uint64_t> index_key(const IndexMetadata &index, const std::vector<Variable> &row);
 
-    void clear() override
-    {
+    // As above, for indexes over STRING columns. The row id goes on the end so that keys are unique.
+    static std::string index_bytes(const IndexMetadata &index, const std::vector<Variable> &row, rid_t row_id);
 
-    }
+    // Gets the indexed then included column values back out of an index key
+    static std::vector<Variable> decode_index_key(Tree::Key key);
+    std::vector<Variable> decode_index_key(const IndexMetadata &index, std::string_view key, StringPool &pool);
+    [[nodiscard]] bool uses_bytes(const IndexMetadata &index) const;
 
-    [[nodiscard]] rid_t get_row_count() const override
-    {
-        return metadata.get_column_count();
-    }
+    // Throws if a row has a value which is too long to be indexed, so it can be rejected before anything is changed
+    void check_index_keys(const std::vector<Variable> &row);
+    void index_insert(size_t index_pos, const std::vector<Variable> &row, rid_t row_id);
+    void index_erase(size_t index_pos, const std::vector<Variable> &row, rid_t row_id);
+    [[nodiscard]] std::string index_stream_name(size_t index_pos) const;
+    std::optional<uint64_t> find_storage_id(rid_t row_id);
 
-private:
     std::unique_ptr<RowStorage> row_store;
     Filesystem *filesystem;
-    rid_t current_rid = 0;
-    Tree index;
+    rid_t next_rid = 0;
+    Tree index; // Row id + 1, to storage id
+    std::vector<IndexTree> indexes; // Column values to row id, in the same order as metadata.indexes
 };
 #endif //TESTDB_TABLE_H
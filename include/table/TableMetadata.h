@@ -1,6 +1,7 @@
 #ifndef TESTDB_TABLEMETADATA_H
 #define TESTDB_TABLEMETADATA_H
 
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <limits>
@@ -24,6 +25,20 @@ struct ColumnMetadata
 	std::vector<Constraint> constraints;
 };
 
+struct IndexMetadata
+{
+	std::string name;
+	std::vector<cid_t> columns; // Keys are ordered by the first column, then the second, and so on
+	std::vector<cid_t> included; // Extra columns stored with each key, so queries only using indexed columns don't need to load rows
+
+	// Checks if the index holds a column's value, either as part of the key or as an included column
+	bool stores(cid_t column) const
+	{
+		return std::find(columns.begin(), columns.end(), column) != columns.end()
+			|| std::find(included.begin(), included.end(), column) != included.end();
+	}
+};
+
 struct TableMetadata
 {
     TableMetadata()=default;
@@ -61,6 +76,7 @@ struct TableMetadata
 	tid_t id;
 	std::string name;
 	std::vector<ColumnMetadata> columns;
+	std::vector<IndexMetadata> indexes;
 };
 
 #endif // TESTDB_TABLEMETADATA_H
\ No newline at end of file
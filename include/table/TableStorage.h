@@ -21,10 +21,14 @@ public:
     void operator=(const TableStorage&)=delete;
 
     tid_t create(TableMetadata metadata);
+    void update(const TableMetadata &metadata);
     void erase(tid_t table_id);
     std::optional<tid_t> find(std::string_view name);
     std::vector<tid_t> list();
     TableMetadata load(tid_t table_id);
+
+    // Writes the tables out, if they've changed since they were last written
+    void flush();
 private:
     struct TableStorageMetadata
     {
@@ -35,6 +39,7 @@ private:
     Filesystem::Handle data;
     std::vector<TableMetadata> tables;
     TableStorageMetadata metadata;
+    bool modified = false;
 };
 
 
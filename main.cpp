@@ -4,6 +4,8 @@
 #include "Lexer.h"
 #include "filesystem/Filesystem.h"
 #include "filesystem/BasicFilesystem.h"
+#include "filesystem/MmapBacking.h"
+#include "filesystem/PosixBacking.h"
 #include "frsql.h"
 
 #ifdef BUILD_TESTS
@@ -24,10 +26,11 @@ int main(int argc, char **argv)
 #endif
 
     std::unique_ptr<FilesystemBacking> backing;
+    std::unique_ptr<FilesystemBacking> log;
     if(argc > 1)
     {
         const std::string filepath(argv[1]);
-        backing = std::make_unique<DiskBacking>();
+        backing = std::make_unique<MmapBacking>();
         if(!backing->open(filepath, false))
         {
             if(!backing->open(filepath, true))
@@ -45,6 +48,14 @@ int main(int argc, char **argv)
         {
             std::cout << "Opened existing database file '" << filepath << "'\n";
         }
+
+        // Queries are committed to a write-ahead log alongside the database, so they survive a crash
+        log = std::make_unique<PosixBacking>();
+        if(!log->open(filepath + "-wal", false) && !log->open(filepath + "-wal", true))
+        {
+            std::cout << "Failed to open/create log file '" << filepath << "-wal'\n";
+            return EXIT_FAILURE;
+        }
     }
     else
     {
@@ -53,7 +64,7 @@ int main(int argc, char **argv)
         BasicFilesystem::Format(backing);
     }
 
-    Frsql frsql(std::make_unique<BasicFilesystem>(std::move(backing)));
+    Frsql frsql(std::make_unique<BasicFilesystem>(std::move(backing), PagePool::DefaultBudget, std::move(log)));
 
 
 //    auto begin = std::chrono::steady_clock::now();
@@ -109,6 +120,7 @@ int main(int argc, char **argv)
                     std::cout << "\n";
                 }
                 });
+            frsql.commit();
         }
         catch (const DatabaseError &e)
         {
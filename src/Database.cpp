@@ -15,8 +15,16 @@ Database::~Database()
 
 std::shared_ptr<Table> Database::load_table(tid_t id)
 {
+    auto iter = open_tables.find(id);
+    if(iter != open_tables.end())
+    {
+        return iter->second;
+    }
+
     auto meta = tables->load(id);
-    return std::make_shared<TreeTable>(std::move(meta), filesystem.get());
+    auto table = std::make_shared<TreeTable>(std::move(meta), filesystem.get());
+    open_tables.emplace(id, table);
+    return table;
 }
 
 std::vector<tid_t> Database::list_table_ids()
@@ -29,9 +37,27 @@ std::shared_ptr<Table> Database::create_table(std::string name, std::vector<Colu
     TableMetadata meta(0, std::move(name), std::move(columns));
     meta.id = tables->create(meta);
     auto table = std::make_shared<TreeTable>(meta, filesystem.get());
+    open_tables.emplace(meta.id, table);
     return table;
 }
 
+void Database::create_index(tid_t table_id, std::string name, std::vector<cid_t> columns, std::vector<cid_t> included)
+{
+    auto table = load_table(table_id);
+    table->create_index(std::move(name), std::move(columns), std::move(included));
+    tables->update(table->get_metadata());
+}
+
+bool Database::commit()
+{
+    for(auto &[id, table] : open_tables)
+    {
+        table->flush();
+    }
+    tables->flush();
+    return filesystem->commit();
+}
+
 std::optional<tid_t> Database::lookup_table(const std::string_view name) const
 {
     return tables->find(name);
@@ -27,6 +27,11 @@
 {"ORDER", Token::ORDER},
 {"BY", Token::BY},
 {"ASC", Token::ASC},
+{"INDEX", Token::INDEX},
+{"ON", Token::ON},
+{"BETWEEN", Token::BETWEEN},
+{"AND", Token::AND},
+{"INCLUDE", Token::INCLUDE},
 };
 
 bool Lexer::lex(std::string_view data_)
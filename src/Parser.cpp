@@ -248,6 +248,12 @@ void Parser::create_query(Statement *stmt)
 {
     //Skip over 'TABLE'
     stmt->query_type = Lexer::Token::CREATE;
+    if(lexer->match(Lexer::Token::INDEX))
+    {
+        lexer->advance();
+        create_index_query(stmt);
+        return;
+    }
     lexer->legal_lookahead(Lexer::Token::TABLE);
     lexer->advance();
 
@@ -271,6 +277,49 @@ void Parser::create_query(Statement *stmt)
     lexer->advance();
 }
 
+void Parser::create_index_query(Statement *stmt)
+{
+    //CREATE INDEX name ON table(column, ...) [INCLUDE (column, ...)]
+    lexer->legal_lookahead(Lexer::Token::ID);
+    stmt->new_index_name = lexer->current().data;
+    lexer->advance();
+
+    lexer->legal_lookahead(Lexer::Token::ON);
+    lexer->advance();
+    table_name(stmt);
+
+    lexer->legal_lookahead(Lexer::Token::OPEN_PARENTHESIS);
+    lexer->advance();
+    column_name(stmt);
+    while(lexer->match(Lexer::Token::COMMA))
+    {
+        lexer->advance();
+        column_name(stmt);
+    }
+    lexer->legal_lookahead(Lexer::Token::CLOSE_PARENTHESIS);
+    lexer->advance();
+
+    //Columns which are only stored in the index, so queries using them don't need to load the row
+    if(lexer->match(Lexer::Token::INCLUDE))
+    {
+        const size_t key_columns = stmt->column_ids.size();
+        lexer->advance();
+        lexer->legal_lookahead(Lexer::Token::OPEN_PARENTHESIS);
+        lexer->advance();
+        column_name(stmt);
+        while(lexer->match(Lexer::Token::COMMA))
+        {
+            lexer->advance();
+            column_name(stmt);
+        }
+        lexer->legal_lookahead(Lexer::Token::CLOSE_PARENTHESIS);
+        lexer->advance();
+
+        stmt->included_column_ids.assign(stmt->column_ids.begin() + key_columns, stmt->column_ids.end());
+        stmt->column_ids.resize(key_columns);
+    }
+}
+
 void Parser::delete_query(Statement* stmt)
 {
     //Skip over FROM
@@ -332,6 +381,8 @@ void Parser::table_or_subquery(Statement *stmt)
 
     if(lexer->match(Lexer::Token::OPEN_PARENTHESIS)) //is subquery
     {
+        lexer->advance();
+        lexer->legal_lookahead(Lexer::Token::SELECT);
         lexer->advance();
         subselect(stmt, stmt->compiled_from_clause);
         lexer->legal_lookahead(Lexer::Token::CLOSE_PARENTHESIS);
@@ -347,6 +398,7 @@ void Parser::result_column(Statement *stmt)
     if(lexer->match(Lexer::Token::ASTERISK)) // *
     {
         stmt->compiled_result_clauses.append(sizeof(uint8_t), (char)Opcode::LOAD_ALL);
+        stmt->selects_all = true;
         lexer->advance();
         return;
     }
@@ -355,6 +407,17 @@ void Parser::result_column(Statement *stmt)
 }
 
 void Parser::expr(Statement *stmt, std::string &output)
+{
+    expr_l1(stmt, output);
+    while(lexer->match(Lexer::Token::AND))
+    {
+        lexer->advance();
+        expr_l1(stmt, output);
+        output.append(sizeof(uint8_t), (char)Opcode::AND);
+    }
+}
+
+void Parser::expr_l1(Statement *stmt, std::string &output)
 {
     expr_l2(stmt, output);
     expr_(stmt, output);
@@ -457,7 +520,7 @@ void Parser::expr_l3(Statement *stmt, std::string &output)
 
 void Parser::expr_l3_(Statement *stmt, std::string &output)
 {
-    while(lexer->match(Lexer::Token::ANGULAR_OPEN, Lexer::Token::ANGULAR_CLOSE))
+    while(lexer->match(Lexer::Token::ANGULAR_OPEN, Lexer::Token::ANGULAR_CLOSE, Lexer::Token::BETWEEN))
     {
         if(lexer->match(Lexer::Token::ANGULAR_OPEN)) // <
         {
@@ -474,6 +537,17 @@ void Parser::expr_l3_(Statement *stmt, std::string &output)
             output.append(sizeof(uint8_t), (char)Opcode::COMP_GT);
             continue;
         }
+
+        if(lexer->match(Lexer::Token::BETWEEN)) // BETWEEN x AND y, inclusive
+        {
+            lexer->advance();
+            expr_l4(stmt, output);
+            lexer->legal_lookahead(Lexer::Token::AND);
+            lexer->advance();
+            expr_l4(stmt, output);
+            output.append(sizeof(uint8_t), (char)Opcode::COMP_BETWEEN);
+            continue;
+        }
     }
 }
 
@@ -584,7 +658,7 @@ void Parser::type(Statement *stmt, std::string &output)
     {
         output.append(sizeof(uint8_t), (char)Opcode::LOAD_COL);
         output.append(sizeof(uint8_t), '\0'); //placeholder to be linked
-        stmt->accessed_columns.emplace_back(Statement::Link((uint8_t*)&output.back(), lexer->current().data));
+        stmt->accessed_columns.emplace_back(Statement::Link(&output, output.size() - 1, lexer->current().data));
         lexer->advance();
         return;
     }
@@ -634,6 +708,7 @@ void Parser::link_stmt(Statement *stmt)
         }
 
         assert(index <= std::numeric_limits<uint8_t>::max()); //todo: increase max size
-        *stmt->accessed_columns[a].bytecode_pos = static_cast<uint8_t>(index);
+        const auto &link = stmt->accessed_columns[a];
+        (*link.bytecode)[link.bytecode_pos] = static_cast<char>(index);
     }
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -13,6 +13,9 @@
 #include "Statement.h"
 #include "Database.h"
 #include "table/Table.h"
+#include "Opcode.h"
+#include <algorithm>
+#include <cstring>
 
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "UnreachableCode"
@@ -40,7 +43,12 @@ void QueryVM::eval_stmt(Statement *stmt_)
     if (state.stmt->table_id != ID_NONE)
     {
         state.table = database->load_table(state.stmt->table_id);
-        state.max_rows = state.table->get_row_count();
+    }
+
+    //Evaluate any subquery in the FROM clause up front, its rows are then visited as a table's would be
+    if (!state.stmt->compiled_from_clause.empty())
+    {
+        state.derived = derive_rows(state.stmt->compiled_from_clause);
     }
 
     //Evaluate any LIMIT clauses
@@ -52,7 +60,7 @@ void QueryVM::eval_stmt(Statement *stmt_)
         {
             throw SemanticError("Limit must be integral");
         }
-        state.max_rows = std::min((size_t)var.store.int64, state.max_rows);
+        state.max_rows = (size_t)std::max<int64_t>(var.store.int64, 0);
         if(state.max_rows == 0)
         {
             state.finalised = true;
@@ -69,6 +77,422 @@ void QueryVM::eval_stmt(Statement *stmt_)
            // state.table->set_sort(var.store.int64);
         }
     }
+
+    //Find the first row for queries which go through the table
+    switch(state.stmt->query_type)
+    {
+        case Lexer::Token::Type::SELECT:
+        case Lexer::Token::Type::UPDATE:
+        case Lexer::Token::Type::DELETE:
+            first_row();
+            break;
+        default:
+            break;
+    }
+}
+
+void QueryVM::first_row()
+{
+    //Queries without a table are evaluated once, or once per row of their FROM subquery
+    if(!state.table)
+    {
+        state.row = 0;
+        state.has_row = state.stmt->compiled_from_clause.empty() || !state.derived.empty();
+        return;
+    }
+
+    if(plan_index_scan())
+    {
+        state.candidate = 0;
+        next_candidate();
+        return;
+    }
+
+    auto row = state.table->next_row(0);
+    state.has_row = row.has_value();
+    state.row = row.value_or(0);
+}
+
+void QueryVM::next_row()
+{
+    if(!state.table)
+    {
+        state.has_row = ++state.row < state.derived.size();
+        return;
+    }
+
+    if(state.indexed)
+    {
+        next_candidate();
+        return;
+    }
+
+    auto row = state.table->next_row(state.row + 1);
+    state.has_row = row.has_value();
+    state.row = row.value_or(0);
+}
+
+void QueryVM::next_candidate()
+{
+    if(state.cursor)
+    {
+        auto row = state.cursor->next(state.covering ? &state.covered_row : nullptr);
+        state.has_row = row.has_value();
+        state.row = row.value_or(0);
+        return;
+    }
+
+    state.has_row = state.candidate < state.candidates.size();
+    state.row = state.has_row ? state.candidates[state.candidate] : 0;
+    if(state.has_row && state.covering)
+    {
+        state.covered_row = std::move(state.covered[state.candidate]);
+    }
+    state.candidate++;
+}
+
+std::vector<row_t> QueryVM::derive_rows(std::string_view bytecode)
+{
+    //Joins aren't supported yet, so the clause can only be a single subquery
+    if(state.table || bytecode.size() != 2 || bytecode[0] != (char)Opcode::EXEC_SUBQUERY)
+    {
+        throw SemanticError("Can only select FROM a single table or subquery");
+    }
+
+    std::vector<row_t> rows;
+    Statement *nested = &state.stmt->nested_statements[(uint8_t)bytecode[1]];
+    push_state();
+    eval_stmt(nested);
+    row_t row;
+    while(fetch_row(&row))
+    {
+        rows.emplace_back(row);
+    }
+    pop_state();
+    return rows;
+}
+
+//A column constrained by the WHERE clause to the given inclusive ranges of values
+struct IndexConstraint
+{
+    cid_t column = ID_NONE;
+    std::vector<std::pair<Variable, Variable>> ranges;
+};
+
+//Reads a constant pushed by the bytecode at 'off', advancing past it
+static bool read_constant(const Statement *stmt, std::string_view bytecode, size_t &off, Variable &value)
+{
+    if(off + 1 + sizeof(int64_t) <= bytecode.size() && bytecode[off] == (char)Opcode::PUSH_INT64)
+    {
+        int64_t num;
+        memcpy(&num, &bytecode[off + 1], sizeof(num));
+        value = Variable(num);
+        off += 1 + sizeof(int64_t);
+        return true;
+    }
+
+    if(off + 2 <= bytecode.size() && bytecode[off] == (char)Opcode::PUSH_STRING)
+    {
+        value = Variable(stmt->strings[(uint8_t)bytecode[off + 1]]);
+        off += 2;
+        return true;
+    }
+
+    return false;
+}
+
+//Reads a column loaded by the bytecode at 'off', advancing past it
+static bool read_column(std::string_view bytecode, size_t &off, cid_t &column)
+{
+    if(off + 2 <= bytecode.size() && bytecode[off] == (char)Opcode::LOAD_COL)
+    {
+        column = (uint8_t)bytecode[off + 1];
+        off += 2;
+        return true;
+    }
+
+    return false;
+}
+
+static bool read_opcode(std::string_view bytecode, size_t &off, Opcode opcode)
+{
+    if(off < bytecode.size() && bytecode[off] == (char)opcode)
+    {
+        off++;
+        return true;
+    }
+
+    return false;
+}
+
+static bool read_comparison(std::string_view bytecode, size_t &off, Opcode &opcode)
+{
+    for(auto candidate : {Opcode::COMP_EQ, Opcode::COMP_LT, Opcode::COMP_GT})
+    {
+        if(read_opcode(bytecode, off, candidate))
+        {
+            opcode = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//Converts 'col <op> value' into an inclusive range of values, which is left out if nothing can match
+static bool comparison_range(Opcode opcode, const Variable &value, std::vector<std::pair<Variable, Variable>> &ranges)
+{
+    if(opcode == Opcode::COMP_EQ)
+    {
+        ranges.emplace_back(value, value);
+        return true;
+    }
+
+    //Ordering comparisons only work on integers, leave anything else to fail when evaluated
+    if(value.type != Variable::Type::INT)
+    {
+        return false;
+    }
+
+    constexpr int64_t min = std::numeric_limits<int64_t>::min();
+    constexpr int64_t max = std::numeric_limits<int64_t>::max();
+    if(opcode == Opcode::COMP_LT && value.store.int64 != min)
+    {
+        ranges.emplace_back(Variable(min), Variable(value.store.int64 - 1));
+    }
+    else if(opcode == Opcode::COMP_GT && value.store.int64 != max)
+    {
+        ranges.emplace_back(Variable(value.store.int64 + 1), Variable(max));
+    }
+    return true;
+}
+
+//Swaps the sides of a comparison, so 'const < col' can be treated as 'col > const'
+static Opcode mirror_comparison(Opcode opcode)
+{
+    switch(opcode)
+    {
+        case Opcode::COMP_LT:
+            return Opcode::COMP_GT;
+        case Opcode::COMP_GT:
+            return Opcode::COMP_LT;
+        default:
+            return opcode;
+    }
+}
+
+//Reads a comparison between a column and constants, which an index can answer:
+//'col = const', 'col < const', 'col > const' (either way around), 'col IN (const, ...)' or 'col BETWEEN const AND const'.
+//If so, gets the inclusive ranges of values which can match.
+static bool read_constraint(const Statement *stmt, std::string_view bytecode, size_t &off, IndexConstraint &constraint)
+{
+    Variable value, upper;
+    Opcode opcode;
+    auto &ranges = constraint.ranges;
+    if(read_column(bytecode, off, constraint.column))
+    {
+        if(read_opcode(bytecode, off, Opcode::FRAME_MARKER))
+        {
+            while(read_constant(stmt, bytecode, off, value))
+            {
+                ranges.emplace_back(value, value);
+            }
+            return read_opcode(bytecode, off, Opcode::FILTER_MUTUAL);
+        }
+
+        if(!read_constant(stmt, bytecode, off, value))
+        {
+            return false;
+        }
+
+        if(read_comparison(bytecode, off, opcode))
+        {
+            return comparison_range(opcode, value, ranges);
+        }
+
+        if(read_constant(stmt, bytecode, off, upper) && read_opcode(bytecode, off, Opcode::COMP_BETWEEN))
+        {
+            if(value.type != Variable::Type::INT || upper.type != Variable::Type::INT)
+            {
+                return false;
+            }
+            if(value.store.int64 <= upper.store.int64)
+            {
+                ranges.emplace_back(value, upper);
+            }
+            return true;
+        }
+
+        return false;
+    }
+
+    return read_constant(stmt, bytecode, off, value)
+        && read_column(bytecode, off, constraint.column)
+        && read_comparison(bytecode, off, opcode)
+        && comparison_range(mirror_comparison(opcode), value, ranges);
+}
+
+//Checks if a WHERE clause is just one or more constraints which an index can answer, joined by AND
+static bool match_index_constraints(const Statement *stmt, std::string_view bytecode, std::vector<IndexConstraint> &constraints)
+{
+    size_t off = 0;
+    constraints.emplace_back();
+    if(!read_constraint(stmt, bytecode, off, constraints.back()))
+    {
+        return false;
+    }
+
+    //Conjunctions are left associative, so each further constraint is followed by its AND
+    while(!read_opcode(bytecode, off, Opcode::QUIT))
+    {
+        constraints.emplace_back();
+        if(!read_constraint(stmt, bytecode, off, constraints.back()) || !read_opcode(bytecode, off, Opcode::AND))
+        {
+            return false;
+        }
+    }
+
+    return off == bytecode.size();
+}
+
+//Checks if an index stores every column a statement uses, so the statement can be answered from the index alone
+static bool index_covers(const Statement *stmt, const IndexMetadata &index, size_t column_count)
+{
+    if(stmt->selects_all)
+    {
+        for(cid_t column = 0; column < column_count; column++)
+        {
+            if(!index.stores(column))
+            {
+                return false;
+            }
+        }
+    }
+
+    //Columns have been linked by now, so read each one's id back out of the bytecode
+    return std::all_of(stmt->accessed_columns.begin(), stmt->accessed_columns.end(), [&index](const Statement::Link &link) {
+        return index.stores((uint8_t)(*link.bytecode)[link.bytecode_pos]);
+    });
+}
+
+bool QueryVM::plan_index_scan()
+{
+    //Scan just the matching part of an index rather than the whole table, if possible.
+    //The WHERE clause is still evaluated against each row found, so this only narrows things down.
+    std::vector<IndexConstraint> constraints;
+    if(state.stmt->compiled_where_clause.empty() || !match_index_constraints(state.stmt, state.stmt->compiled_where_clause, constraints))
+    {
+        return false;
+    }
+
+    //Pick the index which can use the most constraints. Its leading columns need to be looked up by value,
+    //except for the last one used, which can be a range. Each combination of values needs its own scan.
+    using Bounds = std::vector<Variable>;
+    const auto &indexes = state.table->get_metadata().indexes;
+    size_t best_index = ID_NONE, best_used = 0;
+    std::vector<std::pair<Bounds, Bounds>> best_scans;
+    for(size_t index_pos = 0; index_pos < indexes.size(); index_pos++)
+    {
+        std::vector<std::pair<Bounds, Bounds>> scans(1);
+        size_t used = 0;
+        for(auto column : indexes[index_pos].columns)
+        {
+            auto constraint = std::find_if(constraints.begin(), constraints.end(), [column](const auto &c) { return c.column == column; });
+            if(constraint == constraints.end())
+            {
+                break;
+            }
+
+            std::vector<std::pair<Bounds, Bounds>> extended;
+            bool points = true;
+            for(const auto &[lower, upper] : scans)
+            {
+                for(const auto &range : constraint->ranges)
+                {
+                    auto &scan = extended.emplace_back(lower, upper);
+                    scan.first.emplace_back(range.first);
+                    scan.second.emplace_back(range.second);
+                    points &= range.first == range.second;
+                }
+            }
+            scans = std::move(extended);
+            used++;
+            if(!points)
+            {
+                break;
+            }
+        }
+
+        if(used > best_used)
+        {
+            best_index = index_pos;
+            best_used = used;
+            best_scans = std::move(scans);
+        }
+    }
+
+    if(best_index == ID_NONE)
+    {
+        return false;
+    }
+
+    //If the index stores every column the query uses, the rows never need to be loaded
+    const auto &index = indexes[best_index];
+    state.covering = state.stmt->query_type == Lexer::Token::Type::SELECT && index_covers(state.stmt, index, state.table->get_metadata().get_column_count());
+
+    state.indexed = true;
+    state.candidates.clear();
+    state.covered.clear();
+    if(state.covering)
+    {
+        state.covered_positions.assign(state.table->get_metadata().get_column_count(), ID_NONE);
+        size_t position = 0;
+        for(auto column : index.columns)
+        {
+            state.covered_positions[column] = position++;
+        }
+        for(auto column : index.included)
+        {
+            state.covered_positions[column] = position++;
+        }
+    }
+
+    //A single range can't find a row twice, so a SELECT reads it lazily, in index order. That way nothing
+    //past the rows returned is read, such as when there's a LIMIT. Other statements change the table as
+    //they go, so they still find every row up front.
+    if(best_scans.size() == 1 && state.stmt->query_type == Lexer::Token::Type::SELECT)
+    {
+        state.cursor = state.table->index_cursor(best_index, best_scans[0].first, best_scans[0].second, &strings);
+        return true;
+    }
+
+    std::vector<std::pair<size_t, row_t>> found;
+    std::vector<row_t> values;
+    for(const auto &[lower, upper] : best_scans)
+    {
+        values.clear();
+        auto rows = state.table->index_scan(best_index, lower, upper, state.covering ? &values : nullptr, &strings);
+        for(size_t a = 0; a < rows.size(); a++)
+        {
+            found.emplace_back(rows[a], state.covering ? std::move(values[a]) : row_t());
+        }
+    }
+
+    //Visit the rows in table order, once each, however many scans found them
+    auto row_less = [](const auto &a, const auto &b) { return a.first < b.first; };
+    auto row_equal = [](const auto &a, const auto &b) { return a.first == b.first; };
+    std::sort(found.begin(), found.end(), row_less);
+    found.erase(std::unique(found.begin(), found.end(), row_equal), found.end());
+
+    for(auto &[row, row_values] : found)
+    {
+        state.candidates.emplace_back(row);
+        if(state.covering)
+        {
+            state.covered.emplace_back(std::move(row_values));
+        }
+    }
+    return true;
 }
 
 bool QueryVM::run_cycle()
@@ -103,8 +527,9 @@ bool QueryVM::run_update_cycle()
     //Update operations complete within a single cycle always
     state.finalised = true;
 
-    //Update each row
-    while (state.row < state.table->get_row_count())
+    //Update each row. Nothing loaded for one row is needed by the next.
+    const size_t mark = strings.mark();
+    for(; state.has_row; next_row(), strings.rewind(mark))
     {
         //Eval the where-clause first (if there is one), don't want to update anything else
         if(!state.stmt->compiled_where_clause.empty())
@@ -113,7 +538,6 @@ bool QueryVM::run_update_cycle()
             auto where_matched = stack.pop(); //pop match result from stack
             if(where_matched.store.int64 == 0)
             {
-                state.row++;
                 continue;
             }
         }
@@ -130,8 +554,6 @@ bool QueryVM::run_update_cycle()
         {
             state.table->update(state.row, *id, stack.pop());
         }
-
-        state.row++;
     }
 
 
@@ -152,16 +574,15 @@ bool QueryVM::run_delete_cycle()
     }
 
     //Else we have a where clause, evaluate it against each row
-    while (state.row < state.table->get_row_count())
+    const size_t mark = strings.mark();
+    for(; state.has_row; next_row(), strings.rewind(mark))
     {
         exec(state.stmt, state.stmt->compiled_where_clause);
         auto where_matched = stack.pop();
         if (where_matched.store.int64 > 0)
         {
             state.table->erase(state.row);
-            continue;
         }
-        state.row++;
     }
 
     return true;
@@ -169,6 +590,12 @@ bool QueryVM::run_delete_cycle()
 
 bool QueryVM::run_create_cycle()
 {
+    if(!state.stmt->new_index_name.empty())
+    {
+        database->create_index(state.stmt->table_id, state.stmt->new_index_name, state.stmt->column_ids, state.stmt->included_column_ids);
+        return state.finalised = true;
+    }
+
     database->create_table(state.stmt->new_table_name, state.stmt->column_definitions);
     return state.finalised = true;
 }
@@ -178,18 +605,21 @@ bool QueryVM::run_select_cycle()
 
 
     //If there's a WHERE clause, keep iterating until we find a match
-    bool match = true;
+    bool match = state.has_row;
     if(!state.stmt->compiled_where_clause.empty())
     {
         match = false;
-        for(; state.row < state.max_rows; state.row++)
+        for(; state.has_row; next_row())
         {
+            //Anything loaded just to check a row which doesn't match can be let go straight away
+            const size_t mark = strings.mark();
             exec(state.stmt, state.stmt->compiled_where_clause);
             if(stack.pop().store.int64)
             {
                 match = true;
                 break;
             }
+            strings.rewind(mark);
         }
     }
 
@@ -198,7 +628,12 @@ bool QueryVM::run_select_cycle()
         state.stmt->rows_returned += exec(state.stmt, state.stmt->compiled_result_clauses);
     }
 
-    state.finalised = ++state.row >= state.max_rows;
+    if(match)
+    {
+        state.max_rows--;
+        next_row();
+    }
+    state.finalised = !state.has_row || state.max_rows == 0;
     return match;
 }
 
@@ -213,19 +648,20 @@ bool QueryVM::run_insert_cycle()
         throw SemanticError("Can't insert wrong number of values");
     }
 
-    std::vector<Variable> values(col_count);
-    while(value_count > 0)
+    //Rows come off the stack last first, so fill them in from the back
+    std::vector<std::vector<Variable>> rows(value_count / col_count, std::vector<Variable>(col_count));
+    for(auto row = rows.rbegin(); row != rows.rend(); ++row)
     {
         for(size_t a = col_count; a-- > 0;)
         {
             // Insert order can be specified for batch inserts
             // So rearrange the results to match the *actual* table order
             const size_t col_id = is_order_specified ? state.stmt->column_ids[a] : a;
-            values[col_id] = stack.pop();
+            (*row)[col_id] = stack.pop();
         }
-        value_count -= col_count;
     }
-    state.table->insert(values);
+
+    (void)state.table->insert_rows(rows);
 
     return state.finalised = true;
 }
@@ -270,7 +706,7 @@ size_t QueryVM::exec(Statement *stmt, std::string_view bytecode)
 {
     size_t before = stack.size();
     size_t off = 0;
-    static void *dispatch_table[] = { &&do_exit, &&do_push_int64, &&do_push_string, &&do_mult, &&do_div, &&do_mod, &&do_sub, &&do_add, &&do_comp_ne, &&do_comp_eq, &&do_comp_gt, &&do_comp_lt, &&do_load_col, &&do_load_all, &&exec_sub_query, &&exec_frame_marker, &&exec_filter_mutual, &&exec_flip};
+    static void *dispatch_table[] = { &&do_exit, &&do_push_int64, &&do_push_string, &&do_mult, &&do_div, &&do_mod, &&do_sub, &&do_add, &&do_comp_ne, &&do_comp_eq, &&do_comp_gt, &&do_comp_lt, &&do_load_col, &&do_load_all, &&exec_sub_query, &&exec_frame_marker, &&exec_filter_mutual, &&exec_flip, &&do_comp_between, &&do_and};
     DISPATCH();
     while(true)
     {
@@ -351,11 +787,31 @@ size_t QueryVM::exec(Statement *stmt, std::string_view bytecode)
             CONSUME_BYTES(1);
             DISPATCH();
         }
+        do_comp_between:
+        {
+            auto upper = stack.pop(), lower = stack.pop(), value = stack.pop();
+            stack.push(!(value < lower).store.int64 && !(value > upper).store.int64);
+            CONSUME_BYTES(1);
+            DISPATCH();
+        }
+        do_and:
+        {
+            auto s1 = stack.pop(), s2 = stack.pop();
+            stack.push(s1.store.int64 != 0 && s2.store.int64 != 0);
+            CONSUME_BYTES(1);
+            DISPATCH();
+        }
         do_load_col:
         {
             const auto col_index = (uint8_t)bytecode[off + 1];
-            const auto &col = state.table->load(state.row, col_index);
-            stack.push(col);
+            if(state.covering)
+            {
+                stack.push(state.covered_row[state.covered_positions[col_index]]);
+            }
+            else
+            {
+                stack.push(state.table->load(state.row, col_index, strings));
+            }
             CONSUME_BYTES(2);
             DISPATCH();
         }
@@ -363,10 +819,17 @@ size_t QueryVM::exec(Statement *stmt, std::string_view bytecode)
         {
             if(state.table)
             {
-                const size_t row_count = state.table->get_row_count();
-                for(size_t a = 0; a < row_count; a++)
+                const size_t col_count = state.table->get_metadata().get_column_count();
+                for(size_t a = 0; a < col_count; a++)
+                {
+                    stack.push(state.covering ? state.covered_row[state.covered_positions[a]] : state.table->load(state.row, a, strings));
+                }
+            }
+            else if(state.row < state.derived.size())
+            {
+                for(const auto &value : state.derived[state.row])
                 {
-                    stack.push(state.table->load(state.row, a));
+                    stack.push(value);
                 }
             }
 
@@ -423,6 +886,7 @@ void QueryVM::reset()
 {
     stack.clear();
     state_stack.clear();
+    strings.clear();
 }
 
-#pragma clang diagnostic pop
\ No newline at end of file
+#pragma clang diagnostic pop
\ No newline at end of file
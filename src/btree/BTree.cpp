@@ -6,14 +6,15 @@
 #include "btree/NodeStore.h"
 #include "btree/BTree.h"
 
-Tree::Tree()
+Tree::Tree(size_t cache_capacity)
+: store(cache_capacity)
 {
 
 }
 
-bool Tree::create(Filesystem::Handle file)
+bool Tree::create(Filesystem::Handle file, uint64_t order, bool duplicates, uint64_t key_width, bool copy_on_write)
 {
-    return store.create(std::move(file));
+    return store.create(std::move(file), order, duplicates, key_width, copy_on_write);
 }
 
 bool Tree::open(Filesystem::Handle file)
@@ -23,48 +24,303 @@ bool Tree::open(Filesystem::Handle file)
 
 
 std::optional<uint64_t> Tree::search(const uint64_t key)
+{
+    return search(Key(&key, 1));
+}
+
+std::optional<uint64_t> Tree::search(Key key)
+{
+    return search_from(store.root(), key);
+}
+
+std::optional<uint64_t> Tree::search_from(uint64_t root, Key key)
+{
+    assert(key.size() == store.key_width());
+
+    // Go through an iterator, as with duplicates the first match might be at the start of the next leaf
+    auto iter = seek_from(root, key);
+    if(iter.valid() && iter.starts_with(key))
+    {
+        return iter.value();
+    }
+
+    return {};
+}
+
+std::optional<uint64_t> Tree::last()
 {
     auto node = store.load_root();
-    if(!node.valid())
+    while(node.valid() && !node->leaf)
+    {
+        node = store.load(node->children[node->count]);
+    }
+
+    if(!node.valid() || !node->count)
     {
         return {};
     }
+    return *node->key(node->count - 1);
+}
+
+void Tree::insert(uint64_t key, uint64_t val)
+{
+    insert(Key(&key, 1), val);
+}
 
-    while(node->count)
+void Tree::insert(Key key, uint64_t val)
+{
+    assert(key.size() == store.key_width());
+    if(store.copy_on_write())
     {
+        // Don't copy the path down to an entry that's already there, as nothing would publish the copies
         size_t location;
-        if(node->search(key, location))
+        auto leaf = find_leaf(store.root(), key.data(), val);
+        if(leaf.valid() && locate(leaf, key.data(), val, location))
         {
-            return true;
+            throw std::logic_error("Item already in tree!");
         }
+    }
 
-        node = store.load(node->children[location]);
+    auto root = modify_root();
+    if(!root.valid())
+    {
+        root = store.alloc();
+        store.set_root(root);
+        store.height() = 1;
     }
 
-    return false;
+    Entry separator{};
+    NodePtr right_node;
+    insert_btree(root, key.data(), val, separator, right_node);
+    store.size()++;
+
+    if(right_node.valid())
+    {
+        auto temp_root = store.alloc();
+        temp_root->leaf = false;
+        temp_root->count = 1;
+        temp_root->set_key(0, separator.key.data());
+        temp_root->values[0] = separator.val;
+        temp_root->children[0] = root->id;
+        temp_root->children[1] = right_node->id;
+        store.set_root(temp_root);
+        store.height()++;
+    }
+    store.publish();
 }
 
-void Tree::insert(uint64_t key, uint64_t val)
+bool Tree::bulk_load(const std::function<bool(uint64_t &key, uint64_t &val)> &source, double fill_factor)
 {
-    bool is_taller = false;
-    uint64_t median;
+    assert(store.key_width() == 1);
+    return bulk_load([&](uint64_t *key, uint64_t &val) { return source(*key, val); }, fill_factor);
+}
 
-    NodePtr right_child;
-    auto root = store.load_root();
-    insert_btree(root, key, val, median, right_child, is_taller);
+bool Tree::bulk_load(const std::function<bool(uint64_t *key, uint64_t &val)> &source, double fill_factor)
+{
+    if(store.load_root().valid())
+    {
+        return false;
+    }
+
+    // Never pack below the minimum occupancy, else the tree wouldn't be balanced
+    fill_factor = std::clamp(fill_factor, 0.0, 1.0);
+    const size_t target = std::max(min_keys(), static_cast<size_t>(static_cast<double>(store.order() - 1) * fill_factor));
 
-    if(is_taller)
+    // The node currently being filled at each level, leaves first
+    std::vector<NodePtr> open;
+    std::vector<uint64_t> key(store.key_width());
+    uint64_t val;
+    while(source(key.data(), val))
     {
-        auto left = store.load_root().valid() ? store.load_root()->id : 0;
-        auto right = right_child.valid() ? right_child->id : 0;
+        if(open.empty())
+        {
+            open.emplace_back(store.alloc());
+        }
+        else if(!less(open[0]->key(open[0]->count - 1), open[0]->values[open[0]->count - 1], key.data(), val))
+        {
+            throw std::logic_error("Bulk load keys must be sorted and unique!");
+        }
 
-        auto temp_root = store.alloc();
-        temp_root->count = 1;
-        temp_root->list[0] = median;
-        temp_root->children[0] = left;
-        temp_root->children[1] = right;
-        store.set_root(temp_root);
-        store.height()++;
+        // Start a new leaf once the current one is full enough, and link it into the chain
+        if(open[0]->count == target)
+        {
+            auto leaf = store.alloc();
+            open[0]->next = leaf->id;
+            bulk_push_separator(open, 1, open[0]->id, {key, val}, leaf->id, target);
+            open[0] = std::move(leaf);
+        }
+
+        auto &leaf = open[0];
+        leaf->set_key(leaf->count, key.data());
+        leaf->values[leaf->count] = val;
+        leaf->count++;
+        store.size()++;
+    }
+
+    if(open.empty())
+    {
+        return true;
+    }
+
+    store.set_root(open.back());
+    store.height() = open.size();
+    open.clear();
+
+    bulk_fix_right_edge();
+    store.publish();
+    return true;
+}
+
+void Tree::insert_sorted(const std::function<bool(uint64_t &key, uint64_t &val)> &source)
+{
+    assert(store.key_width() == 1);
+    insert_sorted([&](uint64_t *key, uint64_t &val) { return source(*key, val); });
+}
+
+void Tree::insert_sorted(const std::function<bool(uint64_t *key, uint64_t &val)> &source)
+{
+    const size_t width = store.key_width();
+    const size_t full = store.order() - 1;
+    std::vector<NodePtr> rightmost;
+    std::vector<uint64_t> key(width);
+    uint64_t val;
+    while(source(key.data(), val))
+    {
+        if(rightmost.empty())
+        {
+            rightmost = rightmost_path();
+        }
+
+        auto &leaf = rightmost[0];
+        if(leaf->count && !less(leaf->key(leaf->count - 1), leaf->values[leaf->count - 1], key.data(), val))
+        {
+            // Not past the end of the tree, so it has to go in the usual way
+            finish_append(rightmost);
+            insert(Key(key.data(), width), val);
+            continue;
+        }
+
+        // Start a new leaf once the last one is full, leaving it packed
+        if(leaf->count == full)
+        {
+            auto next = store.alloc();
+            leaf->next = next->id;
+            leaf->dirty = true;
+            bulk_push_separator(rightmost, 1, leaf->id, {key, val}, next->id, full);
+            rightmost[0] = std::move(next);
+        }
+
+        rightmost[0]->insert(key.data(), val, 0, rightmost[0]->count);
+        store.size()++;
+    }
+
+    finish_append(rightmost);
+}
+
+std::vector<NodePtr> Tree::rightmost_path()
+{
+    std::vector<NodePtr> path;
+    auto node = modify_root();
+    if(!node.valid())
+    {
+        node = store.alloc();
+        store.set_root(node);
+        store.height() = 1;
+    }
+
+    while(!node->leaf)
+    {
+        auto child = modify_child(node, node->count);
+        path.emplace_back(std::move(node));
+        node = std::move(child);
+    }
+    path.emplace_back(std::move(node));
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+void Tree::finish_append(std::vector<NodePtr> &rightmost)
+{
+    if(rightmost.empty())
+    {
+        return;
+    }
+
+    // Appending may have added levels at the top, and left the newest node at each level short
+    store.set_root(rightmost.back());
+    store.height() = rightmost.size();
+    rightmost.clear();
+
+    bulk_fix_right_edge();
+    store.publish();
+}
+
+void Tree::bulk_push_separator(std::vector<NodePtr> &open, size_t level, uint64_t left, const Entry &separator, uint64_t right, size_t target)
+{
+    // First node at this level, so it becomes the new top of the tree
+    if(level == open.size())
+    {
+        auto node = store.alloc();
+        node->leaf = false;
+        node->count = 1;
+        node->set_key(0, separator.key.data());
+        node->values[0] = separator.val;
+        node->children[0] = left;
+        node->children[1] = right;
+        open.emplace_back(std::move(node));
+        return;
+    }
+
+    // If the current node is full enough, the new child starts a new one and the separator moves up
+    auto &node = open[level];
+    if(node->count == target)
+    {
+        auto sibling = store.alloc();
+        sibling->leaf = false;
+        sibling->children[0] = right;
+        bulk_push_separator(open, level + 1, node->id, separator, sibling->id, target);
+        open[level] = std::move(sibling);
+        return;
+    }
+
+    node->set_key(node->count, separator.key.data());
+    node->values[node->count] = separator.val;
+    node->children[node->count + 1] = right;
+    node->count++;
+    node->dirty = true;
+}
+
+void Tree::bulk_fix_right_edge()
+{
+    // Every node is packed apart from the last one at each level, which may be short (or even
+    // have a single child). Fix the highest short node down the right edge first, so that its
+    // parent always has a left sibling to borrow from or merge with. Merges may leave the parent
+    // short again, so keep going until the whole edge is balanced.
+    bool balanced = false;
+    while(!balanced)
+    {
+        auto node = store.load_root();
+        if(!node->leaf && !node->count)
+        {
+            auto new_root = store.load(node->children[0]);
+            store.set_root(new_root);
+            store.height()--;
+            store.free(node);
+            continue;
+        }
+
+        balanced = true;
+        while(!node->leaf)
+        {
+            auto child = store.load(node->children[node->count]);
+            if(child->count < min_keys())
+            {
+                rebalance_node(node, child, node->count);
+                balanced = false;
+                break;
+            }
+            node = std::move(child);
+        }
     }
 }
 
@@ -84,157 +340,316 @@ void Tree::in_order()
     }
 }
 
-bool Tree::erase(uint64_t key)
+bool Tree::erase(uint64_t key, uint64_t val)
 {
-    size_t position = 0;
-    size_t depth = 1;
-    bool doDelete = false;
-    auto root = store.load_root();
-    if(!erase(root, depth, key, doDelete, position))
+    return erase(Key(&key, 1), val);
+}
+
+bool Tree::erase(Key key, uint64_t val)
+{
+    assert(key.size() == store.key_width());
+    if(store.copy_on_write())
+    {
+        // Don't copy the path down to an entry that isn't there
+        size_t location;
+        auto leaf = find_leaf(store.root(), key.data(), val);
+        if(!leaf.valid() || !locate(leaf, key.data(), val, location))
+        {
+            return false;
+        }
+    }
+
+    auto root = modify_root();
+    if(!root.valid() || !erase(root, key.data(), val))
     {
         return false;
     }
+    store.size()--;
 
     //Tree is shrinking
-#pragma clang diagnostic push
-#pragma ide diagnostic ignored "ConstantConditionsOC"
-#pragma ide diagnostic ignored "UnreachableCode"
-    if(doDelete)
+    if(!root->count)
     {
-        // rebalance_node(root, position, doDelete);
-        if(doDelete)
+        if(root->leaf)
         {
-            auto new_root = store.load(store.load_root()->children[0]);
+            store.set_root(NodePtr());
+            store.height() = 0;
+        }
+        else
+        {
+            auto new_root = store.load(root->children[0]);
             store.set_root(new_root);
             store.height()--;
         }
+        store.free(root);
     }
-#pragma clang diagnostic pop
+    store.publish();
     return true;
 }
 
-void Tree::rebalance_node(NodePtr &node, size_t position, bool &doDelete)
+uint64_t Tree::order() const
 {
-    //Check each sibling node to see if either has more than the minimum
-    if(position > 0 && store.load(node->children[position - 1])->count > NodeOrder / 2)
-    {
-        //Left sibling has enough. Move a key from left sibling into us, and one of our keys into right sibling
-        auto left_child = store.load(node->children[position - 1]);
-        auto right_child = store.load(node->children[position]);
+    return store.order();
+}
 
-        //Extract highest key from left child
-        uint64_t left_val = left_child->list[left_child->count - 1];
-        uint64_t left_val2 = left_child->values[left_child->count - 1];
-        left_child->erase(left_child->count - 1);
+uint64_t Tree::height()
+{
+    return store.height();
+}
 
-        //Move our key into right child
-        right_child->insert(node->list[position - 1], node->values[position - 1], 0, 0);
+uint64_t Tree::size() const
+{
+    return store.size();
+}
 
-        //Replace moved key with left
-        node->list[position - 1] = left_val;
-        node->values[position - 1] = left_val2;
+bool Tree::duplicates() const
+{
+    return store.duplicates();
+}
 
-        //Now we're good
-        doDelete = false;
-    }
-    else if(node->children[position + 1] && store.load(node->children[position + 1])->count > NodeOrder / 2)
+uint64_t Tree::key_width() const
+{
+    return store.key_width();
+}
+
+bool Tree::copy_on_write() const
+{
+    return store.copy_on_write();
+}
+
+Tree::Snapshot Tree::snapshot()
+{
+    if(!store.copy_on_write())
     {
-        //Right has enough
-        auto left_child = store.load(node->children[position]);
-        auto right_child = store.load(node->children[position + 1]);
+        throw std::logic_error("Snapshots need a copy-on-write tree");
+    }
+    return Snapshot(this);
+}
 
-        //Extract lowest key from right child
-        uint64_t right_val = right_child->list[0];
-        uint64_t right_val2 = right_child->values[0];
-        right_child->erase(0);
+uint64_t Tree::node_count() const
+{
+    return store.node_count();
+}
 
-        //Move our key into left child
-        left_child->insert(node->list[position], node->values[position], 0, right_child->count);
+uint64_t Tree::compact()
+{
+    // Publishing first frees anything still retired, so only the live nodes are left
+    store.publish();
+    return store.compact();
+}
 
-        //Replace moved key with right
-        node->list[position] = right_val;
-        node->values[position] = right_val2;
+NodeStore::CacheStats Tree::cache_stats() const
+{
+    return store.cache_stats();
+}
 
-        doDelete = false;
-    }
-    else
+void Tree::flush()
+{
+    store.flush();
+}
+
+Tree::Iterator Tree::begin()
+{
+    return seek(Key());
+}
+
+Tree::Iterator Tree::seek(uint64_t key)
+{
+    return seek(Key(&key, 1));
+}
+
+Tree::Iterator Tree::seek(Key key)
+{
+    return seek_from(store.root(), key);
+}
+
+Tree::Iterator Tree::seek_from(uint64_t root, Key key)
+{
+    Iterator iter(this, root);
+    iter.seek(key);
+    return iter;
+}
+
+NodePtr Tree::find_leaf(uint64_t root, const uint64_t *key, uint64_t val, std::vector<std::pair<NodePtr, size_t>> *parents)
+{
+    auto node = store.load(root);
+    while(node.valid() && !node->leaf)
     {
-        //Else neither has enough, so we need to merge two siblings
-        size_t median_pos;
-        NodePtr left, right;
-        if(node->children[position + 1])
-        {
-            //Merge with right sibling
-            left = store.load(node->children[position]);
-            right = store.load(node->children[position + 1]);
-            median_pos = position;
-        }
-        else
+        // Keys equal to a separator live in the right subtree
+        size_t location;
+        bool found = locate(node, key, val, location);
+        auto child = store.load(node->children[location + found]);
+        if(parents)
         {
-            //Merge with left sibling
-            left = store.load(node->children[position - 1]);
-            right = store.load(node->children[position]);
-            median_pos = position - 1;
+            parents->emplace_back(std::move(node), location + found);
         }
+        node = std::move(child);
+    }
 
-        left->insert(node->list[median_pos], node->values[median_pos], 0, left->count);
-        left->merge_right(right);
+    return node;
+}
 
-        node->erase(median_pos);
-        doDelete = node->count < NodeOrder / 2;
+NodePtr Tree::modify_root()
+{
+    auto root = store.shadow(store.load_root());
+    if(root.valid())
+    {
+        store.set_root(root);
     }
+    return root;
 }
 
-bool Tree::erase(NodePtr &node, size_t depth, uint64_t key, bool &doDelete, size_t position)
+NodePtr Tree::modify_child(NodePtr &node, size_t position)
 {
-    if(!node.valid())
+    auto child = store.shadow(store.load(node->children[position]));
+    if(child->id != node->children[position])
     {
-        return false;
+        node->children[position] = child->id;
+        node->dirty = true;
     }
+    return child;
+}
 
-    bool found = node->search(key, position);
-    if(!found)
+bool Tree::locate(const NodePtr &node, const uint64_t *key, uint64_t val, size_t &location) const
+{
+    bool found = node->search(key, location);
+    if(!store.duplicates())
     {
-        // Keep searching
-        auto child = store.load(node->children[position]);
-        bool erased = erase(child, ++depth, key, doDelete, position);
+        return found;
+    }
+
+    // Entries with the same key are ordered by value
+    const size_t width = store.key_width();
+    auto same_key = [&](size_t position) {
+        return position < node->count && node_search::compare(node->key(position), key, width) == 0;
+    };
+    while(same_key(location) && node->values[location] < val)
+    {
+        location++;
+    }
+    return same_key(location) && node->values[location] == val;
+}
 
-        // If the recursive erase succeeded, and we're in a re-balance state, re-balance the child
-        if(doDelete)
+bool Tree::less(const uint64_t *key_a, uint64_t val_a, const uint64_t *key_b, uint64_t val_b) const
+{
+    const int comparison = node_search::compare(key_a, key_b, store.key_width());
+    if(store.duplicates() && comparison == 0)
+    {
+        return val_a < val_b;
+    }
+    return comparison < 0;
+}
+
+size_t Tree::min_keys() const
+{
+    return (store.order() - 1) / 2;
+}
+
+void Tree::rebalance_node(NodePtr &node, NodePtr &child, size_t position)
+{
+    // Only the sibling which is borrowed from or merged with gets modified, so only it is copied
+    const size_t min = min_keys();
+    NodePtr left = position > 0 ? store.load(node->children[position - 1]) : NodePtr();
+    NodePtr right = position < node->count ? store.load(node->children[position + 1]) : NodePtr();
+    node->dirty = child->dirty = true;
+
+    if(left.valid() && left->count > min)
+    {
+        left = modify_child(node, position - 1);
+        //Left sibling has enough. Move its highest key into the child.
+        if(child->leaf)
+        {
+            child->insert(left->key(left->count - 1), left->values[left->count - 1], 0, 0);
+            node->set_key(position - 1, child->key(0));
+            node->values[position - 1] = child->values[0];
+        }
+        else
+        {
+            //Rotate through the parent, taking the left sibling's last child with it
+            child->insert(node->key(position - 1), node->values[position - 1], child->children[0], 0);
+            child->children[0] = left->children[left->count];
+            node->set_key(position - 1, left->key(left->count - 1));
+            node->values[position - 1] = left->values[left->count - 1];
+        }
+        left->count--;
+        left->dirty = true;
+    }
+    else if(right.valid() && right->count > min)
+    {
+        //Right has enough. Move its lowest key into the child.
+        right = modify_child(node, position + 1);
+        if(child->leaf)
+        {
+            child->insert(right->key(0), right->values[0], 0, child->count);
+            right->erase(0);
+            node->set_key(position, right->key(0));
+            node->values[position] = right->values[0];
+        }
+        else
         {
-            rebalance_node(node, position, doDelete);
+            child->insert(node->key(position), node->values[position], right->children[0], child->count);
+            node->set_key(position, right->key(0));
+            node->values[position] = right->values[0];
+            right->children[0] = right->children[1];
+            right->erase(0);
+        }
+    }
+    else
+    {
+        //Else neither has enough, so we need to merge two siblings. The right one of the pair is
+        //only read before it's freed, so it doesn't need copying.
+        if(left.valid())
+        {
+            left = modify_child(node, position - 1);
+        }
+        size_t median_pos = left.valid() ? position - 1 : position;
+        NodePtr &merge_left = left.valid() ? left : child;
+        NodePtr &merge_right = left.valid() ? child : right;
+
+        if(merge_left->leaf)
+        {
+            merge_left->merge_right(merge_right);
+            merge_left->next = merge_right->next;
+        }
+        else
+        {
+            merge_left->insert(node->key(median_pos), node->values[median_pos], 0, merge_left->count);
+            merge_left->merge_right(merge_right);
         }
 
-        return erased;
+        node->erase(median_pos);
+        store.free(merge_right);
     }
+}
 
-    // We've found it, found is true
+bool Tree::erase(NodePtr &node, const uint64_t *key, uint64_t val)
+{
+    size_t location;
+    bool found = locate(node, key, val, location);
+    if(node->leaf)
     {
-        // If we're not in a leaf, swap with child & erase from child instead
-        if(depth != store.height())
+        if(!found)
         {
-            auto leaf = store.load(node->children[position]);
-            std::swap(node->list[position], leaf->list[leaf->count - 1]);
-            bool erased = erase(leaf, ++depth, key, doDelete, leaf->count - 1);
-            if(doDelete)
-            {
-                rebalance_node(node, position, doDelete);
-            }
-            return erased;
+            return false;
         }
+
+        node->erase(location);
+        return true;
     }
 
-    //We've found the element & we're in a leaf node. Delete the item.
-    node->erase(position);
+    // Keep searching
+    const size_t position = location + found;
+    auto child = modify_child(node, position);
+    if(!erase(child, key, val))
+    {
+        return false;
+    }
 
-    //If this node is still an acceptable size, we're done
-    if(node->count >= NodeOrder / 2)
+    // If the child is now too small, re-balance it with its siblings
+    if(child->count < min_keys())
     {
-        return true;
+        rebalance_node(node, child, position);
     }
 
-    // Else we need to re-balance
-    doDelete = true;
     return true;
 }
 
@@ -245,100 +660,252 @@ void Tree::recurse(NodePtr &node, size_t level, std::map<size_t, std::vector<uin
         return;
     }
 
-    auto c1 = store.load(node->children[0]);
-    recurse(c1, level + 1, levels);
     for(size_t a = 0; a < node->count; a++)
     {
-        levels[level].emplace_back((uint64_t)node->list[a]);
-        auto c2 = store.load(node->children[a + 1]);
-        recurse(c2, level + 1, levels);
+        levels[level].emplace_back(*node->key(a));
     }
     levels[level].emplace_back();
+
+    if(!node->leaf)
+    {
+        for(size_t a = 0; a < node->count + 1; a++)
+        {
+            auto child = store.load(node->children[a]);
+            recurse(child, level + 1, levels);
+        }
+    }
 }
 
-void Tree::insert_btree(NodePtr &node, uint64_t key, uint64_t val, uint64_t &median, NodePtr &right_child, bool &is_taller)
+void Tree::insert_btree(NodePtr &node, const uint64_t *key, uint64_t val, Entry &separator, NodePtr &right_node)
 {
-    if(!node.valid())
+    size_t location;
+    bool found = locate(node, key, val, location);
+    if(node->leaf)
     {
-        //B-tree is empty or search ends at empty subtree
-        median = key;
-        is_taller = true;
+        if(found)
+        {
+            throw std::logic_error("Item already in tree!");
+        }
+
+        insert_node(node, key, val, 0, location, separator, right_node);
         return;
     }
 
-    size_t location;
-    bool found = node->search(key, location);
-    if(found)
+    Entry child_separator{};
+    NodePtr child_right;
+    auto child = modify_child(node, location + found);
+    insert_btree(child, key, val, child_separator, child_right);
+    if(child_right.valid())
     {
-        throw std::logic_error("Item already in tree!");
+        // Child was split, so add the new right half to this node too
+        insert_node(node, child_separator.key.data(), child_separator.val, child_right->id, location + found, separator, right_node);
     }
+}
 
-    auto parent = store.load(node->children[location]);
-    insert_btree(parent, key, val, median, right_child, is_taller);
-    if(is_taller)
+void Tree::insert_node(NodePtr &node, const uint64_t *key, uint64_t val, uint64_t right_child, size_t insert_pos, Entry &separator, NodePtr &right_node)
+{
+    if(node->is_full())
     {
-        if(node->is_full())
-        {
-            NodePtr right;
-            split_node(node, median, val, right_child, location, right, median);
-            if(right->count)
-            {
-                right_child = std::move(right);
-            }
-        }
-        else
-        {
-            node->insert(median, val, right_child.valid() ? right_child->id : 0, location);
-            is_taller = false;
-        }
+        split_node(node, key, val, right_child, insert_pos, separator, right_node);
+        return;
     }
 
+    node->insert(key, val, right_child, insert_pos);
 }
 
-void Tree::split_node(NodePtr &node, uint64_t key, uint64_t val, NodePtr &right_child, size_t insert_pos, NodePtr &right_node, uint64_t &median)
+void Tree::split_node(NodePtr &node, const uint64_t *key, uint64_t val, uint64_t right_child, size_t insert_pos, Entry &separator, NodePtr &right_node)
 {
+    // Lay out everything which needs to go into the two halves, including the new key
+    const size_t order = store.order();
+    const size_t width = store.key_width();
+    std::vector<uint64_t> keys(node->list.begin(), node->list.begin() + node->count * width);
+    std::vector<uint64_t> values(node->values.begin(), node->values.begin() + node->count);
+    std::vector<uint64_t> children(node->children.begin(), node->children.begin() + node->count + 1);
+    keys.insert(keys.begin() + insert_pos * width, key, key + width);
+    values.insert(values.begin() + insert_pos, val);
+    children.insert(children.begin() + insert_pos + 1, right_child);
+
     right_node = store.alloc();
-    size_t mid = (NodeOrder - 1) / 2;
+    right_node->leaf = node->leaf;
+    node->dirty = true;
+    const size_t mid = order / 2;
+    if(node->leaf)
+    {
+        // Leaves keep every key, the separator is just a copy of the right half's first key
+        node->count = mid;
+        right_node->count = order - mid;
+        std::copy(keys.begin(), keys.begin() + mid * width, node->list.begin());
+        std::copy(values.begin(), values.begin() + mid, node->values.begin());
+        std::copy(keys.begin() + mid * width, keys.end(), right_node->list.begin());
+        std::copy(values.begin() + mid, values.end(), right_node->values.begin());
+        separator = {{right_node->key(0), right_node->key(0) + width}, right_node->values[0]};
+
+        right_node->next = node->next;
+        node->next = right_node->id;
+    }
+    else
+    {
+        // Internal nodes move the median key up to the parent. Separators keep their values, to order duplicate keys.
+        node->count = mid;
+        right_node->count = order - mid - 1;
+        std::copy(keys.begin(), keys.begin() + mid * width, node->list.begin());
+        std::copy(values.begin(), values.begin() + mid, node->values.begin());
+        std::copy(children.begin(), children.begin() + mid + 1, node->children.begin());
+        std::copy(keys.begin() + (mid + 1) * width, keys.end(), right_node->list.begin());
+        std::copy(values.begin() + mid + 1, values.end(), right_node->values.begin());
+        std::copy(children.begin() + mid + 1, children.end(), right_node->children.begin());
+        separator = {{keys.begin() + mid * width, keys.begin() + (mid + 1) * width}, values[mid]};
+    }
+}
+
+Tree::Iterator::Iterator(Tree *tree, uint64_t root)
+: tree(tree),
+  root(root)
+{
+
+}
 
-    // Insert into left side
-    if(insert_pos <= mid)
+bool Tree::Iterator::seek(uint64_t key)
+{
+    return seek(Key(&key, 1));
+}
+
+bool Tree::Iterator::seek(Key key)
+{
+    // Pad out partial keys with the smallest possible words, to land on the first key they begin
+    const size_t width = tree->key_width();
+    assert(key.size() <= width);
+    std::vector<uint64_t> padded(width, 0);
+    std::copy(key.begin(), key.end(), padded.begin());
+
+    parents.clear();
+    leaf = tree->find_leaf(root, padded.data(), 0, tree->copy_on_write() ? &parents : nullptr);
+    if(leaf.valid())
     {
-        //Move things on left side of mid into new node
-        size_t index = 0;
-        size_t i = mid;
-        while(i < NodeOrder - 1)
-        {
-            right_node->list[index] = node->list[i];
-            right_node->children[index + 1] = node->children[i + 1];
-            index++;
-            i++;
-        }
+        tree->locate(leaf, padded.data(), 0, position);
+        skip_empty();
+    }
+    return valid();
+}
 
-        node->count = mid;
-        node->insert(key, val, right_child.valid() ? right_child->id : 0, insert_pos);
-        node->count--;
-        median = node->list[node->count];
+bool Tree::Iterator::next()
+{
+    if(!valid())
+    {
+        return false;
+    }
+
+    position++;
+    skip_empty();
+    return valid();
+}
+
+bool Tree::Iterator::valid() const
+{
+    return leaf.valid();
+}
+
+uint64_t Tree::Iterator::key() const
+{
+    assert(valid());
+    return *leaf->key(position);
+}
+
+Tree::Key Tree::Iterator::full_key() const
+{
+    assert(valid());
+    return {leaf->key(position), leaf->key_width};
+}
+
+bool Tree::Iterator::starts_with(Key prefix) const
+{
+    assert(valid() && prefix.size() <= leaf->key_width);
+    return std::equal(prefix.begin(), prefix.end(), leaf->key(position));
+}
+
+uint64_t Tree::Iterator::value() const
+{
+    assert(valid());
+    return leaf->values[position];
+}
 
-        right_node->count = index;
-        right_node->children[0] = node->children[node->count + 1];
+void Tree::Iterator::skip_empty()
+{
+    // Move along the leaf chain until we land on an actual key
+    while(leaf.valid() && position >= leaf->count)
+    {
+        leaf = tree->copy_on_write() ? next_leaf() : tree->store.load(leaf->next);
+        position = 0;
     }
-    else //insert into right side
+}
+
+NodePtr Tree::Iterator::next_leaf()
+{
+    // Climb to the nearest ancestor with a subtree to the right of the one we came up from
+    while(!parents.empty() && parents.back().second >= parents.back().first->count)
     {
-        size_t index = 0;
-        size_t i = mid + 1;
-        while(i < NodeOrder - 1)
-        {
-            right_node->list[index] = node->list[i];
-            right_node->children[index + 1] = node->children[i + 1];
-            index++;
-            i++;
-        }
+        parents.pop_back();
+    }
+    if(parents.empty())
+    {
+        return NodePtr();
+    }
 
-        node->count = mid;
-        right_node->count = index;
+    // Then down the left edge of that subtree
+    auto &[parent, child] = parents.back();
+    auto node = tree->store.load(parent->children[++child]);
+    while(!node->leaf)
+    {
+        auto first = tree->store.load(node->children[0]);
+        parents.emplace_back(std::move(node), 0);
+        node = std::move(first);
+    }
+    return node;
+}
+
+Tree::Snapshot::Snapshot(Tree *tree)
+: tree(tree)
+{
+    generation = tree->store.acquire_snapshot(root);
+}
 
-        median = node->list[mid];
-        right_node->insert(key, val, right_child.valid() ? right_child->id : 0, insert_pos - mid - 1);
-        right_node->children[0] = node->children[node->count + 1];
+Tree::Snapshot::Snapshot(Snapshot &&o) noexcept
+: tree(o.tree),
+  root(o.root),
+  generation(o.generation)
+{
+    o.tree = nullptr;
+}
+
+Tree::Snapshot::~Snapshot()
+{
+    if(tree)
+    {
+        tree->store.release_snapshot(generation);
     }
-}
\ No newline at end of file
+}
+
+std::optional<uint64_t> Tree::Snapshot::search(uint64_t key)
+{
+    return search(Key(&key, 1));
+}
+
+std::optional<uint64_t> Tree::Snapshot::search(Key key)
+{
+    return tree->search_from(root, key);
+}
+
+Tree::Iterator Tree::Snapshot::begin()
+{
+    return seek(Key());
+}
+
+Tree::Iterator Tree::Snapshot::seek(uint64_t key)
+{
+    return seek(Key(&key, 1));
+}
+
+Tree::Iterator Tree::Snapshot::seek(Key key)
+{
+    return tree->seek_from(root, key);
+}
@@ -0,0 +1,283 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#include <atomic>
+#include "btree/ConcurrentTree.h"
+
+ConcurrentTree::ConcurrentTree(size_t cache_capacity)
+: tree(cache_capacity)
+{
+
+}
+
+bool ConcurrentTree::create(Filesystem::Handle file, uint64_t order, uint64_t key_width)
+{
+    return tree.create(std::move(file), order, false, key_width);
+}
+
+bool ConcurrentTree::open(Filesystem::Handle file)
+{
+    return tree.open(std::move(file)) && !tree.duplicates() && !tree.copy_on_write();
+}
+
+std::optional<uint64_t> ConcurrentTree::search(uint64_t key)
+{
+    return search(Key(&key, 1));
+}
+
+std::optional<uint64_t> ConcurrentTree::search(Key key)
+{
+    assert(key.size() == tree.key_width());
+    std::optional<uint64_t> result;
+    while(!try_search(key.data(), result))
+    {
+        // A writer changed something we read, start again from the root
+    }
+    return result;
+}
+
+void ConcurrentTree::insert(uint64_t key, uint64_t val)
+{
+    insert(Key(&key, 1), val);
+}
+
+void ConcurrentTree::insert(Key key, uint64_t val)
+{
+    assert(key.size() == tree.key_width());
+    auto &store = tree.store;
+    WriteLatches latches(root_latch);
+    auto root = store.load_root();
+    if(!root.valid())
+    {
+        root = store.alloc();
+        std::atomic_ref(store.height()).store(1);
+        store.set_root(root);
+    }
+
+    latches.push(std::move(root), true);
+    while(!latches.nodes.back()->leaf)
+    {
+        size_t location;
+        const auto &node = latches.nodes.back();
+        bool found = tree.locate(node, key.data(), val, location);
+        const uint64_t child = node->children[location + found];
+        latches.push(store.load(child), true);
+    }
+
+    // Only the highest latched node can split without a latched parent to take the separator,
+    // and that only happens when it's the root, in which case the root latch is still held.
+    Tree::Entry separator{};
+    NodePtr right_node;
+    auto &top = latches.nodes.front();
+    tree.insert_btree(top, key.data(), val, separator, right_node);
+    std::atomic_ref(store.size()).fetch_add(1);
+
+    if(right_node.valid())
+    {
+        assert(latches.root_latch);
+        auto new_root = store.alloc();
+        new_root->leaf = false;
+        new_root->count = 1;
+        new_root->set_key(0, separator.key.data());
+        new_root->values[0] = separator.val;
+        new_root->children[0] = top->id;
+        new_root->children[1] = right_node->id;
+        store.set_root(new_root);
+        std::atomic_ref(store.height()).fetch_add(1);
+    }
+}
+
+bool ConcurrentTree::erase(uint64_t key)
+{
+    return erase(Key(&key, 1));
+}
+
+bool ConcurrentTree::erase(Key key)
+{
+    assert(key.size() == tree.key_width());
+    auto &store = tree.store;
+    WriteLatches latches(root_latch);
+    auto root = store.load_root();
+    if(!root.valid())
+    {
+        return false;
+    }
+
+    // Nothing above the leaf changes, so only one node needs to be held at a time
+    latches.push(std::move(root), false);
+    while(!latches.nodes.back()->leaf)
+    {
+        size_t location;
+        const auto &node = latches.nodes.back();
+        bool found = tree.locate(node, key.data(), 0, location);
+        const uint64_t child = node->children[location + found];
+        latches.push(store.load(child), false);
+    }
+
+    auto &leaf = latches.nodes.back();
+    size_t location;
+    if(!tree.locate(leaf, key.data(), 0, location))
+    {
+        return false;
+    }
+
+    leaf->erase(location);
+    std::atomic_ref(store.size()).fetch_sub(1);
+    return true;
+}
+
+uint64_t ConcurrentTree::height()
+{
+    return std::atomic_ref(tree.store.height()).load();
+}
+
+uint64_t ConcurrentTree::size()
+{
+    return std::atomic_ref(tree.store.size()).load();
+}
+
+NodeStore::CacheStats ConcurrentTree::cache_stats() const
+{
+    return tree.cache_stats();
+}
+
+void ConcurrentTree::flush()
+{
+    tree.flush();
+}
+
+bool ConcurrentTree::try_search(const uint64_t *key, std::optional<uint64_t> &result)
+{
+    auto &store = tree.store;
+    const uint64_t root_version = root_latch.read_lock();
+    auto node = store.load_root();
+    if(!node.valid())
+    {
+        result.reset();
+        return root_latch.validate(root_version);
+    }
+
+    uint64_t version = node->latch.read_lock();
+    if(!root_latch.validate(root_version))
+    {
+        return false;
+    }
+
+    while(!node->leaf)
+    {
+        size_t location;
+        bool found = optimistic_search(*node, key, location);
+        const uint64_t child_id = node->children.data()[location + found];
+
+        // Make sure the child id wasn't read mid-write before following it
+        if(!node->latch.validate(version))
+        {
+            return false;
+        }
+
+        auto child = store.load(child_id);
+        if(!child.valid())
+        {
+            return false;
+        }
+
+        // The parent must still be unchanged once the child's version is known, or the key may have moved to a new sibling
+        const uint64_t child_version = child->latch.read_lock();
+        if(!node->latch.validate(version))
+        {
+            return false;
+        }
+
+        node = std::move(child);
+        version = child_version;
+    }
+
+    size_t location;
+    if(optimistic_search(*node, key, location))
+    {
+        const uint64_t value = node->values.data()[location];
+        result = value;
+    }
+    else
+    {
+        result.reset();
+    }
+    return node->latch.validate(version);
+}
+
+bool ConcurrentTree::optimistic_search(const Node &node, const uint64_t *key, size_t &location)
+{
+    // A plain binary search written out in full, as anything it called would be checked by the sanitizer
+    const size_t width = node.key_width;
+    const uint64_t *keys = node.list.data();
+    size_t count = node.count;
+    if(count > node.order - 1)
+    {
+        count = node.order - 1;
+    }
+
+    size_t low = 0, high = count;
+    bool found = false;
+    while(low < high)
+    {
+        const size_t mid = low + (high - low) / 2;
+        const uint64_t *mid_key = keys + mid * width;
+        size_t a = 0;
+        while(a < width && mid_key[a] == key[a])
+        {
+            a++;
+        }
+
+        if(a < width && mid_key[a] < key[a])
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+            found = a == width;
+        }
+    }
+
+    // The last key to move 'high' down is the one at 'low', so that's whether it matched
+    location = low;
+    return found && location < count;
+}
+
+ConcurrentTree::WriteLatches::WriteLatches(NodeLatch &root_latch)
+: root_latch(&root_latch)
+{
+    root_latch.lock();
+}
+
+ConcurrentTree::WriteLatches::~WriteLatches()
+{
+    release_above();
+}
+
+void ConcurrentTree::WriteLatches::push(NodePtr node, bool inserting)
+{
+    assert(node.valid());
+    node->latch.lock();
+    if(!inserting || !node->is_full())
+    {
+        release_above();
+    }
+    nodes.emplace_back(std::move(node));
+}
+
+void ConcurrentTree::WriteLatches::release_above()
+{
+    for(auto &node : nodes)
+    {
+        node->latch.unlock();
+    }
+    nodes.clear();
+
+    if(root_latch)
+    {
+        root_latch->unlock();
+        root_latch = nullptr;
+    }
+}
@@ -4,11 +4,3 @@
 
 #include "btree/Node.h"
 #include "btree/NodeStore.h"
-
-void NodePtr::release()
-{
-    if(store)
-    {
-        store->free(node);
-    }
-}
@@ -0,0 +1,169 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#include "btree/NodeSearch.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define NODE_SEARCH_X86
+#include <immintrin.h>
+#endif
+
+namespace node_search
+{
+    // Below this many keys, the vectorised searches compare every remaining key at once
+    static constexpr size_t SimdWindow = 4;
+
+    size_t linear(const uint64_t *keys, size_t count, uint64_t key)
+    {
+        size_t location = 0;
+        while(location < count && key > keys[location])
+        {
+            location++;
+        }
+        return location;
+    }
+
+    // Narrows the search down to a window of at most 'window' keys, without branching on the comparisons
+    static inline const uint64_t *narrow(const uint64_t *base, size_t &count, uint64_t key, size_t window)
+    {
+        while(count > window)
+        {
+            const size_t half = count / 2;
+            base = base[half] < key ? base + half : base;
+            count -= half;
+        }
+        return base;
+    }
+
+    size_t binary(const uint64_t *keys, size_t count, uint64_t key)
+    {
+        if(!count)
+        {
+            return 0;
+        }
+
+        const uint64_t *base = narrow(keys, count, key, 1);
+        return (base - keys) + (*base < key);
+    }
+
+#ifdef NODE_SEARCH_X86
+    // There's no unsigned 64-bit compare, so flip the sign bits and compare signed instead
+    static constexpr uint64_t SignBit = 0x8000000000000000ull;
+
+    __attribute__((target("sse4.2")))
+    size_t sse42(const uint64_t *keys, size_t count, uint64_t key)
+    {
+        const uint64_t *base = narrow(keys, count, key, SimdWindow);
+        const __m128i sign = _mm_set1_epi64x(static_cast<int64_t>(SignBit));
+        const __m128i needle = _mm_xor_si128(_mm_set1_epi64x(static_cast<int64_t>(key)), sign);
+
+        // Keys are sorted, so the lower bound is the number of keys less than the needle
+        size_t less = 0;
+        size_t a = 0;
+        for(; a + 2 <= count; a += 2)
+        {
+            __m128i block = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(base + a)), sign);
+            less += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(needle, block))));
+        }
+        for(; a < count; a++)
+        {
+            less += base[a] < key;
+        }
+
+        return (base - keys) + less;
+    }
+
+    __attribute__((target("avx2")))
+    size_t avx2(const uint64_t *keys, size_t count, uint64_t key)
+    {
+        const uint64_t *base = narrow(keys, count, key, SimdWindow);
+        const __m256i sign = _mm256_set1_epi64x(static_cast<int64_t>(SignBit));
+        const __m256i needle = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<int64_t>(key)), sign);
+
+        size_t less = 0;
+        size_t a = 0;
+        for(; a + 4 <= count; a += 4)
+        {
+            __m256i block = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(base + a)), sign);
+            less += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(needle, block))));
+        }
+        for(; a < count; a++)
+        {
+            less += base[a] < key;
+        }
+
+        return (base - keys) + less;
+    }
+
+    bool supports_sse42()
+    {
+        return __builtin_cpu_supports("sse4.2");
+    }
+
+    bool supports_avx2()
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+#else
+    size_t sse42(const uint64_t *keys, size_t count, uint64_t key)
+    {
+        return binary(keys, count, key);
+    }
+
+    size_t avx2(const uint64_t *keys, size_t count, uint64_t key)
+    {
+        return binary(keys, count, key);
+    }
+
+    bool supports_sse42()
+    {
+        return false;
+    }
+
+    bool supports_avx2()
+    {
+        return false;
+    }
+#endif
+
+    size_t lower_bound(const uint64_t *keys, size_t count, size_t width, const uint64_t *key)
+    {
+        // Single word keys can use the vectorised searches
+        if(width == 1)
+        {
+            return lower_bound(keys, count, *key);
+        }
+
+        size_t first = 0;
+        while(count > 0)
+        {
+            const size_t half = count / 2;
+            if(compare(keys + (first + half) * width, key, width) < 0)
+            {
+                first += half + 1;
+                count -= half + 1;
+            }
+            else
+            {
+                count = half;
+            }
+        }
+        return first;
+    }
+
+    SearchFunc best()
+    {
+        if(supports_avx2())
+        {
+            return avx2;
+        }
+
+        if(supports_sse42())
+        {
+            return sse42;
+        }
+
+        return binary;
+    }
+}
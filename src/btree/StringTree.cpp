@@ -0,0 +1,345 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#include <stdexcept>
+#include "btree/StringTree.h"
+
+StringTree::StringTree(size_t cache_capacity)
+: store(cache_capacity)
+{
+
+}
+
+bool StringTree::create(Filesystem::Handle file)
+{
+    return store.create(std::move(file));
+}
+
+bool StringTree::open(Filesystem::Handle file)
+{
+    return store.open(std::move(file));
+}
+
+std::optional<uint64_t> StringTree::search(std::string_view key)
+{
+    auto leaf = find_leaf(key);
+    size_t location;
+    if(leaf.valid() && leaf->search(key, location))
+    {
+        return leaf->values[location];
+    }
+
+    return {};
+}
+
+void StringTree::insert(std::string_view key, uint64_t val)
+{
+    if(key.size() > max_key_size())
+    {
+        throw std::length_error("Key is too long for tree");
+    }
+
+    auto root = store.load_root();
+    if(!root.valid())
+    {
+        root = store.alloc();
+        store.set_root(root);
+        store.height() = 1;
+    }
+
+    std::string separator;
+    StringNodePtr right_node;
+    insert(root, key, val, separator, right_node);
+    store.size()++;
+
+    if(right_node.valid())
+    {
+        auto new_root = store.alloc();
+        new_root->leaf = false;
+        new_root->children.emplace_back(root->id);
+        new_root->insert(0, std::move(separator), right_node->id);
+        store.set_root(new_root);
+        store.height()++;
+    }
+}
+
+bool StringTree::erase(std::string_view key)
+{
+    auto root = store.load_root();
+    if(!root.valid() || !erase(root, key))
+    {
+        return false;
+    }
+    store.size()--;
+
+    //Tree is shrinking
+    if(!root->count())
+    {
+        if(root->leaf)
+        {
+            store.set_root(StringNodePtr());
+            store.height() = 0;
+        }
+        else
+        {
+            auto new_root = store.load(root->children[0]);
+            store.set_root(new_root);
+            store.height()--;
+        }
+        store.free(root);
+    }
+    return true;
+}
+
+uint64_t StringTree::height()
+{
+    return store.height();
+}
+
+uint64_t StringTree::size() const
+{
+    return store.size();
+}
+
+size_t StringTree::max_key_size() const
+{
+    return StringNode::MaxKeySize(store.node_size());
+}
+
+StringNodeStore::CacheStats StringTree::cache_stats() const
+{
+    return store.cache_stats();
+}
+
+uint64_t StringTree::node_count() const
+{
+    return store.node_count();
+}
+
+void StringTree::flush()
+{
+    store.flush();
+}
+
+StringTree::Iterator StringTree::begin()
+{
+    return seek({});
+}
+
+StringTree::Iterator StringTree::seek(std::string_view key)
+{
+    Iterator iter(this);
+    iter.seek(key);
+    return iter;
+}
+
+std::string StringTree::shortest_separator(std::string_view left_last, std::string_view right_first)
+{
+    assert(left_last < right_first);
+    return std::string(right_first.substr(0, StringNode::common_prefix(left_last, right_first) + 1));
+}
+
+size_t StringTree::child_position(const StringNodePtr &node, std::string_view key)
+{
+    // Keys equal to a separator live in the right subtree
+    size_t location;
+    bool found = node->search(key, location);
+    return location + found;
+}
+
+size_t StringTree::split_position(const StringNodePtr &node)
+{
+    // Ignore prefix compression, as the shared prefix of each half is at least that of the whole node
+    size_t total = 0;
+    for(const auto &key : node->keys)
+    {
+        total += StringNode::CellOverhead + key.size();
+    }
+
+    // Both halves need a key. Internal nodes also lose the one at the split position to the parent.
+    const size_t last = node->count() - (node->leaf ? 1 : 2);
+    size_t position = 0, running = 0;
+    while(position < last && running * 2 < total)
+    {
+        running += StringNode::CellOverhead + node->keys[position++].size();
+    }
+    return std::max<size_t>(position, 1);
+}
+
+StringNodePtr StringTree::find_leaf(std::string_view key)
+{
+    auto node = store.load_root();
+    while(node.valid() && !node->leaf)
+    {
+        node = store.load(node->children[child_position(node, key)]);
+    }
+
+    return node;
+}
+
+void StringTree::insert(StringNodePtr &node, std::string_view key, uint64_t val, std::string &separator, StringNodePtr &right_node)
+{
+    if(node->leaf)
+    {
+        size_t location;
+        if(node->search(key, location))
+        {
+            throw std::logic_error("Item already in tree!");
+        }
+        node->insert(location, std::string(key), val);
+    }
+    else
+    {
+        std::string child_separator;
+        StringNodePtr child_right;
+        const size_t position = child_position(node, key);
+        auto child = store.load(node->children[position]);
+        insert(child, key, val, child_separator, child_right);
+        if(!child_right.valid())
+        {
+            return;
+        }
+
+        // Child was split, so add the new right half to this node too
+        node->insert(position, std::move(child_separator), child_right->id);
+    }
+
+    if(node->size() > store.node_size())
+    {
+        split(node, separator, right_node);
+    }
+}
+
+void StringTree::split(StringNodePtr &node, std::string &separator, StringNodePtr &right_node)
+{
+    right_node = store.alloc();
+    right_node->leaf = node->leaf;
+    separator = node->split(split_position(node), *right_node);
+    if(node->leaf)
+    {
+        // Leaves keep every key, so the separator only needs to be long enough to fall between the two halves
+        separator = shortest_separator(node->keys.back(), right_node->keys.front());
+        right_node->next = node->next;
+        node->next = right_node->id;
+    }
+    assert(node->size() <= store.node_size() && right_node->size() <= store.node_size());
+}
+
+bool StringTree::erase(StringNodePtr &node, std::string_view key)
+{
+    size_t location;
+    if(node->leaf)
+    {
+        if(!node->search(key, location))
+        {
+            return false;
+        }
+
+        node->erase(location);
+        return true;
+    }
+
+    // Keep searching
+    const size_t position = child_position(node, key);
+    auto child = store.load(node->children[position]);
+    if(!erase(child, key))
+    {
+        return false;
+    }
+
+    // If the child is mostly empty, try to fold it into a sibling
+    if(child->size() < store.node_size() / 4)
+    {
+        merge_child(node, position);
+    }
+
+    return true;
+}
+
+void StringTree::merge_child(StringNodePtr &node, size_t position)
+{
+    // Try the left sibling first, then the right
+    for(size_t left_pos : {position - 1, position})
+    {
+        if(left_pos >= node->count())
+        {
+            continue;
+        }
+
+        auto left = store.load(node->children[left_pos]);
+        auto right = store.load(node->children[left_pos + 1]);
+
+        // Internal nodes take the parent's separator as well. Sizes are without prefix compression, which the merged keys may share less of.
+        size_t merged = StringNode::HeaderSize + left->key_bytes + right->key_bytes + (left->count() + right->count()) * StringNode::CellOverhead;
+        if(!left->leaf)
+        {
+            merged += node->keys[left_pos].size() + StringNode::CellOverhead;
+        }
+        if(merged > store.node_size())
+        {
+            continue;
+        }
+
+        left->merge_right(*right, left->leaf ? std::string() : node->keys[left_pos]);
+        node->erase(left_pos);
+        store.free(right);
+        return;
+    }
+}
+
+StringTree::Iterator::Iterator(StringTree *tree)
+: tree(tree)
+{
+
+}
+
+bool StringTree::Iterator::seek(std::string_view key)
+{
+    leaf = tree->find_leaf(key);
+    if(leaf.valid())
+    {
+        leaf->search(key, position);
+        skip_empty();
+    }
+    return valid();
+}
+
+bool StringTree::Iterator::next()
+{
+    if(!valid())
+    {
+        return false;
+    }
+
+    position++;
+    skip_empty();
+    return valid();
+}
+
+bool StringTree::Iterator::valid() const
+{
+    return leaf.valid();
+}
+
+std::string_view StringTree::Iterator::key() const
+{
+    assert(valid());
+    return leaf->keys[position];
+}
+
+uint64_t StringTree::Iterator::value() const
+{
+    assert(valid());
+    return leaf->values[position];
+}
+
+void StringTree::Iterator::skip_empty()
+{
+    // Move along the leaf chain until we land on an actual key
+    while(leaf.valid() && position >= leaf->count())
+    {
+        leaf = tree->store.load(leaf->next);
+        position = 0;
+    }
+}
@@ -4,6 +4,8 @@
 
 #include <memory>
 #include <algorithm>
+#include <bit>
+#include <cstring>
 #include "filesystem/BasicFilesystem.h"
 #include "filesystem/FilesystemBacking.h"
 
@@ -21,8 +23,34 @@ struct STREAM_HEADER
     uint64_t page = 0;
     uint64_t size = 0;
     uint64_t id = 0;
+    uint64_t map_page = 0; // First page of the stream's page map
+    uint64_t extent_next = 0; // Next unused page of the stream's current extent
+    uint64_t extent_end = 0; // One past the last page of the current extent
 };
 
+/*!
+ * Where each page of a stream is, in stream order, so a seek can go straight to the right page
+ * rather than walking the page chain. On disk it's kept in a chain of map pages, each holding
+ * a PAGE_HEADER followed by page numbers, with page_length covering the ones in use.
+ */
+struct PAGE_TABLE
+{
+    std::vector<uint64_t> pages;
+    uint64_t last_map_page = 0; // Where new entries are appended
+    uint64_t handles = 0; // How many handles the stream is open in
+    bool resized = false; // The stream has grown since its size was last written to the stream table
+};
+
+// The free space bitmap is kept in a chain of pages, each holding a PAGE_HEADER then this many words
+static constexpr uint64_t BITMAP_WORDS_PER_PAGE = (PAGE_SIZE - sizeof(PAGE_HEADER)) / sizeof(uint64_t);
+
+// Entries per page map page
+static constexpr uint64_t MAP_ENTRIES_PER_PAGE = (PAGE_SIZE - sizeof(PAGE_HEADER)) / sizeof(uint64_t);
+
+// Stream headers start in the first page after the FILE_HEADER, then carry on in a chain of pages,
+// each holding a PAGE_HEADER then this many headers
+static constexpr uint64_t STREAMS_IN_FIRST_PAGE = (PAGE_SIZE - sizeof(FILE_HEADER)) / sizeof(STREAM_HEADER);
+static constexpr uint64_t STREAMS_PER_PAGE = (PAGE_SIZE - sizeof(PAGE_HEADER)) / sizeof(STREAM_HEADER);
 
 struct StreamHandle
 {
@@ -30,11 +58,30 @@ struct StreamHandle
     uint64_t stream_pos = 0;
     PAGE_HEADER currentPage{};
     STREAM_HEADER stream;
+    PAGE_TABLE *table = nullptr;
+    uint64_t page_index = 0; // Where currentPage is in the stream
+
+    // For read-ahead. The last page read starts off as the one before the first, so reading from the start counts as sequential.
+    uint64_t last_read_page = UINT64_MAX;
+    uint64_t readahead_window = 0; // 0 while reads aren't sequential
+    uint64_t readahead_end = 0; // Pages before this one have already been prefetched
 };
 
-BasicFilesystem::BasicFilesystem(std::unique_ptr<FilesystemBacking> backing)
-        : backing(std::move(backing))
+BasicFilesystem::BasicFilesystem(std::unique_ptr<FilesystemBacking> backing, size_t cache_budget, std::unique_ptr<FilesystemBacking> log)
+        : backing(std::move(backing)),
+          wal(log ? std::make_unique<WriteAheadLog>(std::move(log), PAGE_SIZE) : nullptr),
+          pool(*this->backing, PAGE_SIZE, cache_budget)
 {
+    if(wal)
+    {
+        // Bring the backing up to date with anything committed before it was last closed
+        if(!wal->recover(*this->backing))
+        {
+            abort();
+        }
+        pool.attach_log(wal.get());
+    }
+
     if(!load())
     {
         abort();
@@ -43,8 +90,96 @@ BasicFilesystem::BasicFilesystem(std::unique_ptr<FilesystemBacking> backing)
 
 BasicFilesystem::~BasicFilesystem()
 {
-    backing->seekg(0, std::ios::beg);
-    backing->write(reinterpret_cast<const char *>(&fs_header), sizeof(fs_header));
+    flush();
+}
+
+void BasicFilesystem::flush()
+{
+    if(wal)
+    {
+        (void)checkpoint();
+        return;
+    }
+
+    write_stream_sizes();
+    (void)pool.flush();
+}
+
+bool BasicFilesystem::commit()
+{
+    auto lsn = log_commit();
+    if(!lsn || !wait_durable(*lsn))
+    {
+        return false;
+    }
+
+    // Stop the log growing forever, now that there's nothing uncommitted which would have to be logged first
+    if(wal && wal->size() > CheckpointLogSize)
+    {
+        return checkpoint();
+    }
+    return true;
+}
+
+std::optional<uint64_t> BasicFilesystem::log_commit()
+{
+    write_stream_sizes();
+    if(!wal)
+    {
+        // Without a log, the only way to make the changes durable is to write them all back
+        if(!pool.flush() || !backing->sync())
+        {
+            return {};
+        }
+        return 0;
+    }
+    return pool.log_changes();
+}
+
+bool BasicFilesystem::wait_durable(uint64_t lsn)
+{
+    return !wal || wal->wait_durable(lsn);
+}
+
+bool BasicFilesystem::checkpoint()
+{
+    auto lsn = log_commit();
+    if(!lsn || !wal->wait_durable(*lsn))
+    {
+        return false;
+    }
+
+    // Once every page is written back and synced, the backing has everything the log does, so it can start over
+    return pool.flush() && backing->sync() && wal->reset();
+}
+
+void BasicFilesystem::write_stream_sizes()
+{
+    for(uint64_t id = 0; id < page_tables.size(); id++)
+    {
+        if(page_tables[id] && page_tables[id]->resized)
+        {
+            write_stream_header(id, streams[id]);
+            page_tables[id]->resized = false;
+        }
+    }
+}
+
+WriteAheadLog::Stats BasicFilesystem::log_stats() const
+{
+    return wal ? wal->stats() : WriteAheadLog::Stats();
+}
+
+void BasicFilesystem::write_file_header()
+{
+    auto page = pool.fetch(0);
+    memcpy(page.data(), &fs_header, sizeof(fs_header));
+    page.mark_dirty();
+}
+
+PagePool::Stats BasicFilesystem::cache_stats() const
+{
+    return pool.stats();
 }
 
 
@@ -53,26 +188,51 @@ bool BasicFilesystem::Format(const std::unique_ptr<FilesystemBacking> &backing)
     char page[PAGE_SIZE]{};
     FILE_HEADER header;
     memcpy(page, &header, sizeof(header));
-    return backing->write(page, PAGE_SIZE);
+    return backing->write_at(0, page, PAGE_SIZE);
 }
 
 bool BasicFilesystem::load()
 {
-    bool failed = false;
-    backing->seekg(0, std::ios::beg);
-    failed |= !backing->read(reinterpret_cast<char*>(&fs_header), sizeof(fs_header));
+    const uint64_t size = backing->size();
+    if(size < PAGE_SIZE)
+    {
+        return false;
+    }
+
+    page_count = size / PAGE_SIZE;
+    memcpy(&fs_header, pool.fetch(0).data(), sizeof(fs_header));
+    if(fs_header.magic != FILE_HEADER::Magic || fs_header.version != FILE_HEADER::Version)
+    {
+        return false;
+    }
+    for(uint64_t stream_page = fs_header.stream_page; stream_page; stream_page = read_page_header(stream_page).next_page)
+    {
+        stream_pages.emplace_back(stream_page);
+    }
+
     for(uint64_t a = 0; a < fs_header.stream_count; a++)
     {
         streams.emplace_back(read_stream_header(a));
+
+        // The end of an extent may never have been written, but it's still taken
+        page_count = std::max(page_count, streams.back().extent_end);
     }
-    return !failed;
+    page_tables.resize(streams.size());
+    load_free_map();
+    return true;
 }
 
 void BasicFilesystem::close(void *handle)
 {
     auto ptr = reinterpret_cast<StreamHandle*>(handle);
-    streams[ptr->stream.id] = ptr->stream;
-    write_stream_header(ptr->stream.id, ptr->stream);
+
+    // Leave the stream table alone if the stream didn't grow, so read-only use doesn't dirty it
+    if(ptr->table->resized)
+    {
+        write_stream_header(ptr->stream.id, streams[ptr->stream.id]);
+        ptr->table->resized = false;
+    }
+    ptr->table->handles--;
     delete ptr;
 }
 
@@ -93,6 +253,7 @@ uint64_t BasicFilesystem::read(void *handle_, char *buf, uint64_t len)
 
             handle->currentPage = read_page_header(handle->currentPage.next_page);
             handle->cursor = sizeof(PAGE_HEADER);
+            handle->page_index++;
             continue;
         }
 
@@ -101,12 +262,14 @@ uint64_t BasicFilesystem::read(void *handle_, char *buf, uint64_t len)
             bytes_remaining = len;
         }
 
-        backing->seekg(handle->currentPage.current_page * PAGE_SIZE + handle->cursor, std::ios::beg);
-        backing->read(buf, static_cast<std::streamsize>(bytes_remaining));
+        read_ahead(*handle);
+        auto page = pool.fetch(handle->currentPage.current_page);
+        memcpy(buf, page.data() + handle->cursor, bytes_remaining);
         bytes_read += bytes_remaining;
         buf += bytes_remaining;
         len -= bytes_remaining;
         handle->cursor += bytes_remaining;
+        handle->stream_pos += bytes_remaining;
     }
 
     return bytes_read;
@@ -117,31 +280,42 @@ void BasicFilesystem::write(void *handle_, const char *buf, uint64_t len)
     auto handle = reinterpret_cast<StreamHandle*>(handle_);
     while(len)
     {
-        backing->seekg(handle->currentPage.current_page * PAGE_SIZE + handle->cursor, std::ios::beg);
+        if(handle->cursor == PAGE_SIZE)
+        {
+            // This page is full, so carry on into the next one, adding it if we're at the end of the stream
+            if(!handle->currentPage.next_page)
+            {
+                handle->currentPage.next_page = alloc_stream_page(handle->stream.id, handle->currentPage.current_page);
+                write_page_header(handle->currentPage);
+                append_page_table(*handle->table, handle->currentPage.next_page);
+            }
+            handle->currentPage = read_page_header(handle->currentPage.next_page);
+            handle->cursor = sizeof(PAGE_HEADER);
+            handle->page_index++;
+        }
+
+        // The data and the page header go into the same cached frame, which is written back as one
+        // whole page when it's evicted or flushed, however many writes it took to fill.
         uint64_t bytes_in_page = PAGE_SIZE - handle->cursor;
         uint64_t bytes_to_write = len > bytes_in_page ? bytes_in_page : len;
-        backing->write(buf, bytes_to_write);
+        auto page = pool.fetch(handle->currentPage.current_page);
+        memcpy(page.data() + handle->cursor, buf, bytes_to_write);
         buf += bytes_to_write;
         handle->cursor += bytes_to_write;
+        handle->stream_pos += bytes_to_write;
         len -= bytes_to_write;
 
-        if(handle->cursor > handle->currentPage.page_length || !bytes_to_write)
+        // Only the last page can be partly filled, so going past its end means the stream grew
+        if(handle->cursor > handle->currentPage.page_length)
         {
-            handle->stream.size += bytes_to_write;
+            handle->stream.size = std::max(handle->stream.size, handle->stream_pos);
+            auto &stream = streams[handle->stream.id];
+            stream.size = std::max(stream.size, handle->stream.size);
+            handle->table->resized = true;
             handle->currentPage.page_length = handle->cursor;
-            handle->stream_pos += bytes_to_write;
-            if(handle->cursor == PAGE_SIZE)
-            {
-                handle->currentPage.next_page = alloc_page(handle->currentPage.current_page);
-                write_page_header(handle->currentPage);
-                handle->currentPage = read_page_header(handle->currentPage.next_page);
-                handle->cursor = sizeof(PAGE_HEADER);
-            }
-            else
-            {
-                write_page_header(handle->currentPage);
-            }
+            memcpy(page.data(), &handle->currentPage, sizeof(PAGE_HEADER));
         }
+        page.mark_dirty();
     }
 
 }
@@ -159,7 +333,10 @@ Filesystem::Handle BasicFilesystem::open(const std::string &name, bool should_cr
             return {};
         }
 
-        create(name);
+        if(!create(name))
+        {
+            return {};
+        }
         return open(name, false);
     }
 
@@ -167,109 +344,492 @@ Filesystem::Handle BasicFilesystem::open(const std::string &name, bool should_cr
     handle->stream = *iter;
     handle->cursor = sizeof(PAGE_HEADER);
     handle->currentPage = read_page_header(iter->page);
+    handle->table = page_table(*iter);
+    handle->table->handles++;
     return Filesystem::Handle(this, handle);
 }
 
 PAGE_HEADER BasicFilesystem::read_page_header(uint64_t index)
 {
     PAGE_HEADER ret;
-    const auto orig = backing->tellg();
-    backing->seekg(index * PAGE_SIZE, std::ios::beg);
-    backing->read(reinterpret_cast<char *>(&ret), sizeof(PAGE_HEADER));
-    backing->seekg(orig, std::ios::beg);
+    memcpy(&ret, pool.fetch(index).data(), sizeof(PAGE_HEADER));
     return ret;
 }
 
 void BasicFilesystem::write_page_header(const PAGE_HEADER &header)
 {
-    const auto orig = backing->tellg();
-    backing->seekg(header.current_page * PAGE_SIZE, std::ios::beg);
-    backing->write(reinterpret_cast<const char *>(&header), sizeof(PAGE_HEADER));
-    backing->seekg(orig, std::ios::beg);
+    auto page = pool.fetch(header.current_page);
+    memcpy(page.data(), &header, sizeof(PAGE_HEADER));
+    page.mark_dirty();
 }
 
 uint64_t BasicFilesystem::alloc_page(uint64_t previous_page)
 {
-    const auto orig = backing->tellg();
-    backing->seekg(0, std::ios::end);
-    assert(backing->tellg() % PAGE_SIZE == 0);
-    const uint64_t page = backing->tellg() / PAGE_SIZE;
-    char empty[PAGE_SIZE]{};
+    uint64_t page;
+    if(auto [start, length] = find_free_run(1); length)
+    {
+        page = start;
+        set_free(page, false);
+    }
+    else
+    {
+        page = page_count++;
+    }
+    init_page(page, previous_page);
+    return page;
+}
+
+uint64_t BasicFilesystem::alloc_stream_page(uint64_t stream_id, uint64_t previous_page)
+{
+    auto &stream = streams[stream_id];
+    if(stream.extent_next == stream.extent_end)
+    {
+        // Start a new extent at the end of the file. Making it as long as the stream so far doubles the
+        // stream each time, so the number of extents stays logarithmic until they reach the cap.
+        // Freed pages are used first, even if they don't make up a whole extent, so the file doesn't grow needlessly.
+        const uint64_t wanted = std::clamp<uint64_t>(page_tables[stream_id]->pages.size(), 1, MaxExtentPages);
+        auto [start, length] = find_free_run(wanted);
+        if(length)
+        {
+            for(uint64_t page = start; page < start + length; page++)
+            {
+                set_free(page, false);
+            }
+        }
+        else
+        {
+            start = page_count;
+            length = wanted;
+            page_count += wanted;
+        }
+        stream.extent_next = start;
+        stream.extent_end = start + length;
+    }
+
+    const uint64_t page = stream.extent_next++;
+    write_stream_header(stream_id, stream);
+    init_page(page, previous_page);
+    return page;
+}
+
+void BasicFilesystem::init_page(uint64_t page, uint64_t previous_page)
+{
+    // The page only reaches the backing once it's written back, so it doesn't need reading in first
     PAGE_HEADER header;
     header.current_page = page;
     header.previous_page = previous_page;
-    memcpy(empty, &header, sizeof(header));
-    backing->write(empty, PAGE_SIZE);
-    backing->seekg(orig, std::ios::beg);
-    return page;
+    memcpy(pool.create(page).data(), &header, sizeof(header));
 }
 
 bool BasicFilesystem::create(const std::string &name)
 {
     assert(!name.empty());
     assert(name.size() <= sizeof(STREAM_HEADER::name));
-    STREAM_HEADER stream;
-    memcpy(stream.name, name.c_str(), name.size());
-    stream.page = alloc_page(0);
-    stream.id = fs_header.stream_count++;
 
-    backing->seekg(sizeof(FILE_HEADER) + streams.size() * sizeof(STREAM_HEADER), std::ios::beg);
-    backing->write(reinterpret_cast<const char *>(&stream), sizeof(STREAM_HEADER));
+    // Reuse the slot of a removed stream if there is one
+    auto iter = std::find_if(streams.begin(), streams.end(), [](auto &a) { return !a.name[0]; });
+    if(iter == streams.end())
+    {
+        // Once the first page is full, chain on another page of stream headers
+        if(streams.size() >= STREAMS_IN_FIRST_PAGE + stream_pages.size() * STREAMS_PER_PAGE)
+        {
+            const uint64_t previous = stream_pages.empty() ? 0 : stream_pages.back();
+            const uint64_t stream_page = alloc_page(previous);
+            if(previous)
+            {
+                auto header = read_page_header(previous);
+                header.next_page = stream_page;
+                write_page_header(header);
+            }
+            else
+            {
+                fs_header.stream_page = stream_page;
+            }
+            stream_pages.emplace_back(stream_page);
+        }
 
-    PAGE_HEADER page;
-    page.current_page = stream.page;
-    write_page_header(page);
+        streams.emplace_back().id = fs_header.stream_count++;
+        write_file_header();
+        page_tables.emplace_back();
+        iter = streams.end() - 1;
+    }
 
-    streams.emplace_back(stream);
+    auto &stream = *iter;
+    memcpy(stream.name, name.c_str(), name.size());
+    stream.map_page = alloc_page(0);
+    auto &table = page_tables[stream.id];
+    table = std::make_unique<PAGE_TABLE>();
+    table->last_map_page = stream.map_page;
+
+    stream.page = alloc_stream_page(stream.id, 0);
+    append_page_table(*table, stream.page);
+    write_stream_header(stream.id, stream);
     return true;
 }
 
-uint64_t BasicFilesystem::seek(void *handle_, uint64_t position)
+PAGE_TABLE *BasicFilesystem::page_table(const STREAM_HEADER &stream)
 {
-    auto handle = reinterpret_cast<StreamHandle*>(handle_);
-
-    uint64_t desired_page = position / (PAGE_SIZE - sizeof(STREAM_HEADER));
-    uint64_t current_page = handle->stream_pos / (PAGE_SIZE - sizeof(STREAM_HEADER));
-    while(current_page < desired_page)
+    auto &table = page_tables[stream.id];
+    if(table)
     {
-        if(!handle->currentPage.next_page)
-        {
-            handle->cursor = PAGE_SIZE;
-            handle->stream_pos = handle->stream.size;
-            return handle->stream_pos;
-        }
+        return table.get();
+    }
 
-        handle->currentPage = read_page_header(handle->currentPage.next_page);
-        current_page++;
+    table = std::make_unique<PAGE_TABLE>();
+    for(uint64_t map_page = stream.map_page; map_page;)
+    {
+        auto page = pool.fetch(map_page);
+        PAGE_HEADER header;
+        memcpy(&header, page.data(), sizeof(header));
+
+        const uint64_t count = (header.page_length - sizeof(PAGE_HEADER)) / sizeof(uint64_t);
+        const size_t loaded = table->pages.size();
+        table->pages.resize(loaded + count);
+        memcpy(table->pages.data() + loaded, page.data() + sizeof(PAGE_HEADER), count * sizeof(uint64_t));
+        table->last_map_page = map_page;
+        map_page = header.next_page;
     }
+    return table.get();
+}
 
-    while(current_page > desired_page)
+void BasicFilesystem::append_page_table(PAGE_TABLE &table, uint64_t page)
+{
+    PAGE_HEADER header = read_page_header(table.last_map_page);
+    if(header.page_length + sizeof(uint64_t) > PAGE_SIZE)
     {
-        handle->currentPage = read_page_header(handle->currentPage.previous_page);
-        current_page--;
+        // This map page is full, so chain on another
+        header.next_page = alloc_page(header.current_page);
+        write_page_header(header);
+        header = read_page_header(header.next_page);
+        table.last_map_page = header.current_page;
     }
 
-    handle->cursor = sizeof(PAGE_HEADER) + (position % (PAGE_SIZE - sizeof(PAGE_HEADER)));
-    handle->stream_pos = position > handle->stream.size ? handle->stream.size : position;
+    auto map_page = pool.fetch(header.current_page);
+    memcpy(map_page.data() + header.page_length, &page, sizeof(page));
+    header.page_length += sizeof(page);
+    memcpy(map_page.data(), &header, sizeof(header));
+    map_page.mark_dirty();
+    table.pages.emplace_back(page);
+}
+
+uint64_t BasicFilesystem::seek(void *handle_, uint64_t position)
+{
+    auto handle = reinterpret_cast<StreamHandle*>(handle_);
+    const auto &pages = handle->table->pages;
+
+    // Past the end, so stop at the end of the stream where writes will append
+    position = std::min(position, handle->stream.size);
+
+    // Look the page up directly. Only a stream which exactly fills its last page can
+    // land past the end of the table, in which case stay at the end of that page.
+    const uint64_t index = std::min<uint64_t>(position / page_size(), pages.size() - 1);
+    handle->currentPage = read_page_header(pages[index]);
+    handle->page_index = index;
+    handle->cursor = sizeof(PAGE_HEADER) + (position - index * page_size());
+    handle->stream_pos = position;
     return handle->stream_pos;
 }
 
+std::pair<uint64_t, uint64_t> BasicFilesystem::stream_header_location(uint64_t index) const
+{
+    if(index < STREAMS_IN_FIRST_PAGE)
+    {
+        return {0, sizeof(FILE_HEADER) + index * sizeof(STREAM_HEADER)};
+    }
+    index -= STREAMS_IN_FIRST_PAGE;
+    return {stream_pages[index / STREAMS_PER_PAGE], sizeof(PAGE_HEADER) + (index % STREAMS_PER_PAGE) * sizeof(STREAM_HEADER)};
+}
+
 STREAM_HEADER BasicFilesystem::read_stream_header(uint64_t index)
 {
     STREAM_HEADER ret;
-    assert(backing->read(reinterpret_cast<char *>(&ret), sizeof(STREAM_HEADER)));
+    const auto [page, offset] = stream_header_location(index);
+    memcpy(&ret, pool.fetch(page).data() + offset, sizeof(STREAM_HEADER));
     return ret;
 }
 
 void BasicFilesystem::write_stream_header(uint64_t index, const STREAM_HEADER &header)
 {
-    auto origin = backing->tellg();
-    backing->seekg(sizeof(FILE_HEADER) + index * sizeof(STREAM_HEADER), std::ios::beg);
-    backing->write(reinterpret_cast<const char *>(&header), sizeof(header));
-    backing->seekg(origin, std::ios::beg);
+    const auto [page_index, offset] = stream_header_location(index);
+    auto page = pool.fetch(page_index);
+    memcpy(page.data() + offset, &header, sizeof(header));
+    page.mark_dirty();
+}
+
+const char *BasicFilesystem::view(void *handle_, uint64_t len)
+{
+    auto handle = reinterpret_cast<StreamHandle*>(handle_);
+
+    // Step onto the next page if this one's used up, as read would
+    if(handle->cursor == handle->currentPage.page_length && handle->currentPage.next_page)
+    {
+        handle->currentPage = read_page_header(handle->currentPage.next_page);
+        handle->cursor = sizeof(PAGE_HEADER);
+        handle->page_index++;
+    }
+
+    if(handle->currentPage.page_length - handle->cursor < len)
+    {
+        return nullptr;
+    }
+    read_ahead(*handle);
+
+    // The frame isn't kept pinned, but nothing can evict it until the next call in
+    auto data = pool.fetch(handle->currentPage.current_page).data() + handle->cursor;
+    handle->cursor += len;
+    handle->stream_pos += len;
+    return data;
+}
+
+void BasicFilesystem::read_ahead(StreamHandle &handle)
+{
+    const uint64_t index = handle.page_index;
+    if(index == handle.last_read_page)
+    {
+        return;
+    }
+
+    if(index == handle.last_read_page + 1)
+    {
+        handle.readahead_window = handle.readahead_window ? std::min(handle.readahead_window * 2, MaxReadAhead) : InitialReadAhead;
+    }
+    else
+    {
+        // Jumped somewhere else, so stop prefetching until there's a new run
+        handle.readahead_window = 0;
+        handle.readahead_end = 0;
+    }
+    handle.last_read_page = index;
+    if(!handle.readahead_window)
+    {
+        return;
+    }
+
+    // Top the window back up once half of it has been used, so prefetches go out in batches
+    const auto &pages = handle.table->pages;
+    const uint64_t from = std::max(handle.readahead_end, index + 1);
+    const uint64_t to = std::min<uint64_t>(index + 1 + handle.readahead_window, pages.size());
+    if(to > from && (to - from) * 2 >= handle.readahead_window)
+    {
+        pool.prefetch(pages.data() + from, to - from);
+        handle.readahead_end = to;
+    }
+}
+
+bool BasicFilesystem::truncate(void *handle_, uint64_t size)
+{
+    auto handle = reinterpret_cast<StreamHandle*>(handle_);
+    auto &table = *handle->table;
+    if(table.handles > 1)
+    {
+        // Other handles could be on the pages about to be freed
+        return false;
+    }
+
+    auto &stream = streams[handle->stream.id];
+    if(size >= handle->stream.size)
+    {
+        return true;
+    }
+
+    // Keep the pages covering the new size, and at least the first page
+    const uint64_t keep = std::max<uint64_t>((size + page_size() - 1) / page_size(), 1);
+    for(uint64_t a = keep; a < table.pages.size(); a++)
+    {
+        set_free(table.pages[a], true);
+    }
+    table.pages.resize(keep);
+    truncate_page_map(stream, table, keep);
+
+    // Give back what's left of the current extent too, so the next page starts a new one
+    for(uint64_t page = stream.extent_next; page < stream.extent_end; page++)
+    {
+        set_free(page, true);
+    }
+    stream.extent_next = stream.extent_end = 0;
+
+    auto last = read_page_header(table.pages.back());
+    last.next_page = 0;
+    last.page_length = sizeof(PAGE_HEADER) + size - (keep - 1) * page_size();
+    write_page_header(last);
+
+    stream.size = handle->stream.size = size;
+    write_stream_header(stream.id, stream);
+    seek(handle, std::min(handle->stream_pos, size));
+    return true;
+}
+
+bool BasicFilesystem::remove(const std::string &name)
+{
+    auto iter = std::find_if(streams.begin(), streams.end(),  [&name](auto &a) {
+        return name.compare(0, name.size(), a.name) == 0;
+    });
+    if(iter == streams.end())
+    {
+        return false;
+    }
+
+    auto &stream = *iter;
+    auto &table = *page_table(stream);
+    if(table.handles)
+    {
+        return false;
+    }
+
+    for(uint64_t page : table.pages)
+    {
+        set_free(page, true);
+    }
+    truncate_page_map(stream, table, 0);
+    set_free(stream.map_page, true);
+    for(uint64_t page = stream.extent_next; page < stream.extent_end; page++)
+    {
+        set_free(page, true);
+    }
+
+    // Leave the slot empty for the next stream created
+    const uint64_t id = stream.id;
+    stream = STREAM_HEADER();
+    stream.id = id;
+    write_stream_header(id, stream);
+    page_tables[id].reset();
+    return true;
+}
+
+void BasicFilesystem::truncate_page_map(const STREAM_HEADER &stream, PAGE_TABLE &table, uint64_t keep)
+{
+    // The first map page is always kept, so the stream header can keep pointing at it
+    const uint64_t keep_map_pages = std::max<uint64_t>((keep + MAP_ENTRIES_PER_PAGE - 1) / MAP_ENTRIES_PER_PAGE, 1);
+    uint64_t index = 0;
+    for(uint64_t map_page = stream.map_page; map_page; index++)
+    {
+        auto header = read_page_header(map_page);
+        const uint64_t next = header.next_page;
+        if(index + 1 == keep_map_pages)
+        {
+            header.page_length = sizeof(PAGE_HEADER) + (keep - index * MAP_ENTRIES_PER_PAGE) * sizeof(uint64_t);
+            header.next_page = 0;
+            write_page_header(header);
+            table.last_map_page = map_page;
+        }
+        else if(index >= keep_map_pages)
+        {
+            set_free(map_page, true);
+        }
+        map_page = next;
+    }
+}
+
+void BasicFilesystem::load_free_map()
+{
+    for(uint64_t bitmap_page = fs_header.bitmap_page; bitmap_page;)
+    {
+        auto page = pool.fetch(bitmap_page);
+        PAGE_HEADER header;
+        memcpy(&header, page.data(), sizeof(header));
+
+        const size_t loaded = free_map.size();
+        free_map.resize(loaded + BITMAP_WORDS_PER_PAGE);
+        memcpy(free_map.data() + loaded, page.data() + sizeof(PAGE_HEADER), BITMAP_WORDS_PER_PAGE * sizeof(uint64_t));
+        bitmap_pages.emplace_back(bitmap_page);
+        page_count = std::max(page_count, bitmap_page + 1);
+        bitmap_page = header.next_page;
+    }
+
+    // Pages freed before they were ever written lie past the end of the file, so the file size
+    // alone would hand them out again from the end while they're still in the bitmap
+    for(size_t word = 0; word < free_map.size(); word++)
+    {
+        if(free_map[word])
+        {
+            free_count += std::popcount(free_map[word]);
+            page_count = std::max<uint64_t>(page_count, word * 64 + 64 - std::countl_zero(free_map[word]));
+        }
+    }
+}
+
+std::pair<uint64_t, uint64_t> BasicFilesystem::find_free_run(uint64_t max_length)
+{
+    if(!free_count)
+    {
+        return {0, 0};
+    }
+
+    for(size_t word = 0; word < free_map.size(); word++)
+    {
+        if(!free_map[word])
+        {
+            continue;
+        }
+
+        const uint64_t start = word * 64 + std::countr_zero(free_map[word]);
+        uint64_t length = 1;
+        while(length < max_length)
+        {
+            const uint64_t page = start + length;
+            if(page / 64 >= free_map.size() || !(free_map[page / 64] & (uint64_t(1) << (page % 64))))
+            {
+                break;
+            }
+            length++;
+        }
+        return {start, length};
+    }
+    return {0, 0};
+}
+
+void BasicFilesystem::set_free(uint64_t page, bool free)
+{
+    const uint64_t word = page / 64;
+    const uint64_t bit = uint64_t(1) << (page % 64);
+    if(word >= free_map.size())
+    {
+        if(!free)
+        {
+            return;
+        }
+        free_map.resize(word + 1);
+    }
+    if(static_cast<bool>(free_map[word] & bit) == free)
+    {
+        return;
+    }
+    free_map[word] ^= bit;
+    free_count += free ? 1 : -1;
+
+    // Make sure there's a bitmap page to record it in. These are always put at the end of the
+    // file rather than in a free page, so that allocating them doesn't change the bitmap.
+    const uint64_t index = word / BITMAP_WORDS_PER_PAGE;
+    while(bitmap_pages.size() <= index)
+    {
+        const uint64_t previous = bitmap_pages.empty() ? 0 : bitmap_pages.back();
+        const uint64_t bitmap_page = page_count++;
+        init_page(bitmap_page, previous);
+        if(previous)
+        {
+            auto header = read_page_header(previous);
+            header.next_page = bitmap_page;
+            write_page_header(header);
+        }
+        else
+        {
+            fs_header.bitmap_page = bitmap_page;
+            write_file_header();
+        }
+        bitmap_pages.emplace_back(bitmap_page);
+    }
+
+    auto bitmap = pool.fetch(bitmap_pages[index]);
+    memcpy(bitmap.data() + sizeof(PAGE_HEADER) + (word % BITMAP_WORDS_PER_PAGE) * sizeof(uint64_t), &free_map[word], sizeof(uint64_t));
+    bitmap.mark_dirty();
 }
 
 uint64_t BasicFilesystem::tell(void *handle)
 {
     return reinterpret_cast<StreamHandle*>(handle)->stream_pos;
 }
+
+uint64_t BasicFilesystem::page_size()
+{
+    return PAGE_SIZE - sizeof(PAGE_HEADER);
+}
@@ -0,0 +1,212 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "filesystem/MmapBacking.h"
+
+MmapBacking::~MmapBacking()
+{
+    close();
+}
+
+bool MmapBacking::open(const std::string &path, bool create)
+{
+    assert(!is_open());
+    fd = ::open(path.c_str(), O_RDWR | (create ? O_CREAT | O_TRUNC : 0), 0644);
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    struct stat info{};
+    if(fstat(fd, &info) != 0)
+    {
+        close();
+        return false;
+    }
+
+    length = file_size = info.st_size;
+    cursor = 0;
+    failed = false;
+    if(length && !reserve(length))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool MmapBacking::write(const char *buf, uint64_t buflen)
+{
+    assert(is_open());
+    if(!reserve(cursor + buflen))
+    {
+        failed = true;
+        return false;
+    }
+
+    memcpy(map + cursor, buf, buflen);
+    cursor += buflen;
+    length = std::max(length, cursor);
+    return true;
+}
+
+bool MmapBacking::read(char *buf, uint64_t buflen)
+{
+    assert(is_open());
+    if(cursor + buflen > length)
+    {
+        failed = true;
+        return false;
+    }
+
+    memcpy(buf, map + cursor, buflen);
+    cursor += buflen;
+    return true;
+}
+
+bool MmapBacking::read_at(uint64_t offset, char *buf, uint64_t buflen)
+{
+    assert(is_open());
+    if(offset + buflen > length)
+    {
+        return false;
+    }
+
+    memcpy(buf, map + offset, buflen);
+    return true;
+}
+
+bool MmapBacking::write_at(uint64_t offset, const char *buf, uint64_t buflen)
+{
+    assert(is_open());
+    if(!reserve(offset + buflen))
+    {
+        failed = true;
+        return false;
+    }
+
+    memcpy(map + offset, buf, buflen);
+    length = std::max(length, offset + buflen);
+    return true;
+}
+
+uint64_t MmapBacking::size()
+{
+    return length;
+}
+
+void MmapBacking::prefetch(uint64_t offset, uint64_t len)
+{
+    if(offset >= length)
+    {
+        return;
+    }
+
+    // madvise needs an address on an OS page boundary
+    const uint64_t os_page = sysconf(_SC_PAGESIZE);
+    const uint64_t start = offset - offset % os_page;
+    const uint64_t end = std::min(offset + len, length);
+    (void)madvise(map + start, end - start, MADV_WILLNEED);
+}
+
+bool MmapBacking::sync()
+{
+    // Writes to the mapping only reach the file once they're flushed, then the file's size needs flushing too
+    if(map && msync(map, length, MS_SYNC) != 0)
+    {
+        return false;
+    }
+    return fdatasync(fd) == 0;
+}
+
+uint64_t MmapBacking::tellg()
+{
+    return cursor;
+}
+
+void MmapBacking::seekg(int64_t pos, std::ios_base::seekdir base)
+{
+    switch(base)
+    {
+        case std::ios::beg:
+            cursor = pos;
+            break;
+        case std::ios::end:
+            cursor = length + pos;
+            break;
+        case std::ios::cur:
+            cursor += pos;
+            break;
+        default:
+            abort();
+    }
+    assert(cursor <= length);
+}
+
+bool MmapBacking::good() const
+{
+    return is_open() && !failed;
+}
+
+bool MmapBacking::is_open() const
+{
+    return fd >= 0;
+}
+
+void MmapBacking::close()
+{
+    if(map)
+    {
+        munmap(map, capacity);
+        map = nullptr;
+        capacity = 0;
+    }
+    file_size = 0;
+
+    if(fd >= 0)
+    {
+        // Drop the rest of the last OS page
+        (void)ftruncate(fd, static_cast<off_t>(length));
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool MmapBacking::reserve(uint64_t needed)
+{
+    const uint64_t page = sysconf(_SC_PAGESIZE);
+    if(needed > capacity)
+    {
+        // Grow the mapping geometrically, so the number of remaps stays logarithmic in the file size
+        uint64_t new_capacity = std::max<uint64_t>({needed, capacity * 2, MinGrowth});
+        new_capacity = (new_capacity + page - 1) / page * page;
+        void *new_map = map ? mremap(map, capacity, new_capacity, MREMAP_MAYMOVE) : mmap(nullptr, new_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(new_map == MAP_FAILED)
+        {
+            return false;
+        }
+
+        map = static_cast<char *>(new_map);
+        capacity = new_capacity;
+    }
+
+    // Touching the mapping past the end of the file faults, so the file has to cover every page written to
+    if(needed > file_size)
+    {
+        const uint64_t new_size = (needed + page - 1) / page * page;
+        if(ftruncate(fd, static_cast<off_t>(new_size)) != 0)
+        {
+            return false;
+        }
+        file_size = new_size;
+    }
+    return true;
+}
@@ -0,0 +1,319 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include "filesystem/PagePool.h"
+#include "filesystem/FilesystemBacking.h"
+#include "filesystem/WriteAheadLog.h"
+
+PagePool::PageRef::PageRef(PagePool *pool, size_t frame)
+: pool(pool), frame(frame)
+{
+    pool->frames[frame].pins++;
+}
+
+PagePool::PageRef::PageRef(PageRef &&o) noexcept
+: pool(o.pool), frame(o.frame)
+{
+    o.pool = nullptr;
+}
+
+PagePool::PageRef &PagePool::PageRef::operator=(PageRef &&o) noexcept
+{
+    release();
+    pool = o.pool;
+    frame = o.frame;
+    o.pool = nullptr;
+    return *this;
+}
+
+PagePool::PageRef::~PageRef()
+{
+    release();
+}
+
+char *PagePool::PageRef::data() const
+{
+    assert(valid());
+    return pool->frames[frame].data.get();
+}
+
+void PagePool::PageRef::mark_dirty()
+{
+    assert(valid());
+    pool->frames[frame].dirty = true;
+    pool->frames[frame].unlogged = pool->log != nullptr;
+}
+
+void PagePool::PageRef::release()
+{
+    if(pool)
+    {
+        assert(pool->frames[frame].pins);
+        pool->frames[frame].pins--;
+        pool = nullptr;
+    }
+}
+
+PagePool::PagePool(FilesystemBacking &backing, uint64_t page_size, size_t budget)
+: backing(backing), page_size(page_size), frame_budget(std::max<size_t>(budget / page_size, MinFrames))
+{
+
+}
+
+void PagePool::attach_log(WriteAheadLog *log_)
+{
+    log = log_;
+}
+
+std::optional<uint64_t> PagePool::log_changes()
+{
+    assert(log);
+    std::vector<size_t> changed;
+    std::vector<WriteAheadLog::PageImage> images;
+    for(size_t a = 0; a < frames.size(); a++)
+    {
+        if(frames[a].unlogged)
+        {
+            changed.emplace_back(a);
+            images.push_back({frames[a].page, frames[a].data.get()});
+        }
+    }
+    if(changed.empty())
+    {
+        return last_lsn;
+    }
+
+    auto lsn = log->append(images.data(), images.size());
+    if(!lsn)
+    {
+        return {};
+    }
+
+    for(size_t frame : changed)
+    {
+        frames[frame].unlogged = false;
+        frames[frame].lsn = *lsn;
+    }
+    last_lsn = *lsn;
+    return lsn;
+}
+
+PagePool::PageRef PagePool::fetch(uint64_t page)
+{
+    auto iter = page_to_frame.find(page);
+    if(iter != page_to_frame.end())
+    {
+        counters.hits++;
+        frames[iter->second].referenced = true;
+        return {this, iter->second};
+    }
+
+    counters.misses++;
+    const size_t frame = take_frame(page);
+    if(!backing.read_at(page * page_size, frames[frame].data.get(), page_size))
+    {
+        // Past the end of the backing, so there's nothing there yet
+        memset(frames[frame].data.get(), 0, page_size);
+    }
+    return {this, frame};
+}
+
+PagePool::PageRef PagePool::create(uint64_t page)
+{
+    auto iter = page_to_frame.find(page);
+    const size_t frame = iter != page_to_frame.end() ? iter->second : take_frame(page);
+    memset(frames[frame].data.get(), 0, page_size);
+    frames[frame].dirty = true;
+    frames[frame].unlogged = log != nullptr;
+    return {this, frame};
+}
+
+void PagePool::prefetch(const uint64_t *pages, size_t count)
+{
+    if(backing.queues_io())
+    {
+        // The backing can have the whole window in flight at once, so read it straight into frames. Keep
+        // them pinned until it's done, and take no more than half the pool so they don't push each other out.
+        std::vector<PageRef> refs;
+        std::vector<IoRequest> requests;
+        for(size_t a = 0; a < count && refs.size() < frame_budget / 2; a++)
+        {
+            if(page_to_frame.count(pages[a]))
+            {
+                continue;
+            }
+
+            const size_t frame = take_frame(pages[a]);
+            refs.emplace_back(PageRef(this, frame));
+            requests.push_back({pages[a] * page_size, frames[frame].data.get(), page_size});
+        }
+
+        if(!backing.read_batch(requests.data(), requests.size()))
+        {
+            // Not knowing which failed, forget them all. They'll be read again if they're fetched.
+            for(auto &ref : refs)
+            {
+                page_to_frame.erase(frames[ref.frame].page);
+                frames[ref.frame].referenced = false;
+            }
+        }
+        counters.prefetched += requests.size();
+        return;
+    }
+
+    size_t a = 0;
+    while(a < count)
+    {
+        if(page_to_frame.count(pages[a]))
+        {
+            a++;
+            continue;
+        }
+
+        size_t end = a + 1;
+        while(end < count && pages[end] == pages[end - 1] + 1 && !page_to_frame.count(pages[end]))
+        {
+            end++;
+        }
+        backing.prefetch(pages[a] * page_size, (end - a) * page_size);
+        counters.prefetched += end - a;
+        a = end;
+    }
+}
+
+bool PagePool::flush()
+{
+    // Write back in page order, so the backing sees one sequential pass
+    std::vector<size_t> dirty;
+    for(size_t a = 0; a < frames.size(); a++)
+    {
+        if(frames[a].dirty)
+        {
+            dirty.emplace_back(a);
+        }
+    }
+    std::sort(dirty.begin(), dirty.end(), [this](size_t a, size_t b) { return frames[a].page < frames[b].page; });
+
+    // Hand them over as one batch, so backings which can queue I/O have them all in flight at once
+    std::vector<IoRequest> requests;
+    uint64_t lsn = 0;
+    for(size_t frame : dirty)
+    {
+        requests.push_back({frames[frame].page * page_size, frames[frame].data.get(), page_size});
+        lsn = std::max(lsn, frames[frame].lsn);
+    }
+
+    // Everything being written back has to be in the log first
+    if(log && lsn && !log->wait_durable(lsn))
+    {
+        return false;
+    }
+
+    // Not knowing which writes failed, keep them all dirty so the next flush tries again
+    if(!backing.write_batch(requests.data(), requests.size()))
+    {
+        return false;
+    }
+    for(size_t frame : dirty)
+    {
+        frames[frame].dirty = false;
+    }
+    counters.writebacks += requests.size();
+    return true;
+}
+
+PagePool::Stats PagePool::stats() const
+{
+    return counters;
+}
+
+size_t PagePool::capacity() const
+{
+    return frame_budget;
+}
+
+size_t PagePool::size() const
+{
+    return frames.size();
+}
+
+size_t PagePool::take_frame(uint64_t page)
+{
+    size_t frame = frames.size();
+    if(frames.size() >= frame_budget)
+    {
+        // Two sweeps are enough to find a victim, as the first clears every referenced bit it passes
+        for(size_t scanned = 0; scanned < 2 * frames.size(); scanned++)
+        {
+            const size_t candidate = hand;
+            hand = (hand + 1) % frames.size();
+            auto &victim = frames[candidate];
+            if(victim.pins || victim.unlogged)
+            {
+                continue;
+            }
+            if(victim.referenced)
+            {
+                victim.referenced = false;
+                continue;
+            }
+
+            // A dirty page can only be dropped once it's safely written back, so leave it be if that fails
+            if(!write_back(victim))
+            {
+                continue;
+            }
+
+            // The frame may have been dropped after a failed prefetch, and its page read into another since
+            auto mapped = page_to_frame.find(victim.page);
+            if(mapped != page_to_frame.end() && mapped->second == candidate)
+            {
+                page_to_frame.erase(mapped);
+            }
+            counters.evictions++;
+            frame = candidate;
+            break;
+        }
+    }
+
+    if(frame == frames.size())
+    {
+        // Either there's room in the budget, or every frame's pinned, waiting to be logged or failing to write back
+        frames.emplace_back();
+        frames.back().data = std::make_unique<char[]>(page_size);
+    }
+
+    auto &entry = frames[frame];
+    entry.page = page;
+    entry.referenced = true;
+    entry.dirty = false;
+    entry.unlogged = false;
+    entry.lsn = 0;
+    page_to_frame[page] = frame;
+    return frame;
+}
+
+bool PagePool::write_back(Frame &frame)
+{
+    if(!frame.dirty)
+    {
+        return true;
+    }
+
+    if(log && frame.lsn && !log->wait_durable(frame.lsn))
+    {
+        return false;
+    }
+
+    if(!backing.write_at(frame.page * page_size, frame.data.get(), page_size))
+    {
+        return false;
+    }
+    counters.writebacks++;
+    frame.dirty = false;
+    return true;
+}
@@ -0,0 +1,181 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#include <cassert>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "filesystem/PosixBacking.h"
+
+PosixBacking::~PosixBacking()
+{
+    close();
+}
+
+bool PosixBacking::open(const std::string &path, bool create)
+{
+    assert(!is_open());
+    fd = ::open(path.c_str(), O_RDWR | (create ? O_CREAT | O_TRUNC : 0), 0644);
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    struct stat info{};
+    if(fstat(fd, &info) != 0)
+    {
+        close();
+        return false;
+    }
+
+    length = info.st_size;
+    cursor = 0;
+    failed = false;
+    return true;
+}
+
+bool PosixBacking::write(const char *buf, uint64_t buflen)
+{
+    if(!write_at(cursor, buf, buflen))
+    {
+        failed = true;
+        return false;
+    }
+
+    cursor += buflen;
+    return true;
+}
+
+bool PosixBacking::read(char *buf, uint64_t buflen)
+{
+    if(!read_at(cursor, buf, buflen))
+    {
+        failed = true;
+        return false;
+    }
+
+    cursor += buflen;
+    return true;
+}
+
+bool PosixBacking::read_at(uint64_t offset, char *buf, uint64_t buflen)
+{
+    assert(is_open());
+    while(buflen)
+    {
+        // pread can come back short, or be interrupted, so keep going until it's all in
+        const ssize_t count = ::pread(fd, buf, buflen, static_cast<off_t>(offset));
+        if(count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(count <= 0)
+        {
+            return false;
+        }
+
+        buf += count;
+        offset += count;
+        buflen -= count;
+    }
+    return true;
+}
+
+bool PosixBacking::write_at(uint64_t offset, const char *buf, uint64_t buflen)
+{
+    assert(is_open());
+    const uint64_t end = offset + buflen;
+    while(buflen)
+    {
+        const ssize_t count = ::pwrite(fd, buf, buflen, static_cast<off_t>(offset));
+        if(count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(count <= 0)
+        {
+            return false;
+        }
+
+        buf += count;
+        offset += count;
+        buflen -= count;
+    }
+
+    extend(end);
+    return true;
+}
+
+void PosixBacking::extend(uint64_t end)
+{
+    uint64_t current = length.load();
+    while(current < end && !length.compare_exchange_weak(current, end));
+}
+
+uint64_t PosixBacking::size()
+{
+    return length;
+}
+
+uint64_t PosixBacking::tellg()
+{
+    return cursor;
+}
+
+void PosixBacking::seekg(int64_t pos, std::ios_base::seekdir base)
+{
+    switch(base)
+    {
+        case std::ios::beg:
+            cursor = pos;
+            break;
+        case std::ios::end:
+            cursor = length + pos;
+            break;
+        case std::ios::cur:
+            cursor += pos;
+            break;
+        default:
+            abort();
+    }
+}
+
+bool PosixBacking::good() const
+{
+    return is_open() && !failed;
+}
+
+bool PosixBacking::is_open() const
+{
+    return fd >= 0;
+}
+
+void PosixBacking::prefetch(uint64_t offset, uint64_t len)
+{
+    // The kernel starts reading the range into the page cache, and returns straight away
+    (void)posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(len), POSIX_FADV_WILLNEED);
+}
+
+bool PosixBacking::sync()
+{
+    // The file's size is flushed along with its data, which is all that's needed to read it back
+    while(fdatasync(fd) != 0)
+    {
+        if(errno != EINTR)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void PosixBacking::close()
+{
+    if(fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
@@ -0,0 +1,250 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "filesystem/UringBacking.h"
+
+// The submission and completion queues, shared with the kernel
+struct UringBacking::Ring
+{
+    ~Ring()
+    {
+        if(sqes)
+        {
+            munmap(sqes, entries * sizeof(io_uring_sqe));
+        }
+        if(cq_ring && cq_ring != sq_ring)
+        {
+            munmap(cq_ring, cq_ring_size);
+        }
+        if(sq_ring)
+        {
+            munmap(sq_ring, sq_ring_size);
+        }
+        if(fd >= 0)
+        {
+            ::close(fd);
+        }
+    }
+
+    /*!
+     * Creates the ring and maps its queues
+     *
+     * @param depth Number of submission queue entries
+     * @return True on success, false if io_uring isn't available
+     */
+    bool setup(unsigned depth)
+    {
+        io_uring_params params{};
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+        if(fd < 0)
+        {
+            return false;
+        }
+        entries = params.sq_entries;
+
+        // Newer kernels share one mapping between both rings
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if(single_mmap)
+        {
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+
+        sq_ring = map(sq_ring_size, IORING_OFF_SQ_RING);
+        cq_ring = single_mmap ? sq_ring : map(cq_ring_size, IORING_OFF_CQ_RING);
+        sqes = static_cast<io_uring_sqe*>(map(entries * sizeof(io_uring_sqe), IORING_OFF_SQES));
+        if(!sq_ring || !cq_ring || !sqes)
+        {
+            return false;
+        }
+
+        auto sq = static_cast<char*>(sq_ring);
+        sq_tail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+
+        auto cq = static_cast<char*>(cq_ring);
+        cq_head = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    void *map(size_t len, off_t offset) const
+    {
+        void *ptr = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+
+    // Submits 'to_submit' queued entries, and waits for at least 'wait_for' completions. Returns how many were submitted.
+    unsigned enter(unsigned to_submit, unsigned wait_for) const
+    {
+        while(true)
+        {
+            const long ret = syscall(__NR_io_uring_enter, fd, to_submit, wait_for, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if(ret >= 0)
+            {
+                return static_cast<unsigned>(ret);
+            }
+            if(errno != EINTR)
+            {
+                return 0;
+            }
+        }
+    }
+
+    int fd = -1;
+    unsigned entries = 0;
+    void *sq_ring = nullptr;
+    void *cq_ring = nullptr;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    io_uring_sqe *sqes = nullptr;
+
+    uint32_t *sq_tail = nullptr;
+    uint32_t sq_mask = 0;
+    uint32_t *sq_array = nullptr;
+    uint32_t *cq_head = nullptr;
+    uint32_t *cq_tail = nullptr;
+    uint32_t cq_mask = 0;
+    io_uring_cqe *cqes = nullptr;
+};
+
+UringBacking::UringBacking()=default;
+
+UringBacking::~UringBacking()
+{
+    close();
+}
+
+bool UringBacking::open(const std::string &path, bool create)
+{
+    if(!PosixBacking::open(path, create))
+    {
+        return false;
+    }
+
+    ring = std::make_unique<Ring>();
+    if(!ring->setup(QueueDepth))
+    {
+        ring.reset();
+    }
+    return true;
+}
+
+void UringBacking::close()
+{
+    ring.reset();
+    PosixBacking::close();
+}
+
+bool UringBacking::read_batch(const IoRequest *requests, size_t count)
+{
+    return ring ? submit(IORING_OP_READ, requests, count) : PosixBacking::read_batch(requests, count);
+}
+
+bool UringBacking::write_batch(const IoRequest *requests, size_t count)
+{
+    if(!ring)
+    {
+        return PosixBacking::write_batch(requests, count);
+    }
+
+    const bool ok = submit(IORING_OP_WRITE, requests, count);
+    for(size_t a = 0; a < count; a++)
+    {
+        extend(requests[a].offset + requests[a].len);
+    }
+    return ok;
+}
+
+bool UringBacking::queues_io() const
+{
+    return ring != nullptr;
+}
+
+bool UringBacking::submit(uint8_t opcode, const IoRequest *requests, size_t count)
+{
+    std::lock_guard lock(ring_mutex);
+    bool ok = true;
+    for(size_t done = 0; done < count;)
+    {
+        const auto batch = static_cast<unsigned>(std::min<size_t>(count - done, ring->entries));
+
+        // Only this thread adds entries, so the tail can be read plainly. The kernel needs to see the entries before the new tail.
+        uint32_t tail = *ring->sq_tail;
+        for(unsigned a = 0; a < batch; a++)
+        {
+            const auto &request = requests[done + a];
+            assert(request.len <= UINT32_MAX);
+            const uint32_t index = tail++ & ring->sq_mask;
+            auto &sqe = ring->sqes[index];
+            memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = opcode;
+            sqe.fd = fd;
+            sqe.addr = reinterpret_cast<uint64_t>(request.buf);
+            sqe.len = static_cast<uint32_t>(request.len);
+            sqe.off = request.offset;
+            sqe.user_data = done + a;
+            ring->sq_array[index] = index;
+        }
+        std::atomic_ref<uint32_t>(*ring->sq_tail).store(tail, std::memory_order_release);
+
+        // The kernel takes entries in order, so if it stops short it's the first ones which are in flight
+        const unsigned submitted = ring->enter(batch, batch);
+        for(unsigned completed = 0; completed < submitted;)
+        {
+            uint32_t head = *ring->cq_head;
+            const uint32_t cq_tail = std::atomic_ref<uint32_t>(*ring->cq_tail).load(std::memory_order_acquire);
+            if(head == cq_tail)
+            {
+                // Interrupted before everything finished
+                (void)ring->enter(0, submitted - completed);
+                continue;
+            }
+
+            for(; head != cq_tail; head++, completed++)
+            {
+                const auto &cqe = ring->cqes[head & ring->cq_mask];
+                const auto &request = requests[cqe.user_data];
+                const uint64_t transferred = cqe.res > 0 ? cqe.res : 0;
+                if(transferred == request.len)
+                {
+                    continue;
+                }
+
+                // Finish off short or failed requests synchronously
+                const uint64_t offset = request.offset + transferred;
+                char *buf = request.buf + transferred;
+                const uint64_t len = request.len - transferred;
+                ok &= opcode == IORING_OP_READ ? PosixBacking::read_at(offset, buf, len) : PosixBacking::write_at(offset, buf, len);
+            }
+            std::atomic_ref<uint32_t>(*ring->cq_head).store(head, std::memory_order_release);
+        }
+
+        if(submitted < batch)
+        {
+            // Nothing's in flight any more, so the buffers are safe to reuse. The ring's in an unknown
+            // state though, so stop using it and do the requests it didn't take the slow way.
+            ring.reset();
+            done += submitted;
+            const bool rest = opcode == IORING_OP_READ ? PosixBacking::read_batch(requests + done, count - done)
+                                                       : PosixBacking::write_batch(requests + done, count - done);
+            return ok && rest;
+        }
+        done += batch;
+    }
+    return ok;
+}
@@ -0,0 +1,223 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include "filesystem/WriteAheadLog.h"
+
+static constexpr uint64_t LOG_MAGIC = 0x4c41575153524646; // "FFRSQWAL"
+
+struct LOG_HEADER
+{
+    uint64_t magic = LOG_MAGIC;
+    uint64_t epoch = 0;
+    uint64_t page_size = 0;
+};
+
+// Each record is followed by a page image for RECORD_PAGE, or nothing for RECORD_COMMIT
+struct LOG_RECORD
+{
+    uint64_t epoch = 0;
+    uint64_t type = 0;
+    uint64_t page = 0;
+    uint64_t checksum = 0; // Of the record with this field zeroed, then the page image
+};
+
+static constexpr uint64_t RECORD_PAGE = 1;
+static constexpr uint64_t RECORD_COMMIT = 2;
+
+// FNV-1a, which is enough to catch a record that was only partly written before a crash
+static uint64_t checksum(uint64_t hash, const char *data, uint64_t len)
+{
+    for(uint64_t a = 0; a < len; a++)
+    {
+        hash ^= static_cast<unsigned char>(data[a]);
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+static uint64_t record_checksum(LOG_RECORD record, const char *body, uint64_t body_len)
+{
+    record.checksum = 0;
+    const uint64_t hash = checksum(0xcbf29ce484222325, reinterpret_cast<const char *>(&record), sizeof(record));
+    return checksum(hash, body, body_len);
+}
+
+WriteAheadLog::WriteAheadLog(std::unique_ptr<FilesystemBacking> backing, uint64_t page_size)
+: backing(std::move(backing)), page_size(page_size)
+{
+
+}
+
+bool WriteAheadLog::recover(FilesystemBacking &target)
+{
+    LOG_HEADER header;
+    if(!backing->read_at(0, reinterpret_cast<char *>(&header), sizeof(header)) || header.magic != LOG_MAGIC)
+    {
+        // A new log, so there's nothing to replay
+        return reset();
+    }
+    if(header.page_size != page_size)
+    {
+        return false;
+    }
+    epoch = header.epoch;
+
+    // Page images only count once the commit record after them has been read, so collect them until then
+    std::vector<std::pair<uint64_t, std::string>> pending;
+    std::string image(page_size, '\0');
+    bool replayed = false;
+    uint64_t offset = sizeof(LOG_HEADER);
+    while(true)
+    {
+        LOG_RECORD record;
+        if(!backing->read_at(offset, reinterpret_cast<char *>(&record), sizeof(record)) || record.epoch != epoch)
+        {
+            break;
+        }
+
+        const uint64_t body_len = record.type == RECORD_PAGE ? page_size : 0;
+        if(body_len && !backing->read_at(offset + sizeof(record), image.data(), body_len))
+        {
+            break;
+        }
+        if(record_checksum(record, image.data(), body_len) != record.checksum)
+        {
+            break;
+        }
+        offset += sizeof(record) + body_len;
+
+        if(record.type == RECORD_PAGE)
+        {
+            pending.emplace_back(record.page, image);
+        }
+        else if(record.type == RECORD_COMMIT)
+        {
+            for(const auto &[page, data] : pending)
+            {
+                if(!target.write_at(page * page_size, data.data(), page_size))
+                {
+                    return false;
+                }
+            }
+            pending.clear();
+            replayed = true;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    // The replayed pages have to be durable in the target before the log they came from is dropped
+    if(replayed && !target.sync())
+    {
+        return false;
+    }
+    return reset();
+}
+
+std::optional<uint64_t> WriteAheadLog::append(const PageImage *pages, size_t count)
+{
+    std::lock_guard lock(mutex);
+    std::string buf;
+    buf.reserve(count * (sizeof(LOG_RECORD) + page_size) + sizeof(LOG_RECORD));
+    for(size_t a = 0; a < count; a++)
+    {
+        encode(buf, RECORD_PAGE, pages[a].page, pages[a].data);
+    }
+    encode(buf, RECORD_COMMIT, 0, nullptr);
+
+    // The whole commit goes out in one write, with the commit record last
+    if(!backing->write_at(tail, buf.data(), buf.size()))
+    {
+        return {};
+    }
+    tail += buf.size();
+    appended += buf.size();
+    counters.commits++;
+    counters.pages += count;
+    return appended;
+}
+
+bool WriteAheadLog::wait_durable(uint64_t lsn)
+{
+    std::unique_lock lock(mutex);
+    while(durable < lsn)
+    {
+        if(syncing)
+        {
+            // Someone else is syncing. It might not cover this commit, in which case go round again.
+            synced.wait(lock);
+            continue;
+        }
+
+        // Sync everything appended so far, on behalf of anyone else waiting as well
+        syncing = true;
+        const uint64_t target = appended;
+        lock.unlock();
+        const bool ok = backing->sync();
+        lock.lock();
+        syncing = false;
+        counters.syncs++;
+        if(ok)
+        {
+            durable = std::max(durable, target);
+        }
+        synced.notify_all();
+        if(!ok)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool WriteAheadLog::reset()
+{
+    std::lock_guard lock(mutex);
+    LOG_HEADER header;
+    header.epoch = epoch + 1;
+    header.page_size = page_size;
+    if(!backing->write_at(0, reinterpret_cast<const char *>(&header), sizeof(header)) || !backing->sync())
+    {
+        return false;
+    }
+
+    epoch = header.epoch;
+    tail = sizeof(header);
+    durable = appended;
+    return true;
+}
+
+uint64_t WriteAheadLog::size() const
+{
+    std::lock_guard lock(mutex);
+    return tail - sizeof(LOG_HEADER);
+}
+
+WriteAheadLog::Stats WriteAheadLog::stats() const
+{
+    std::lock_guard lock(mutex);
+    return counters;
+}
+
+void WriteAheadLog::encode(std::string &buf, uint64_t type, uint64_t page, const char *body) const
+{
+    LOG_RECORD record;
+    record.epoch = epoch;
+    record.type = type;
+    record.page = page;
+    const uint64_t body_len = body ? page_size : 0;
+    record.checksum = record_checksum(record, body, body_len);
+    buf.append(reinterpret_cast<const char *>(&record), sizeof(record));
+    if(body_len)
+    {
+        buf.append(body, body_len);
+    }
+}
@@ -3,39 +3,49 @@
 //
 
 #include <cassert>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
 #include "table/RowStorage.h"
 #include "Variable.h"
+#include "exceptions/DatabaseError.h"
 
-RowStorage::RowStorage(TableMetadata metadata, Filesystem::Handle index, Filesystem::Handle data)
-: metadata(std::move(metadata)), index(std::move(index)), data(std::move(data))
+RowStorage::RowStorage(TableMetadata metadata, Filesystem::Handle index, Filesystem::Handle data, Filesystem::Handle strings)
+: metadata(std::move(metadata)), index(std::move(index)), data(std::move(data)), strings(std::move(strings))
 {
     row_size = this->metadata.get_column_count() * sizeof(rid_t);
 }
 
 rid_t RowStorage::store(const std::vector<Variable> &row)
 {
-    for(const auto &val : row)
-    {
-        switch(val.type)
-        {
-            case Variable::Type::INT:
-                data.write(reinterpret_cast<const char *>(&val.store.int64), sizeof(val.store.int64));
-                break;
-            case Variable::Type::STRING:
-                abort(); // todo implement
-                break;
-        }
-    }
+    // New rows always go on the end
+    std::vector<uint64_t> words(row.size());
+    encode_row(row, words);
+    data.seek(std::numeric_limits<uint64_t>::max());
+    data.write(reinterpret_cast<const char *>(words.data()), row_size);
     assert(data.tell() % row_size == 0);
     return (data.tell() / row_size) - 1;
 }
 
 void RowStorage::erase(rid_t row_id)
 {
+    // The row's strings won't be read again, so their space can go to new ones
+    std::vector<uint64_t> words(metadata.get_column_count());
+    if(data.seek(row_id * row_size) == row_id * row_size && data.read(words.data(), row_size) == row_size)
+    {
+        for(size_t a = 0; a < words.size(); a++)
+        {
+            if(metadata.columns[a].type == Variable::Type::STRING && words[a])
+            {
+                free_string(words[a] - 1);
+            }
+        }
+    }
+
     index.write(reinterpret_cast<const char *>(&row_id), sizeof(row_id));
 }
 
-std::vector<Variable> RowStorage::load(rid_t row_id)
+std::vector<Variable> RowStorage::load(rid_t row_id, StringPool &pool)
 {
     if(data.seek(row_id * row_size) != row_id * row_size)
     {
@@ -54,8 +64,12 @@ std::vector<Variable> RowStorage::load(rid_t row_id)
                 bytes_read += data.read(reinterpret_cast<char *>(&row.back().store.int64), sizeof(row.back().store.int64));
                 break;
             case Variable::Type::STRING:
-                abort(); // todo implement
+            {
+                uint64_t offset = 0;
+                bytes_read += data.read(reinterpret_cast<char *>(&offset), sizeof(offset));
+                row.back() = pool.hold(load_string(offset - 1));
                 break;
+            }
         }
     }
 
@@ -69,5 +83,149 @@ std::vector<Variable> RowStorage::load(rid_t row_id)
 
 void RowStorage::update(rid_t row_id, const std::vector<Variable> &row)
 {
+    std::vector<uint64_t> words(row.size());
+    if(data.seek(row_id * row_size) != row_id * row_size || data.read(words.data(), row_size) != row_size)
+    {
+        throw std::runtime_error("Failed to seek to row");
+    }
+
+    encode_row(row, words);
+    data.seek(row_id * row_size);
+    data.write(reinterpret_cast<const char *>(words.data()), row_size);
+}
+
+void RowStorage::encode_row(const std::vector<Variable> &row, std::vector<uint64_t> &words)
+{
+    for(size_t a = 0; a < row.size(); a++)
+    {
+        const auto &val = row[a];
+        if(val.type != metadata.columns[a].type)
+        {
+            throw DatabaseError("Wrong type of value for column '" + metadata.columns[a].name + "'");
+        }
+
+        switch(val.type)
+        {
+            case Variable::Type::INT:
+                words[a] = static_cast<uint64_t>(val.store.int64);
+                break;
+            case Variable::Type::STRING:
+                // Strings that haven't changed keep their slot. Changed ones reuse it if they fit.
+                if(!words[a])
+                {
+                    words[a] = store_string(val) + 1;
+                }
+                else if(load_string(words[a] - 1) != std::string_view(val.store.str, val.store.len))
+                {
+                    words[a] = replace_string(words[a] - 1, val) + 1;
+                }
+                break;
+        }
+    }
+}
+
+size_t RowStorage::size_class(uint64_t len)
+{
+    size_t size = 0;
+    while(size + 1 < SIZE_CLASSES && (MIN_CAPACITY << size) < len)
+    {
+        size++;
+    }
+    if((MIN_CAPACITY << size) < len)
+    {
+        throw DatabaseError("String is too long to be stored");
+    }
+    return size;
+}
+
+uint64_t RowStorage::store_string(const Variable &value)
+{
+    const size_t size = size_class(value.store.len);
+    uint64_t heads[SIZE_CLASSES] = {};
+    uint64_t offset = strings.seek(std::numeric_limits<uint64_t>::max());
+    if(offset == 0)
+    {
+        // New heap, so start it off with empty free lists
+        strings.write(reinterpret_cast<const char *>(heads), sizeof(heads));
+        offset = sizeof(heads);
+    }
+    else if(strings.seek(size * sizeof(uint64_t)) == size * sizeof(uint64_t) && strings.read(&heads[size], sizeof(uint64_t)) == sizeof(uint64_t) && heads[size])
+    {
+        // Take the first free slot of the right size
+        offset = heads[size] - 1;
+        const uint64_t next = read_header(offset).len;
+        strings.seek(size * sizeof(uint64_t));
+        strings.write(reinterpret_cast<const char *>(&next), sizeof(next));
+        write_header(offset, {MIN_CAPACITY << size, value.store.len});
+        strings.write(value.store.str, value.store.len);
+        return offset;
+    }
+
+    // Otherwise add a new slot on the end, padded out to its full capacity
+    std::string slot(sizeof(StringHeader) + (MIN_CAPACITY << size), '\0');
+    const StringHeader header{MIN_CAPACITY << size, value.store.len};
+    memcpy(slot.data(), &header, sizeof(header));
+    memcpy(slot.data() + sizeof(header), value.store.str, value.store.len);
+    strings.seek(offset);
+    strings.write(slot.data(), slot.size());
+    return offset;
+}
+
+uint64_t RowStorage::replace_string(uint64_t offset, const Variable &value)
+{
+    auto header = read_header(offset);
+    if(value.store.len > header.capacity)
+    {
+        free_string(offset);
+        return store_string(value);
+    }
+
+    header.len = value.store.len;
+    write_header(offset, header);
+    strings.write(value.store.str, value.store.len);
+    return offset;
+}
+
+void RowStorage::free_string(uint64_t offset)
+{
+    auto header = read_header(offset);
+    const size_t size = size_class(header.capacity);
+    uint64_t head = 0;
+    if(strings.seek(size * sizeof(uint64_t)) != size * sizeof(uint64_t) || strings.read(&head, sizeof(head)) != sizeof(head))
+    {
+        throw std::runtime_error("Failed to read string free list");
+    }
+
+    header.len = head;
+    write_header(offset, header);
+    head = offset + 1;
+    strings.seek(size * sizeof(uint64_t));
+    strings.write(reinterpret_cast<const char *>(&head), sizeof(head));
+}
+
+std::string RowStorage::load_string(uint64_t offset)
+{
+    const auto header = read_header(offset);
+    std::string str(header.len, '\0');
+    if(header.len > header.capacity || strings.read(str.data(), header.len) != header.len)
+    {
+        throw std::runtime_error("Failed to read string");
+    }
+    return str;
+}
 
+RowStorage::StringHeader RowStorage::read_header(uint64_t offset)
+{
+    StringHeader header{};
+    if(strings.seek(offset) != offset || strings.read(&header, sizeof(header)) != sizeof(header))
+    {
+        throw std::runtime_error("Failed to read string");
+    }
+    return header;
+}
+
+void RowStorage::write_header(uint64_t offset, const StringHeader &header)
+{
+    strings.seek(offset);
+    strings.write(reinterpret_cast<const char *>(&header), sizeof(header));
 }
@@ -3,3 +3,564 @@
 //
 
 #include "table/Table.h"
+#include "exceptions/SemanticError.h"
+
+TreeTable::TreeTable(TableMetadata meta, Filesystem *filesystem)
+: Table(std::move(meta)), filesystem(filesystem)
+{
+    auto data_index = filesystem->open(metadata.name + ".index", true);
+    auto data_data = filesystem->open(metadata.name + ".data", true);
+    auto data_strings = filesystem->open(metadata.name + ".str", true);
+    auto index_tree = filesystem->open(metadata.name + ".tree", true);
+    row_store = std::make_unique<RowStorage>(metadata, std::move(data_index), std::move(data_data), std::move(data_strings));
+    index.open(std::move(index_tree));
+
+    // Carry on from the highest row id in use. Keys are offset by one, so that's the next free id.
+    if(auto last = index.last())
+    {
+        next_rid = *last;
+    }
+
+    for(size_t a = 0; a < metadata.indexes.size(); a++)
+    {
+        auto &tree = indexes.emplace_back();
+        if(uses_bytes(metadata.indexes[a]))
+        {
+            tree.bytes = std::make_unique<StringTree>();
+            tree.bytes->open(filesystem->open(index_stream_name(a), true));
+        }
+        else
+        {
+            tree.words = std::make_unique<Tree>();
+            tree.words->open(filesystem->open(index_stream_name(a), true));
+        }
+    }
+}
+
+rid_t TreeTable::insert(const std::vector<Variable> &row)
+{
+    check_index_keys(row);
+    auto storage_id = row_store->store(row);
+    const rid_t row_id = next_rid++;
+    index.insert(row_id + 1, storage_id);
+    for(size_t a = 0; a < indexes.size(); a++)
+    {
+        index_insert(a, row, row_id);
+    }
+    return row_id;
+}
+
+std::vector<rid_t> TreeTable::insert_rows(const std::vector<std::vector<Variable>> &rows)
+{
+    for(const auto &row : rows)
+    {
+        check_index_keys(row);
+    }
+
+    std::vector<rid_t> row_ids;
+    std::vector<uint64_t> storage_ids;
+    row_ids.reserve(rows.size());
+    storage_ids.reserve(rows.size());
+    for(const auto &row : rows)
+    {
+        storage_ids.emplace_back(row_store->store(row));
+        row_ids.emplace_back(next_rid++);
+    }
+
+    // New row ids are always the largest, so they can be appended to the row index in one go
+    size_t pos = 0;
+    index.insert_sorted([&](uint64_t &key, uint64_t &val) {
+        if(pos == rows.size())
+        {
+            return false;
+        }
+        key = row_ids[pos] + 1;
+        val = storage_ids[pos++];
+        return true;
+    });
+
+    for(size_t a = 0; a < indexes.size(); a++)
+    {
+        for(size_t r = 0; r < rows.size(); r++)
+        {
+            index_insert(a, rows[r], row_ids[r]);
+        }
+    }
+    return row_ids;
+}
+
+void TreeTable::erase(rid_t row_id)
+{
+    auto storage_id = find_storage_id(row_id);
+    if(!storage_id)
+    {
+        return;
+    }
+
+    StringPool pool;
+    auto row = row_store->load(*storage_id, pool);
+    for(size_t a = 0; a < indexes.size(); a++)
+    {
+        index_erase(a, row, row_id);
+    }
+    index.erase(row_id + 1);
+    row_store->erase(*storage_id);
+}
+
+Variable TreeTable::load(rid_t row_id, cid_t col_id, StringPool &pool)
+{
+    auto storage_id = find_storage_id(row_id);
+    if(!storage_id)
+    {
+        throw DatabaseError("Row not found");
+    }
+
+    return row_store->load(*storage_id, pool).at(col_id); //todo return whole thing
+}
+
+void TreeTable::update(rid_t row_id, cid_t col_id, Variable new_val)
+{
+    auto storage_id = find_storage_id(row_id);
+    if(!storage_id)
+    {
+        throw DatabaseError("Row not found");
+    }
+
+    StringPool pool;
+    auto row = row_store->load(*storage_id, pool);
+    auto new_row = row;
+    new_row.at(col_id) = new_val;
+    check_index_keys(new_row);
+    row_store->update(*storage_id, new_row);
+    for(size_t a = 0; a < indexes.size(); a++)
+    {
+        if(metadata.indexes[a].stores(col_id))
+        {
+            index_erase(a, row, row_id);
+            index_insert(a, new_row, row_id);
+        }
+    }
+}
+
+void TreeTable::clear()
+{
+    std::vector<rid_t> rows;
+    for(auto iter = index.begin(); iter.valid(); iter.next())
+    {
+        rows.emplace_back(iter.key() - 1);
+    }
+
+    for(auto row_id : rows)
+    {
+        erase(row_id);
+    }
+}
+
+void TreeTable::flush()
+{
+    // Rows are written straight through, but the trees hold on to modified nodes
+    index.flush();
+    for(auto &tree : indexes)
+    {
+        if(tree.bytes)
+        {
+            tree.bytes->flush();
+        }
+        else
+        {
+            tree.words->flush();
+        }
+    }
+}
+
+rid_t TreeTable::get_row_count() const
+{
+    return index.size();
+}
+
+std::optional<rid_t> TreeTable::next_row(rid_t row_id)
+{
+    auto iter = index.seek(row_id + 1);
+    if(!iter.valid())
+    {
+        return {};
+    }
+    return iter.key() - 1;
+}
+
+void TreeTable::create_index(std::string name, std::vector<cid_t> col_ids, std::vector<cid_t> included)
+{
+    for(auto col_id : col_ids)
+    {
+        if(col_id >= metadata.get_column_count())
+        {
+            throw SemanticError("No such column to index");
+        }
+    }
+    for(auto col_id : included)
+    {
+        if(col_id >= metadata.get_column_count())
+        {
+            throw SemanticError("No such column to include in index");
+        }
+        if(std::find(col_ids.begin(), col_ids.end(), col_id) != col_ids.end())
+        {
+            throw SemanticError("Column is already part of the index");
+        }
+    }
+    if(std::any_of(metadata.indexes.begin(), metadata.indexes.end(), [&name](const auto &existing) { return existing.name == name; }))
+    {
+        throw SemanticError("Index '" + name + "' already exists");
+    }
+    IndexMetadata index_meta{std::move(name), std::move(col_ids), std::move(included)};
+
+    IndexTree tree;
+    StringPool pool;
+    auto file = filesystem->open(index_stream_name(indexes.size()), true);
+    if(uses_bytes(index_meta))
+    {
+        // Index the existing rows in key order, so each insert goes to the right edge of the tree
+        std::vector<std::pair<std::string, rid_t>> entries;
+        for(auto iter = index.begin(); iter.valid(); iter.next())
+        {
+            const rid_t row_id = iter.key() - 1;
+            entries.emplace_back(index_bytes(index_meta, row_store->load(iter.value(), pool), row_id), row_id);
+            pool.clear();
+        }
+        std::sort(entries.begin(), entries.end());
+
+        tree.bytes = std::make_unique<StringTree>();
+        tree.bytes->create(std::move(file));
+        for(const auto &[key, row_id] : entries)
+        {
+            if(key.size() > tree.bytes->max_key_size())
+            {
+                throw DatabaseError("Value is too long to be indexed by '" + index_meta.name + "'");
+            }
+            tree.bytes->insert(key, row_id);
+        }
+    }
+    else
+    {
+        // Index the existing rows, sorted so they can be bulk loaded
+        std::vector<std::pair<std::vector<uint64_t>, rid_t>> entries;
+        for(auto iter = index.begin(); iter.valid(); iter.next())
+        {
+            const rid_t row_id = iter.key() - 1;
+            entries.emplace_back(index_key(index_meta, row_store->load(iter.value(), pool)), row_id);
+            pool.clear();
+        }
+        std::sort(entries.begin(), entries.end());
+
+        tree.words = std::make_unique<Tree>();
+        tree.words->create(std::move(file), 0, true, index_meta.columns.size() + index_meta.included.size());
+        size_t pos = 0;
+        tree.words->bulk_load([&](uint64_t *key, uint64_t &val) {
+            if(pos == entries.size())
+            {
+                return false;
+            }
+            std::copy(entries[pos].first.begin(), entries[pos].first.end(), key);
+            val = entries[pos++].second;
+            return true;
+        });
+    }
+
+    indexes.emplace_back(std::move(tree));
+    metadata.indexes.emplace_back(std::move(index_meta));
+}
+
+std::vector<rid_t> Table::index_scan(size_t index_pos, const std::vector<Variable> &lower, const std::vector<Variable> &upper, std::vector<std::vector<Variable>> *covered, StringPool *pool)
+{
+    assert(!covered || pool);
+    std::vector<rid_t> rows;
+    std::vector<Variable> values;
+    auto cursor = index_cursor(index_pos, lower, upper, pool);
+    while(auto row = cursor->next(covered ? &values : nullptr))
+    {
+        rows.emplace_back(*row);
+        if(covered)
+        {
+            covered->emplace_back(std::move(values));
+        }
+    }
+    return rows;
+}
+
+class TreeTable::RangeCursor : public IndexCursor
+{
+public:
+    RangeCursor(TreeTable *table, size_t index_pos, StringPool *pool)
+    : table(table), index_pos(index_pos), pool(pool)
+    {
+
+    }
+
+    std::optional<rid_t> next(std::vector<Variable> *covered) override
+    {
+        // The iterators are left on the row returned last, so they only move on once it's been used
+        if(words && words->valid())
+        {
+            if(started && !words->next())
+            {
+                return {};
+            }
+            started = true;
+
+            // Walk the leaves until the key's leading words pass the end of the range
+            const auto key = words->full_key();
+            if(std::lexicographical_compare(last_words.begin(), last_words.end(), key.begin(), key.begin() + last_words.size()))
+            {
+                return {};
+            }
+            if(covered)
+            {
+                *covered = decode_index_key(key);
+            }
+            return words->value();
+        }
+
+        if(bytes && bytes->valid())
+        {
+            if(started && !bytes->next())
+            {
+                return {};
+            }
+            started = true;
+
+            // Encodings aren't prefixes of each other, so a key is within the range if its leading bytes are <= the upper bound
+            if(bytes->key().substr(0, last_bytes.size()) > last_bytes)
+            {
+                return {};
+            }
+            if(covered)
+            {
+                assert(pool);
+                *covered = table->decode_index_key(table->metadata.indexes[index_pos], bytes->key(), *pool);
+            }
+            return bytes->value();
+        }
+        return {};
+    }
+
+    TreeTable *table;
+    size_t index_pos;
+    StringPool *pool;
+    std::optional<Tree::Iterator> words; // Set for INT only indexes, unless the range can't match anything
+    std::optional<StringTree::Iterator> bytes; // Set for indexes with STRING columns, likewise
+    std::vector<uint64_t> last_words; // The upper bound, encoded to match the tree's keys
+    std::string last_bytes;
+    bool started = false; // Set once the iterator is on a row which has been returned
+};
+
+std::unique_ptr<IndexCursor> TreeTable::index_cursor(size_t index_pos, const std::vector<Variable> &lower, const std::vector<Variable> &upper, StringPool *pool)
+{
+    const auto &columns = metadata.indexes.at(index_pos).columns;
+    assert(lower.size() == upper.size() && lower.size() <= columns.size());
+
+    auto cursor = std::make_unique<RangeCursor>(this, index_pos, pool);
+    for(size_t a = 0; a < lower.size(); a++)
+    {
+        const auto type = metadata.columns[columns[a]].type;
+        if(lower[a].type != type || upper[a].type != type)
+        {
+            return cursor;
+        }
+    }
+
+    if(auto &tree = indexes[index_pos].bytes)
+    {
+        std::string first;
+        for(size_t a = 0; a < lower.size(); a++)
+        {
+            encode_key(lower[a], first);
+            encode_key(upper[a], cursor->last_bytes);
+        }
+        cursor->bytes.emplace(tree->seek(first));
+        return cursor;
+    }
+
+    std::vector<uint64_t> first;
+    for(size_t a = 0; a < lower.size(); a++)
+    {
+        first.emplace_back(encode_key(lower[a]));
+        cursor->last_words.emplace_back(encode_key(upper[a]));
+    }
+    cursor->words.emplace(indexes[index_pos].words->seek(first));
+    return cursor;
+}
+
+uint64_t TreeTable::encode_key(const Variable &value)
+{
+    // Flip the sign bit, so that negative numbers order before positive ones
+    return static_cast<uint64_t>(value.store.int64) ^ 0x8000000000000000ull;
+}
+
+Variable TreeTable::decode_key(uint64_t word)
+{
+    return Variable(static_cast<int64_t>(word ^ 0x8000000000000000ull));
+}
+
+Variable TreeTable::decode_key(Variable::Type type, std::string_view &key, StringPool &pool)
+{
+    if(type == Variable::Type::INT)
+    {
+        uint64_t word = 0;
+        for(size_t a = 0; a < sizeof(word); a++)
+        {
+            word = (word << 8) | static_cast<uint8_t>(key[a]);
+        }
+        key.remove_prefix(sizeof(word));
+        return decode_key(word);
+    }
+
+    std::string str;
+    size_t pos = 0;
+    for(; key[pos] != '\0' || key[pos + 1] != '\0'; pos++)
+    {
+        str.push_back(key[pos]);
+        if(key[pos] == '\0')
+        {
+            pos++; // Skip the escape
+        }
+    }
+    key.remove_prefix(pos + 2);
+    return pool.hold(std::move(str));
+}
+
+std::vector<uint64_t> TreeTable::index_key(const IndexMetadata &index, const std::vector<Variable> &row)
+{
+    std::vector<uint64_t> key;
+    key.reserve(index.columns.size() + index.included.size());
+    for(auto col_id : index.columns)
+    {
+        key.emplace_back(encode_key(row.at(col_id)));
+    }
+    for(auto col_id : index.included)
+    {
+        key.emplace_back(encode_key(row.at(col_id)));
+    }
+    return key;
+}
+
+void TreeTable::encode_key(const Variable &value, std::string &key)
+{
+    if(value.type == Variable::Type::INT)
+    {
+        // Big endian, so that the bytes compare in the same order as the words
+        const uint64_t word = encode_key(value);
+        for(size_t shift = 64; shift > 0; shift -= 8)
+        {
+            key.push_back(static_cast<char>(word >> (shift - 8)));
+        }
+        return;
+    }
+
+    // Strings are terminated with 0x00 0x00, so shorter strings sort first. Any 0x00 within the string is escaped as 0x00 0xFF.
+    for(size_t a = 0; a < value.store.len; a++)
+    {
+        key.push_back(value.store.str[a]);
+        if(value.store.str[a] == '\0')
+        {
+            key.push_back(static_cast<char>(0xFF));
+        }
+    }
+    key.append(2, '\0');
+}
+
+std::string TreeTable::index_bytes(const IndexMetadata &index, const std::vector<Variable> &row, rid_t row_id)
+{
+    std::string key;
+    for(auto col_id : index.columns)
+    {
+        encode_key(row.at(col_id), key);
+    }
+    for(auto col_id : index.included)
+    {
+        encode_key(row.at(col_id), key);
+    }
+    encode_key(Variable(static_cast<int64_t>(row_id)), key);
+    return key;
+}
+
+std::vector<Variable> TreeTable::decode_index_key(Tree::Key key)
+{
+    // Word keys are only used when every column is an INT
+    std::vector<Variable> values;
+    values.reserve(key.size());
+    for(auto word : key)
+    {
+        values.emplace_back(decode_key(word));
+    }
+    return values;
+}
+
+std::vector<Variable> TreeTable::decode_index_key(const IndexMetadata &index, std::string_view key, StringPool &pool)
+{
+    std::vector<Variable> values;
+    values.reserve(index.columns.size() + index.included.size());
+    for(auto col_id : index.columns)
+    {
+        values.emplace_back(decode_key(metadata.columns[col_id].type, key, pool));
+    }
+    for(auto col_id : index.included)
+    {
+        values.emplace_back(decode_key(metadata.columns[col_id].type, key, pool));
+    }
+    return values;
+}
+
+bool TreeTable::uses_bytes(const IndexMetadata &index) const
+{
+    auto is_string = [this](cid_t col_id) {
+        return metadata.columns[col_id].type == Variable::Type::STRING;
+    };
+    return std::any_of(index.columns.begin(), index.columns.end(), is_string) || std::any_of(index.included.begin(), index.included.end(), is_string);
+}
+
+void TreeTable::check_index_keys(const std::vector<Variable> &row)
+{
+    for(size_t a = 0; a < indexes.size(); a++)
+    {
+        if(indexes[a].bytes && index_bytes(metadata.indexes[a], row, 0).size() > indexes[a].bytes->max_key_size())
+        {
+            throw DatabaseError("Value is too long to be indexed by '" + metadata.indexes[a].name + "'");
+        }
+    }
+}
+
+void TreeTable::index_insert(size_t index_pos, const std::vector<Variable> &row, rid_t row_id)
+{
+    auto &tree = indexes[index_pos];
+    if(tree.bytes)
+    {
+        tree.bytes->insert(index_bytes(metadata.indexes[index_pos], row, row_id), row_id);
+    }
+    else
+    {
+        tree.words->insert(index_key(metadata.indexes[index_pos], row), row_id);
+    }
+}
+
+void TreeTable::index_erase(size_t index_pos, const std::vector<Variable> &row, rid_t row_id)
+{
+    auto &tree = indexes[index_pos];
+    if(tree.bytes)
+    {
+        tree.bytes->erase(index_bytes(metadata.indexes[index_pos], row, row_id));
+    }
+    else
+    {
+        tree.words->erase(index_key(metadata.indexes[index_pos], row), row_id);
+    }
+}
+
+std::string TreeTable::index_stream_name(size_t index_pos) const
+{
+    return metadata.name + ".i" + std::to_string(index_pos);
+}
+
+std::optional<uint64_t> TreeTable::find_storage_id(rid_t row_id)
+{
+    return index.search(row_id + 1);
+}
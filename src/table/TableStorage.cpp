@@ -37,6 +37,16 @@ TableStorage::TableStorage(Filesystem::Handle index)
 
 TableStorage::~TableStorage()
 {
+    flush();
+}
+
+void TableStorage::flush()
+{
+    if(!modified)
+    {
+        return;
+    }
+
     data.seek(0);
     serializer::Serializer serializer(std::make_unique<FilehandleSerializerAdapter>(data));
     serializer << metadata;
@@ -44,6 +54,7 @@ TableStorage::~TableStorage()
     {
         serializer << table;
     }
+    modified = false;
 }
 
 tid_t TableStorage::create(TableMetadata table)
@@ -51,7 +62,20 @@ tid_t TableStorage::create(TableMetadata table)
     table.id = metadata.current_table_id++;
     tables.emplace_back(std::move(table));
     metadata.table_count++;
-    return metadata.current_table_id;
+    modified = true;
+    return tables.back().id;
+}
+
+void TableStorage::update(const TableMetadata &table)
+{
+    auto iter = std::find_if(std::begin(tables), std::end(tables), [&table](const auto &elem) {
+        return elem.id == table.id;
+    });
+    if(iter != tables.end())
+    {
+        *iter = table;
+        modified = true;
+    }
 }
 
 void TableStorage::erase(tid_t table_id)
@@ -63,6 +87,7 @@ void TableStorage::erase(tid_t table_id)
     {
         tables.erase(iter);
         metadata.table_count--;
+        modified = true;
     }
 }
 
@@ -213,4 +213,1313 @@ TEST(BTreeTest, test_insert)
     ASSERT_TRUE(assert_node(tree.root->children[3], {79, 81}));
     ASSERT_TRUE(assert_node(tree.root->children[4], {95, 98, 100, 150}));
 }
- */
\ No newline at end of file
+ */
+
+#include "TestUtils.h"
+#include "filesystem/BasicFilesystem.h"
+#include "filesystem/FilesystemBacking.h"
+#include "btree/NodeSearch.h"
+#include "btree/StringTree.h"
+#include "btree/ConcurrentTree.h"
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#define DEF_TREE_FS \
+std::unique_ptr<FilesystemBacking> backing(new MemoryBacking()); \
+BasicFilesystem::Format(backing);                                 \
+BasicFilesystem fs(std::move(backing));
+
+static std::vector<uint64_t> shuffled_keys(size_t count)
+{
+    std::vector<uint64_t> keys(count);
+    for(size_t a = 0; a < count; a++)
+    {
+        keys[a] = a + 1;
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(count));
+    return keys;
+}
+
+TEST(BTreeTest, test_order_from_page_size)
+{
+    DEF_TREE_FS
+    Tree tree;
+    ASSERT_TRUE(tree.create(fs.open("tree", true)));
+    ASSERT_EQ(tree.order(), NodeStore::OrderForSize(fs.page_size()));
+    ASSERT_LE(NodeStore::NodeSize(tree.order()), fs.page_size());
+    ASSERT_GT(tree.order(), 100);
+}
+
+TEST(BTreeTest, test_order_too_large)
+{
+    DEF_TREE_FS
+    Tree tree;
+    ASSERT_FALSE(tree.create(fs.open("tree", true), NodeStore::OrderForSize(fs.page_size()) + 1));
+}
+
+TEST(BTreeTest, test_order_persisted)
+{
+    DEF_TREE_FS
+    {
+        Tree tree;
+        ASSERT_TRUE(tree.create(fs.open("tree", true), 7));
+        for(auto key : shuffled_keys(100))
+        {
+            tree.insert(key, key * 10);
+        }
+    }
+
+    Tree tree;
+    ASSERT_TRUE(tree.open(fs.open("tree", false)));
+    ASSERT_EQ(tree.order(), 7);
+    for(uint64_t key = 1; key <= 100; key++)
+    {
+        ASSERT_EQ(tree.search(key), key * 10);
+    }
+}
+
+TEST(BTreeTest, test_insert_search_small_order)
+{
+    DEF_TREE_FS
+    Tree tree;
+    ASSERT_TRUE(tree.create(fs.open("tree", true), 5));
+    for(auto key : shuffled_keys(2000))
+    {
+        tree.insert(key, key * 10);
+    }
+
+    for(uint64_t key = 1; key <= 2000; key++)
+    {
+        ASSERT_EQ(tree.search(key), key * 10);
+    }
+    ASSERT_FALSE(tree.search(2001).has_value());
+}
+
+TEST(BTreeTest, test_page_order_height)
+{
+    DEF_TREE_FS
+    Tree tree;
+    ASSERT_TRUE(tree.create(fs.open("tree", true)));
+    for(auto key : shuffled_keys(20000))
+    {
+        tree.insert(key, key + 1);
+    }
+
+    ASSERT_LE(tree.height(), 3);
+    for(uint64_t key = 1; key <= 20000; key++)
+    {
+        ASSERT_EQ(tree.search(key), key + 1);
+    }
+}
+
+TEST(BTreeTest, test_node_search_implementations)
+{
+    std::vector<std::pair<std::string, node_search::SearchFunc>> impls = {
+            {"linear", node_search::linear},
+            {"binary", node_search::binary},
+            {"best", node_search::best()},
+    };
+    if(node_search::supports_sse42())
+    {
+        impls.emplace_back("sse4.2", node_search::sse42);
+    }
+    if(node_search::supports_avx2())
+    {
+        impls.emplace_back("avx2", node_search::avx2);
+    }
+
+    std::mt19937_64 rng(5);
+    for(size_t count = 0; count < 200; count++)
+    {
+        // Full 64-bit range, to make sure keys with the top bit set compare as unsigned
+        std::vector<uint64_t> keys(count);
+        std::generate(keys.begin(), keys.end(), rng);
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<uint64_t> needles = {0, 1, std::numeric_limits<uint64_t>::max()};
+        for(auto key : keys)
+        {
+            needles.insert(needles.end(), {key - 1, key, key + 1});
+        }
+
+        for(auto needle : needles)
+        {
+            const size_t expected = std::lower_bound(keys.begin(), keys.end(), needle) - keys.begin();
+            for(const auto &[name, func] : impls)
+            {
+                ASSERT_EQ(func(keys.data(), keys.size(), needle), expected) << name << " with " << count << " keys";
+            }
+        }
+    }
+}
+
+TEST(BTreeTest, test_iterate_in_order)
+{
+    DEF_TREE_FS
+    Tree tree;
+    ASSERT_TRUE(tree.create(fs.open("tree", true), 5));
+    for(auto key : shuffled_keys(1000))
+    {
+        tree.insert(key, key * 10);
+    }
+
+    uint64_t expected = 1;
+    for(auto iter = tree.begin(); iter.valid(); iter.next())
+    {
+        ASSERT_EQ(iter.key(), expected);
+        ASSERT_EQ(iter.value(), expected * 10);
+        expected++;
+    }
+    ASSERT_EQ(expected, 1001);
+}
+
+TEST(BTreeTest, test_iterator_seek)
+{
+    DEF_TREE_FS
+    Tree tree;
+    ASSERT_TRUE(tree.create(fs.open("tree", true), 5));
+    for(auto key : shuffled_keys(500))
+    {
+        tree.insert(key * 2, key);
+    }
+
+    auto iter = tree.seek(101);
+    ASSERT_TRUE(iter.valid());
+    ASSERT_EQ(iter.key(), 102);
+    ASSERT_TRUE(iter.next());
+    ASSERT_EQ(iter.key(), 104);
+
+    ASSERT_TRUE(iter.seek(600));
+    ASSERT_EQ(iter.key(), 600);
+    ASSERT_EQ(iter.value(), 300);
+
+    ASSERT_TRUE(iter.seek(0));
+    ASSERT_EQ(iter.key(), 2);
+
+    ASSERT_TRUE(iter.seek(1000));
+    ASSERT_FALSE(iter.next());
+    ASSERT_FALSE(iter.seek(1001));
+}
+
+TEST(BTreeTest, test_iterator_outlives_lookups)
+{
+    DEF_TREE_FS
+    Tree tree;
+    ASSERT_TRUE(tree.create(fs.open("tree", true), 5));
+    for(uint64_t key = 1; key <= 10; key++)
+    {
+        tree.insert(key, key);
+    }
+
+    // Point lookups load the same leaf as the iterator, which must stay valid
+    auto iter = tree.seek(3);
+    ASSERT_EQ(tree.search(3), 3);
+    ASSERT_EQ(tree.search(4), 4);
+    ASSERT_EQ(iter.key(), 3);
+    ASSERT_TRUE(iter.next());
+    ASSERT_EQ(iter.key(), 4);
+}
+
+TEST(BTreeTest, test_empty_tree)
+{
+    DEF_TREE_FS
+    Tree tree;
+    ASSERT_TRUE(tree.create(fs.open("tree", true), 5));
+    ASSERT_FALSE(tree.search(1).has_value());
+    ASSERT_FALSE(tree.begin().valid());
+    ASSERT_FALSE(tree.erase(1));
+    ASSERT_EQ(tree.height(), 0);
+}
+
+TEST(BTreeTest, test_erase)
+{
+    for(uint64_t order : {3, 4, 5, 16})
+    {
+        DEF_TREE_FS
+        Tree tree;
+        ASSERT_TRUE(tree.create(fs.open("tree", true), order));
+        auto keys = shuffled_keys(1500);
+        for(auto key : keys)
+        {
+            tree.insert(key, key * 10);
+        }
+
+        // Erase half of them, making sure the rest survive all of the re-balancing
+        std::vector<uint64_t> erased(keys.begin(), keys.begin() + keys.size() / 2);
+        for(auto key : erased)
+        {
+            ASSERT_TRUE(tree.erase(key)) << "order " << order << " key " << key;
+            ASSERT_FALSE(tree.erase(key));
+        }
+
+        std::vector<uint64_t> remaining(keys.begin() + keys.size() / 2, keys.end());
+        std::sort(remaining.begin(), remaining.end());
+        for(auto key : erased)
+        {
+            ASSERT_FALSE(tree.search(key).has_value());
+        }
+
+        auto expected = remaining.begin();
+        for(auto iter = tree.begin(); iter.valid(); iter.next(), expected++)
+        {
+            ASSERT_NE(expected, remaining.end());
+            ASSERT_EQ(iter.key(), *expected);
+            ASSERT_EQ(iter.value(), *expected * 10);
+        }
+        ASSERT_EQ(expected, remaining.end());
+
+        // And then the rest, which should collapse the tree back down
+        for(auto key : remaining)
+        {
+            ASSERT_TRUE(tree.erase(key));
+        }
+        ASSERT_EQ(tree.height(), 0);
+        ASSERT_FALSE(tree.begin().valid());
+    }
+}
+
+// Feeds 1..count to a bulk load, with each value being ten times its key
+static std::function<bool(uint64_t &, uint64_t &)> sequential_source(uint64_t count)
+{
+    return [count, next = uint64_t(1)](uint64_t &key, uint64_t &val) mutable {
+        if(next > count)
+        {
+            return false;
+        }
+        key = next++;
+        val = key * 10;
+        return true;
+    };
+}
+
+TEST(BTreeTest, test_bulk_load)
+{
+    for(uint64_t order : {3, 4, 5, 16})
+    {
+        for(uint64_t count : {uint64_t(1), order - 1, order, 2 * order + 1, uint64_t(3000)})
+        {
+            for(double fill : {0.5, 0.7, 1.0})
+            {
+                DEF_TREE_FS
+                Tree tree;
+                ASSERT_TRUE(tree.create(fs.open("tree", true), order));
+                ASSERT_TRUE(tree.bulk_load(sequential_source(count), fill));
+
+                uint64_t expected = 1;
+                for(auto iter = tree.begin(); iter.valid(); iter.next(), expected++)
+                {
+                    ASSERT_EQ(iter.key(), expected);
+                    ASSERT_EQ(iter.value(), expected * 10);
+                }
+                ASSERT_EQ(expected, count + 1);
+                ASSERT_EQ(tree.search(count / 2 + 1).value(), (count / 2 + 1) * 10);
+                ASSERT_FALSE(tree.search(count + 1).has_value());
+
+                // The packed tree must still be balanced enough to insert into and erase from
+                tree.insert(count + 1, 0);
+                auto keys = shuffled_keys(count + 1);
+                for(auto key : keys)
+                {
+                    ASSERT_TRUE(tree.erase(key)) << "order " << order << " count " << count << " fill " << fill;
+                }
+                ASSERT_EQ(tree.height(), 0);
+            }
+        }
+    }
+}
+
+TEST(BTreeTest, test_bulk_load_packing)
+{
+    DEF_TREE_FS
+    Tree packed, inserted;
+    ASSERT_TRUE(packed.create(fs.open("packed", true), 16));
+    ASSERT_TRUE(inserted.create(fs.open("inserted", true), 16));
+
+    ASSERT_TRUE(packed.bulk_load(sequential_source(20000)));
+    for(uint64_t key = 1; key <= 20000; key++)
+    {
+        inserted.insert(key, key * 10);
+    }
+
+    // Full leaves of 15 keys need 1334 leaves, which fits under a 16-way tree of height 4
+    ASSERT_EQ(packed.height(), 4);
+    ASSERT_GE(inserted.height(), packed.height());
+}
+
+TEST(BTreeTest, test_bulk_load_rejects_bad_input)
+{
+    DEF_TREE_FS
+    Tree tree;
+    ASSERT_TRUE(tree.create(fs.open("tree", true), 5));
+
+    std::vector<uint64_t> keys = {1, 2, 3, 3};
+    size_t pos = 0;
+    ASSERT_THROW(tree.bulk_load([&](uint64_t &key, uint64_t &val) {
+        if(pos == keys.size())
+        {
+            return false;
+        }
+        key = val = keys[pos++];
+        return true;
+    }), std::logic_error);
+
+    // Bulk loading only makes sense for an empty tree
+    Tree other;
+    ASSERT_TRUE(other.create(fs.open("other", true), 5));
+    other.insert(1, 1);
+    ASSERT_FALSE(other.bulk_load(sequential_source(10)));
+}
+
+TEST(BTreeTest, test_cache_eviction)
+{
+    DEF_TREE_FS
+    auto keys = shuffled_keys(3000);
+    {
+        // Far fewer frames than nodes, so nodes are constantly written back and re-read
+        Tree tree(8);
+        ASSERT_TRUE(tree.create(fs.open("tree", true), 5));
+        for(auto key : keys)
+        {
+            tree.insert(key, key * 10);
+        }
+        for(auto key : keys)
+        {
+            ASSERT_EQ(tree.search(key), key * 10);
+        }
+        ASSERT_GT(tree.cache_stats().evictions, 0);
+    }
+
+    Tree tree(8);
+    ASSERT_TRUE(tree.open(fs.open("tree", false)));
+    for(auto key : keys)
+    {
+        ASSERT_EQ(tree.search(key), key * 10);
+    }
+}
+
+TEST(BTreeTest, test_cache_keeps_hot_nodes)
+{
+    DEF_TREE_FS
+    Tree tree(64);
+    ASSERT_TRUE(tree.create(fs.open("tree", true), 16));
+    ASSERT_TRUE(tree.bulk_load(sequential_source(20000)));
+    ASSERT_EQ(tree.height(), 4);
+
+    // Probing the same leaf repeatedly should only touch the disk on the first lookup
+    tree.search(1);
+    auto before = tree.cache_stats();
+    for(size_t a = 0; a < 100; a++)
+    {
+        ASSERT_EQ(tree.search(1), 10);
+    }
+    ASSERT_EQ(tree.cache_stats().misses, before.misses);
+    ASSERT_EQ(tree.cache_stats().hits, before.hits + 100 * tree.height());
+
+    // Random probes will miss on leaves, but the upper levels stay resident
+    before = tree.cache_stats();
+    for(auto key : shuffled_keys(1000))
+    {
+        ASSERT_EQ(tree.search(key * 20), key * 200);
+    }
+    ASSERT_LT(tree.cache_stats().misses - before.misses, 1000 * 2);
+}
+
+TEST(BTreeTest, test_cache_over_capacity_when_pinned)
+{
+    DEF_TREE_FS
+    NodeStore store(2);
+    ASSERT_TRUE(store.create(fs.open("tree", true), 5));
+
+    // All of these stay pinned, so none of them can be evicted
+    std::vector<NodePtr> pinned;
+    for(uint64_t a = 0; a < 10; a++)
+    {
+        pinned.emplace_back(store.alloc());
+        pinned.back()->list[0] = a;
+    }
+    for(uint64_t a = 0; a < 10; a++)
+    {
+        ASSERT_EQ(pinned[a]->list[0], a);
+    }
+    ASSERT_EQ(store.cache_stats().evictions, 0);
+
+    pinned.clear();
+    auto node = store.alloc();
+    ASSERT_EQ(store.cache_stats().evictions, 1);
+}
+
+TEST(BTreeTest, test_reads_dont_write)
+{
+    DEF_TREE_FS
+    Tree tree(8);
+    ASSERT_TRUE(tree.create(fs.open("tree", true), 5));
+    auto keys = shuffled_keys(1000);
+    for(auto key : keys)
+    {
+        tree.insert(key, key * 10);
+    }
+    tree.flush();
+
+    // Lookups evict plenty of nodes, but none of them have changed
+    auto writes = tree.cache_stats().writes;
+    for(auto key : keys)
+    {
+        ASSERT_EQ(tree.search(key), key * 10);
+    }
+    for(auto iter = tree.begin(); iter.valid(); iter.next());
+    ASSERT_GT(tree.cache_stats().evictions, 0);
+    ASSERT_EQ(tree.cache_stats().writes, writes);
+
+    // Modifying a single key only writes back its leaf
+    ASSERT_TRUE(tree.erase(keys[0]));
+    tree.insert(keys[0], 1);
+    tree.flush();
+    ASSERT_EQ(tree.cache_stats().writes, writes + 1);
+}
+
+TEST(BTreeTest, test_erased_nodes_reused)
+{
+    DEF_TREE_FS
+    Tree tree(8);
+    ASSERT_TRUE(tree.create(fs.open("tree", true), 5));
+    auto keys = shuffled_keys(1000);
+    for(auto key : keys)
+    {
+        tree.insert(key, key);
+    }
+    const auto peak = tree.node_count();
+
+    // Churning through the same number of keys shouldn't need any more space
+    for(size_t round = 0; round < 3; round++)
+    {
+        for(auto key : keys)
+        {
+            ASSERT_TRUE(tree.erase(key));
+        }
+        for(auto key : keys)
+        {
+            tree.insert(key, key + round);
+        }
+        ASSERT_LE(tree.node_count(), peak);
+    }
+
+    for(auto key : keys)
+    {
+        ASSERT_EQ(tree.search(key), key + 2);
+    }
+}
+
+TEST(BTreeTest, test_compact)
+{
+    DEF_TREE_FS
+    auto keys = shuffled_keys(3000);
+    std::vector<uint64_t> remaining(keys.begin() + 2000, keys.end());
+    std::sort(remaining.begin(), remaining.end());
+    {
+        Tree tree(8);
+        ASSERT_TRUE(tree.create(fs.open("tree", true), 5));
+        for(auto key : keys)
+        {
+            tree.insert(key, key * 10);
+        }
+        for(size_t a = 0; a < 2000; a++)
+        {
+            ASSERT_TRUE(tree.erase(keys[a]));
+        }
+    }
+
+    {
+        // Re-opening should keep the free list
+        Tree tree(8);
+        ASSERT_TRUE(tree.open(fs.open("tree", false)));
+        const auto before = tree.node_count();
+        const auto reclaimed = tree.compact();
+        ASSERT_GT(reclaimed, 0);
+        ASSERT_EQ(tree.node_count(), before - reclaimed);
+        ASSERT_EQ(tree.compact(), 0);
+    }
+
+    Tree tree(8);
+    ASSERT_TRUE(tree.open(fs.open("tree", false)));
+    auto expected = remaining.begin();
+    for(auto iter = tree.begin(); iter.valid(); iter.next(), expected++)
+    {
+        ASSERT_NE(expected, remaining.end());
+        ASSERT_EQ(iter.key(), *expected);
+        ASSERT_EQ(iter.value(), *expected * 10);
+    }
+    ASSERT_EQ(expected, remaining.end());
+
+    // The tree should still be fully usable, with new nodes appended after the compacted ones
+    for(size_t a = 0; a < 2000; a++)
+    {
+        tree.insert(keys[a], keys[a] * 10);
+    }
+    for(auto key : keys)
+    {
+        ASSERT_EQ(tree.search(key), key * 10);
+    }
+    for(auto key : keys)
+    {
+        ASSERT_TRUE(tree.erase(key));
+    }
+    ASSERT_EQ(tree.height(), 0);
+}
+
+TEST(BTreeTest, test_duplicate_keys)
+{
+    for(uint64_t order : {3, 4, 5, 16})
+    {
+        DEF_TREE_FS
+        Tree tree;
+        ASSERT_TRUE(tree.create(fs.open("tree", true), order, true));
+        ASSERT_TRUE(tree.duplicates());
+
+        // Lots of values for each of a few keys, so runs of the same key span many nodes
+        std::vector<std::pair<uint64_t, uint64_t>> entries;
+        for(auto val : shuffled_keys(2000))
+        {
+            entries.emplace_back(val % 7, val);
+            tree.insert(val % 7, val);
+        }
+        ASSERT_THROW(tree.insert(3, 3), std::logic_error);
+        ASSERT_EQ(tree.size(), entries.size());
+        ASSERT_EQ(tree.last(), 6);
+
+        std::sort(entries.begin(), entries.end());
+        auto expected = entries.begin();
+        for(auto iter = tree.begin(); iter.valid(); iter.next(), expected++)
+        {
+            ASSERT_EQ(iter.key(), expected->first);
+            ASSERT_EQ(iter.value(), expected->second);
+        }
+        ASSERT_EQ(expected, entries.end());
+
+        // Erase the even values, then every remaining value for a key should be found by a seek
+        for(auto &[key, val] : entries)
+        {
+            if(val % 2 == 0)
+            {
+                ASSERT_TRUE(tree.erase(key, val)) << "order " << order;
+                ASSERT_FALSE(tree.erase(key, val));
+            }
+        }
+        ASSERT_EQ(tree.size(), entries.size() / 2);
+
+        for(uint64_t key = 0; key < 7; key++)
+        {
+            std::vector<uint64_t> found;
+            for(auto iter = tree.seek(key); iter.valid() && iter.key() == key; iter.next())
+            {
+                found.emplace_back(iter.value());
+            }
+
+            std::vector<uint64_t> odd;
+            for(auto &[k, val] : entries)
+            {
+                if(k == key && val % 2)
+                {
+                    odd.emplace_back(val);
+                }
+            }
+            ASSERT_EQ(found, odd);
+            ASSERT_EQ(tree.search(key), odd.front());
+        }
+    }
+}
+
+TEST(BTreeTest, test_bulk_load_duplicates)
+{
+    DEF_TREE_FS
+    Tree tree;
+    ASSERT_TRUE(tree.create(fs.open("tree", true), 4, true));
+    uint64_t next = 0;
+    ASSERT_TRUE(tree.bulk_load([&](uint64_t &key, uint64_t &val) {
+        key = next / 100;
+        val = next % 100;
+        return next++ < 1000;
+    }));
+    ASSERT_EQ(tree.size(), 1000);
+
+    for(uint64_t key = 0; key < 10; key++)
+    {
+        uint64_t count = 0;
+        for(auto iter = tree.seek(key); iter.valid() && iter.key() == key; iter.next())
+        {
+            ASSERT_EQ(iter.value(), count++);
+        }
+        ASSERT_EQ(count, 100);
+    }
+}
+
+TEST(BTreeTest, test_composite_keys)
+{
+    for(uint64_t order : {3, 4, 5, 16, 0})
+    {
+        DEF_TREE_FS
+        Tree tree;
+        ASSERT_TRUE(tree.create(fs.open("tree", true), order, false, 2));
+        ASSERT_EQ(tree.key_width(), 2);
+
+        // A few values of the leading word, each with many of the second
+        std::vector<std::array<uint64_t, 2>> keys;
+        for(auto val : shuffled_keys(1500))
+        {
+            std::array<uint64_t, 2> key{val % 5, val};
+            keys.emplace_back(key);
+            tree.insert(key, val);
+        }
+        ASSERT_THROW(tree.insert(keys.front(), 0), std::logic_error);
+
+        std::sort(keys.begin(), keys.end());
+        auto expected = keys.begin();
+        for(auto iter = tree.begin(); iter.valid(); iter.next(), expected++)
+        {
+            ASSERT_TRUE(std::equal(expected->begin(), expected->end(), iter.full_key().begin()));
+            ASSERT_EQ(iter.value(), (*expected)[1]);
+        }
+        ASSERT_EQ(expected, keys.end());
+
+        // Seeking to just the leading word finds every key starting with it, in order
+        for(uint64_t prefix = 0; prefix < 5; prefix++)
+        {
+            uint64_t count = 0, previous = 0;
+            for(auto iter = tree.seek(Tree::Key(&prefix, 1)); iter.valid() && iter.starts_with(Tree::Key(&prefix, 1)); iter.next(), count++)
+            {
+                ASSERT_GE(iter.full_key()[1], previous);
+                previous = iter.full_key()[1];
+            }
+            ASSERT_EQ(count, 300);
+        }
+
+        for(auto &key : keys)
+        {
+            if(key[1] % 3 == 0)
+            {
+                ASSERT_TRUE(tree.erase(key)) << "order " << order;
+                ASSERT_FALSE(tree.search(key).has_value());
+            }
+            else
+            {
+                ASSERT_EQ(tree.search(key), key[1]);
+            }
+        }
+        ASSERT_EQ(tree.size(), 1000);
+    }
+}
+
+TEST(BTreeTest, test_bulk_load_composite_keys)
+{
+    DEF_TREE_FS
+    Tree tree;
+    ASSERT_TRUE(tree.create(fs.open("tree", true), 5, false, 3));
+
+    uint64_t next = 0;
+    ASSERT_TRUE(tree.bulk_load([&](uint64_t *key, uint64_t &val) {
+        if(next == 1000)
+        {
+            return false;
+        }
+        key[0] = next / 100;
+        key[1] = (next / 10) % 10;
+        key[2] = next % 10;
+        val = next++;
+        return true;
+    }));
+    ASSERT_EQ(tree.size(), 1000);
+
+    for(uint64_t val = 0; val < 1000; val++)
+    {
+        std::array<uint64_t, 3> key{val / 100, (val / 10) % 10, val % 10};
+        ASSERT_EQ(tree.search(key), val);
+    }
+
+    // Keys must still be strictly ascending, comparing every word
+    Tree unsorted;
+    ASSERT_TRUE(unsorted.create(fs.open("unsorted", true), 5, false, 2));
+    std::vector<std::array<uint64_t, 2>> keys = {{1, 5}, {1, 4}};
+    size_t pos = 0;
+    ASSERT_THROW(unsorted.bulk_load([&](uint64_t *key, uint64_t &val) {
+        if(pos == keys.size())
+        {
+            return false;
+        }
+        std::copy(keys[pos].begin(), keys[pos].end(), key);
+        val = pos++;
+        return true;
+    }), std::logic_error);
+}
+
+static std::vector<std::string> shuffled_strings(const std::string &prefix, size_t count)
+{
+    std::vector<std::string> keys;
+    for(auto key : shuffled_keys(count))
+    {
+        keys.emplace_back(prefix + std::to_string(key));
+    }
+    return keys;
+}
+
+TEST(BTreeTest, test_string_keys)
+{
+    DEF_TREE_FS
+    StringTree tree(8);
+    ASSERT_TRUE(tree.create(fs.open("tree", true)));
+    auto keys = shuffled_strings("user", 5000);
+    for(size_t a = 0; a < keys.size(); a++)
+    {
+        keys[a] += "@example.com";
+        tree.insert(keys[a], a);
+    }
+    ASSERT_EQ(tree.size(), keys.size());
+    ASSERT_GT(tree.height(), 1);
+
+    for(size_t a = 0; a < keys.size(); a++)
+    {
+        ASSERT_EQ(tree.search(keys[a]), a);
+    }
+    ASSERT_FALSE(tree.search("user").has_value());
+    ASSERT_FALSE(tree.search("user1@example.co").has_value());
+    ASSERT_THROW(tree.insert(keys[0], 0), std::logic_error);
+    ASSERT_THROW(tree.insert(std::string(tree.max_key_size() + 1, 'a'), 0), std::length_error);
+
+    // Keys come back in byte order
+    auto sorted = keys;
+    std::sort(sorted.begin(), sorted.end());
+    size_t pos = 0;
+    for(auto iter = tree.begin(); iter.valid(); iter.next())
+    {
+        ASSERT_EQ(iter.key(), sorted[pos++]);
+    }
+    ASSERT_EQ(pos, sorted.size());
+
+    // Seeking to part of a key lands on the first key starting with it
+    ASSERT_EQ(tree.seek("user42").key(), "user4200@example.com");
+    ASSERT_EQ(tree.seek("user42@").key(), "user42@example.com");
+    ASSERT_FALSE(tree.seek("v").valid());
+}
+
+TEST(BTreeTest, test_string_keys_erase)
+{
+    DEF_TREE_FS
+    StringTree tree(8);
+    ASSERT_TRUE(tree.create(fs.open("tree", true)));
+    auto keys = shuffled_strings("ref-", 3000);
+    for(const auto &key : keys)
+    {
+        tree.insert(key, key.size());
+    }
+    const auto peak = tree.node_count();
+
+    for(size_t a = 0; a < keys.size(); a += 2)
+    {
+        ASSERT_TRUE(tree.erase(keys[a]));
+    }
+    ASSERT_FALSE(tree.erase(keys[0]));
+    for(size_t a = 0; a < keys.size(); a++)
+    {
+        ASSERT_EQ(tree.search(keys[a]).has_value(), a % 2 == 1);
+    }
+
+    // Erased nodes are reused once the tree grows again
+    for(size_t a = 0; a < keys.size(); a += 2)
+    {
+        tree.insert(keys[a], keys[a].size());
+    }
+    ASSERT_LE(tree.node_count(), peak + 1);
+
+    for(const auto &key : keys)
+    {
+        ASSERT_TRUE(tree.erase(key));
+    }
+    ASSERT_EQ(tree.size(), 0);
+    ASSERT_EQ(tree.height(), 0);
+    ASSERT_FALSE(tree.begin().valid());
+}
+
+TEST(BTreeTest, test_string_keys_prefix_compressed)
+{
+    DEF_TREE_FS
+    const std::string prefix = "https://shop.example.com/orders/external-reference/";
+    auto keys = shuffled_strings(prefix, 5000);
+    size_t key_bytes = 0;
+    {
+        StringTree tree;
+        ASSERT_TRUE(tree.create(fs.open("tree", true)));
+        for(const auto &key : keys)
+        {
+            tree.insert(key, key_bytes);
+            key_bytes += key.size();
+        }
+    }
+
+    StringTree tree;
+    ASSERT_TRUE(tree.open(fs.open("tree", false)));
+    ASSERT_EQ(tree.size(), keys.size());
+    size_t pos = 0;
+    for(const auto &key : keys)
+    {
+        ASSERT_EQ(tree.search(key), pos);
+        pos += key.size();
+    }
+
+    // The shared prefix is only stored once per node, so the keys take up far fewer pages than they would in full
+    ASSERT_LT(tree.node_count() * fs.page_size(), key_bytes / 2);
+
+    // A word tree can't open a string tree's file
+    Tree words;
+    ASSERT_FALSE(words.open(fs.open("tree", false)));
+}
+
+TEST(BTreeTest, test_concurrent_tree)
+{
+    DEF_TREE_FS
+    const size_t writers = 4, per_writer = 2000;
+    auto keys = shuffled_keys(writers * per_writer);
+    {
+        ConcurrentTree tree(16);
+        ASSERT_TRUE(tree.create(fs.open("tree", true), 8));
+        ASSERT_FALSE(tree.search(1).has_value());
+        tree.insert(1, 10);
+        ASSERT_THROW(tree.insert(1, 11), std::logic_error);
+        ASSERT_EQ(tree.search(1), 10);
+        ASSERT_TRUE(tree.erase(1));
+        ASSERT_FALSE(tree.erase(1));
+        ASSERT_EQ(tree.size(), 0);
+
+        // Writers each insert their own share of the keys, while readers check that every key they find has the right value
+        std::atomic<bool> done = false;
+        std::atomic<size_t> bad_reads = 0;
+        std::vector<std::thread> threads;
+        for(size_t w = 0; w < writers; w++)
+        {
+            threads.emplace_back([&, w]() {
+                for(size_t a = w; a < keys.size(); a += writers)
+                {
+                    tree.insert(keys[a], keys[a] * 2);
+                }
+            });
+        }
+
+        std::vector<std::thread> readers;
+        for(size_t r = 0; r < 4; r++)
+        {
+            readers.emplace_back([&, r]() {
+                std::mt19937 rng(r);
+                while(!done)
+                {
+                    const uint64_t key = rng() % keys.size() + 1;
+                    auto val = tree.search(key);
+                    if(val.has_value() && *val != key * 2)
+                    {
+                        bad_reads++;
+                    }
+                }
+            });
+        }
+
+        for(auto &thread : threads)
+        {
+            thread.join();
+        }
+        threads.clear();
+
+        // Erase the odd keys while the readers are still going
+        for(size_t w = 0; w < writers; w++)
+        {
+            threads.emplace_back([&, w]() {
+                for(uint64_t key = w * 2 + 1; key <= keys.size(); key += writers * 2)
+                {
+                    ASSERT_TRUE(tree.erase(key));
+                }
+            });
+        }
+        for(auto &thread : threads)
+        {
+            thread.join();
+        }
+
+        done = true;
+        for(auto &thread : readers)
+        {
+            thread.join();
+        }
+        ASSERT_EQ(bad_reads, 0);
+        ASSERT_EQ(tree.size(), keys.size() / 2);
+        for(uint64_t key = 1; key <= keys.size(); key++)
+        {
+            ASSERT_EQ(tree.search(key), key % 2 ? std::nullopt : std::optional<uint64_t>(key * 2));
+        }
+    }
+
+    // The tree is an ordinary one on disk
+    Tree reopened;
+    ASSERT_TRUE(reopened.open(fs.open("tree", false)));
+    ASSERT_EQ(reopened.size(), keys.size() / 2);
+    uint64_t expected = 2;
+    for(auto iter = reopened.begin(); iter.valid(); iter.next(), expected += 2)
+    {
+        ASSERT_EQ(iter.key(), expected);
+    }
+    ASSERT_EQ(expected, keys.size() + 2);
+}
+
+TEST(BTreeTest, test_concurrent_insert_erase)
+{
+    DEF_TREE_FS
+    const size_t writers = 4, operations = 10000, key_range = 2000, stripes = 64;
+    ConcurrentTree tree(32);
+    ASSERT_TRUE(tree.create(fs.open("tree", true), 8));
+
+    // Each key is guarded by a stripe lock, so every change can be checked against a reference, while
+    // writers working on keys in other stripes still race each other over the same nodes
+    std::map<uint64_t, uint64_t> reference;
+    std::mutex reference_mutex;
+    std::vector<std::mutex> stripe_mutexes(stripes);
+    std::atomic<size_t> mismatches = 0, bad_reads = 0;
+    std::atomic<bool> done = false;
+
+    std::vector<std::thread> readers;
+    for(size_t r = 0; r < 4; r++)
+    {
+        readers.emplace_back([&, r]() {
+            std::mt19937 rng(100 + r);
+            while(!done)
+            {
+                // Values are the key times four plus a small counter, so a torn read shows up as the wrong key
+                const uint64_t key = rng() % key_range + 1;
+                auto val = tree.search(key);
+                if(val.has_value() && *val / 4 != key)
+                {
+                    bad_reads++;
+                }
+            }
+        });
+    }
+
+    std::vector<std::thread> threads;
+    for(size_t w = 0; w < writers; w++)
+    {
+        threads.emplace_back([&, w]() {
+            std::mt19937 rng(w);
+            for(size_t a = 0; a < operations; a++)
+            {
+                const uint64_t key = rng() % key_range + 1;
+                std::lock_guard stripe(stripe_mutexes[key % stripes]);
+                std::optional<uint64_t> expected;
+                {
+                    std::lock_guard lock(reference_mutex);
+                    auto iter = reference.find(key);
+                    if(iter != reference.end())
+                    {
+                        expected = iter->second;
+                    }
+                }
+
+                if(tree.search(key) != expected)
+                {
+                    mismatches++;
+                }
+
+                if(expected)
+                {
+                    if(!tree.erase(key))
+                    {
+                        mismatches++;
+                    }
+                    std::lock_guard lock(reference_mutex);
+                    reference.erase(key);
+                }
+                else
+                {
+                    const uint64_t val = key * 4 + a % 4;
+                    tree.insert(key, val);
+                    std::lock_guard lock(reference_mutex);
+                    reference.emplace(key, val);
+                }
+            }
+        });
+    }
+
+    for(auto &thread : threads)
+    {
+        thread.join();
+    }
+    done = true;
+    for(auto &thread : readers)
+    {
+        thread.join();
+    }
+
+    ASSERT_EQ(mismatches, 0);
+    ASSERT_EQ(bad_reads, 0);
+    ASSERT_EQ(tree.size(), reference.size());
+    for(uint64_t key = 1; key <= key_range; key++)
+    {
+        auto iter = reference.find(key);
+        ASSERT_EQ(tree.search(key), iter == reference.end() ? std::nullopt : std::optional<uint64_t>(iter->second));
+    }
+}
+
+TEST(BTreeTest, test_concurrent_root_splits)
+{
+    // Split the root while readers are partway down the tree, over and over, as the window is small.
+    // Keys that were there from the start must be found by every search, however many times it restarts.
+    DEF_TREE_FS
+    const size_t rounds = 50, order = 8, initial = order - 2, writers = 2, per_writer = 40;
+    for(size_t round = 0; round < rounds; round++)
+    {
+        ConcurrentTree tree(16);
+        ASSERT_TRUE(tree.create(fs.open("tree" + std::to_string(round), true), order));
+        for(uint64_t key = 1; key <= initial; key++)
+        {
+            tree.insert(key * 1000, key);
+        }
+        ASSERT_EQ(tree.height(), 1);
+
+        std::atomic<bool> start = false, done = false;
+        std::atomic<size_t> missed = 0;
+        std::vector<std::thread> readers;
+        for(size_t r = 0; r < 3; r++)
+        {
+            readers.emplace_back([&, r]() {
+                while(!start)
+                {
+                    std::this_thread::yield();
+                }
+                for(uint64_t key = r % initial + 1; !done; key = key % initial + 1)
+                {
+                    if(tree.search(key * 1000) != key)
+                    {
+                        missed++;
+                    }
+                }
+            });
+        }
+
+        // Keys go in between the initial ones, so splits move them to new nodes on either side
+        std::vector<std::thread> threads;
+        for(size_t w = 0; w < writers; w++)
+        {
+            threads.emplace_back([&, w]() {
+                while(!start)
+                {
+                    std::this_thread::yield();
+                }
+                for(uint64_t a = 0; a < per_writer; a++)
+                {
+                    tree.insert((a % initial + 1) * 1000 + 1 + a * writers + w, 0);
+                }
+            });
+        }
+
+        start = true;
+        for(auto &thread : threads)
+        {
+            thread.join();
+        }
+        done = true;
+        for(auto &thread : readers)
+        {
+            thread.join();
+        }
+
+        ASSERT_EQ(missed, 0);
+        ASSERT_GE(tree.height(), 2);
+        ASSERT_EQ(tree.size(), initial + writers * per_writer);
+        for(uint64_t key = 1; key <= initial; key++)
+        {
+            ASSERT_EQ(tree.search(key * 1000), key);
+        }
+    }
+}
+
+TEST(BTreeTest, test_copy_on_write_snapshots)
+{
+    DEF_TREE_FS
+    auto keys = shuffled_keys(1000);
+    {
+        Tree plain;
+        ASSERT_TRUE(plain.create(fs.open("plain", true)));
+        ASSERT_THROW(plain.snapshot(), std::logic_error);
+    }
+
+    {
+        Tree tree(16);
+        ASSERT_TRUE(tree.create(fs.open("tree", true), 5, false, 1, true));
+        for(auto key : keys)
+        {
+            tree.insert(key, key);
+        }
+
+        auto snapshot = tree.snapshot();
+
+        // A reader walks the snapshot from another thread while the tree is rewritten underneath it
+        std::atomic<bool> done = false;
+        std::atomic<size_t> bad_scans = 0, scans = 0;
+        std::thread reader([&]() {
+            while(!done || !scans)
+            {
+                uint64_t expected = 1;
+                for(auto iter = snapshot.begin(); iter.valid(); iter.next(), expected++)
+                {
+                    if(iter.key() != expected || iter.value() != expected)
+                    {
+                        break;
+                    }
+                }
+                if(expected != keys.size() + 1)
+                {
+                    bad_scans++;
+                }
+                scans++;
+            }
+        });
+
+        for(uint64_t key = 2; key <= keys.size(); key += 2)
+        {
+            ASSERT_TRUE(tree.erase(key));
+        }
+        for(uint64_t key = keys.size() + 1; key <= keys.size() * 2; key++)
+        {
+            tree.insert(key, key * 10);
+        }
+        done = true;
+        reader.join();
+        ASSERT_EQ(bad_scans, 0);
+
+        ASSERT_EQ(snapshot.search(2), 2);
+        ASSERT_FALSE(snapshot.search(keys.size() + 1).has_value());
+        ASSERT_FALSE(tree.search(2).has_value());
+        ASSERT_EQ(tree.search(keys.size() + 1), (keys.size() + 1) * 10);
+        ASSERT_EQ(tree.size(), keys.size() / 2 + keys.size());
+    }
+
+    // The file holds the latest version, and stays copy-on-write
+    Tree tree(16);
+    ASSERT_TRUE(tree.open(fs.open("tree", false)));
+    ASSERT_TRUE(tree.copy_on_write());
+    size_t count = 0;
+    for(auto iter = tree.seek(1); iter.valid(); iter.next(), count++)
+    {
+        ASSERT_TRUE(iter.key() % 2 || iter.key() > keys.size());
+    }
+    ASSERT_EQ(count, tree.size());
+
+    // Without snapshots holding on to old versions, replaced nodes are reused rather than the file growing
+    const auto peak = tree.node_count();
+    for(size_t round = 0; round < 3; round++)
+    {
+        for(uint64_t key = 1; key <= keys.size(); key += 2)
+        {
+            ASSERT_TRUE(tree.erase(key));
+            tree.insert(key, key);
+        }
+    }
+    ASSERT_LE(tree.node_count(), peak + tree.height());
+}
+
+TEST(BTreeTest, test_copy_on_write_copies_only_what_changes)
+{
+    DEF_TREE_FS
+    Tree tree(16);
+    ASSERT_TRUE(tree.create(fs.open("tree", true), 16, false, 1, true));
+    for(uint64_t key = 1; key <= 60; key++)
+    {
+        tree.insert(key, key);
+    }
+    ASSERT_EQ(tree.height(), 2);
+
+    // Compacting empties the free list, so every copy made from then on grows the file
+    tree.compact();
+    auto slots = tree.node_count();
+    ASSERT_THROW(tree.insert(20, 20), std::logic_error);
+    ASSERT_EQ(tree.node_count(), slots);
+
+    // Erasing copies the root and the leaf, plus the one sibling a rebalance borrows from or merges into
+    for(uint64_t key : {5, 6, 7, 20, 21, 22, 23, 2, 3, 35, 36, 37})
+    {
+        tree.compact();
+        slots = tree.node_count();
+        ASSERT_TRUE(tree.erase(key));
+        ASSERT_LE(tree.node_count(), slots + 3);
+    }
+    ASSERT_EQ(tree.height(), 2);
+    ASSERT_EQ(tree.size(), 48);
+}
+
+TEST(BTreeTest, test_insert_sorted)
+{
+    DEF_TREE_FS
+    Tree tree(16);
+    ASSERT_TRUE(tree.create(fs.open("tree", true), 5));
+
+    // Start with a tree built by ordinary inserts, then append a long run after it
+    for(auto key : shuffled_keys(500))
+    {
+        tree.insert(key * 2, key);
+    }
+    const auto before = tree.cache_stats();
+    uint64_t next = 1001;
+    tree.insert_sorted([&](uint64_t &key, uint64_t &val) {
+        key = next;
+        val = next / 2;
+        return next++ <= 5000;
+    });
+    ASSERT_EQ(tree.size(), 4500);
+
+    // The rightmost path is only walked once, rather than once per key
+    const auto after = tree.cache_stats();
+    ASSERT_LT((after.hits + after.misses) - (before.hits + before.misses), 500);
+
+    // Keys which aren't past the end of the tree still go in, as do any appended after them
+    std::vector<uint64_t> run = {3, 5, 999, 5001, 5002, 5003};
+    size_t pos = 0;
+    tree.insert_sorted([&](uint64_t &key, uint64_t &val) {
+        if(pos == run.size())
+        {
+            return false;
+        }
+        key = run[pos++];
+        val = key / 2;
+        return true;
+    });
+    pos = 0;
+    ASSERT_THROW(tree.insert_sorted([&](uint64_t &key, uint64_t &val) {
+        key = 5003;
+        val = 0;
+        return pos++ == 0;
+    }), std::logic_error);
+
+    std::vector<uint64_t> expected;
+    for(uint64_t key = 2; key <= 1000; key += 2)
+    {
+        expected.emplace_back(key);
+    }
+    expected.insert(expected.end(), run.begin(), run.end());
+    for(uint64_t key = 1001; key <= 5000; key++)
+    {
+        expected.emplace_back(key);
+    }
+    std::sort(expected.begin(), expected.end());
+    ASSERT_EQ(tree.size(), expected.size());
+
+    auto iter = tree.begin();
+    for(auto key : expected)
+    {
+        ASSERT_TRUE(iter.valid());
+        ASSERT_EQ(iter.key(), key);
+        ASSERT_EQ(iter.value(), key / 2);
+        iter.next();
+    }
+    ASSERT_FALSE(iter.valid());
+
+    // The tree stays balanced enough for erasing to work as normal
+    for(auto key : expected)
+    {
+        ASSERT_TRUE(tree.erase(key));
+    }
+    ASSERT_EQ(tree.height(), 0);
+}
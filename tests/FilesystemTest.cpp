@@ -5,6 +5,14 @@
 #include "filesystem/BasicFilesystem.h"
 #include "TestUtils.h"
 #include "filesystem/FilesystemBacking.h"
+#include "filesystem/MmapBacking.h"
+#include "filesystem/PosixBacking.h"
+#include "filesystem/UringBacking.h"
+#include "filesystem/WriteAheadLog.h"
+#include <atomic>
+#include <filesystem>
+#include <thread>
+#include <unistd.h>
 #define DEF_FS \
 std::unique_ptr<FilesystemBacking> backing(new MemoryBacking()); \
 BasicFilesystem::Format(backing);                                 \
@@ -47,6 +55,16 @@ TEST(FilesystemTest, test_open_valid_file)
     }
 }
 
+TEST(FilesystemTest, test_rejects_unformatted_file)
+{
+    // A file from before the header had a magic number starts with its stream count
+    std::unique_ptr<FilesystemBacking> backing(new MemoryBacking());
+    char page[PAGE_SIZE]{};
+    page[0] = 3;
+    ASSERT_TRUE(backing->write_at(0, page, PAGE_SIZE));
+    ASSERT_DEATH(BasicFilesystem fs(std::move(backing)), "");
+}
+
 TEST(FilesystemTest, test_single_page_read_write)
 {
     DEF_FS
@@ -171,6 +189,24 @@ TEST(FilesystemTest, test_seek_past_end_multi_page)
     ASSERT_EQ(handle.tell(), source.size());
 }
 
+TEST(FilesystemTest, test_write_after_seek_past_end)
+{
+    DEF_FS
+    auto handle = fs.open("file1", true);
+    auto source1 = gen_random(handle.page_size() * 2, 10);
+    auto source2 = gen_random(handle.page_size(), 7);
+    handle.write(source1.data(), source1.size());
+
+    // Seeking past the end should leave writes appending to the end of the stream
+    ASSERT_EQ(handle.seek(source1.size() * 2), source1.size());
+    handle.write(source2.data(), source2.size());
+
+    std::string sink(source1.size() + source2.size(), '\0');
+    handle.seek(0);
+    ASSERT_EQ(handle.read(sink.data(), sink.size()), sink.size());
+    ASSERT_EQ(sink, source1 + source2);
+}
+
 TEST(FilesystemTest, test_interspersed_file_read_write)
 {
     DEF_FS
@@ -197,4 +233,821 @@ TEST(FilesystemTest, test_interspersed_file_read_write)
 
     ASSERT_EQ(sink1, source1);
     ASSERT_EQ(sink2, source2);
-}
\ No newline at end of file
+}
+
+TEST(FilesystemTest, test_view)
+{
+    DEF_FS
+    auto handle = fs.open("file1", true);
+    auto source = gen_random(handle.page_size() + 100);
+    handle.write(source.data(), source.size());
+
+    // Views come straight out of the page, and move the position along like a read
+    handle.seek(0);
+    const char *data = handle.view(10);
+    ASSERT_NE(data, nullptr);
+    ASSERT_EQ(std::string(data, 10), source.substr(0, 10));
+    data = handle.view(handle.page_size() - 10);
+    ASSERT_NE(data, nullptr);
+    ASSERT_EQ(std::string(data, handle.page_size() - 10), source.substr(10, handle.page_size() - 10));
+
+    // Straight onto the next page once this one's used up, but not across pages or past the end
+    data = handle.view(50);
+    ASSERT_NE(data, nullptr);
+    ASSERT_EQ(std::string(data, 50), source.substr(handle.page_size(), 50));
+    ASSERT_EQ(handle.view(51), nullptr);
+    char buf[50];
+    ASSERT_EQ(handle.read(buf, 50), 50);
+    ASSERT_EQ(std::string(buf, 50), source.substr(handle.page_size() + 50));
+}
+
+TEST(FilesystemTest, test_mmap_backing)
+{
+    const auto path = (std::filesystem::temp_directory_path() / "frsql_mmap_test.db").string();
+    auto source1 = gen_random(3 * 1024 * 1024, 10);
+    auto source2 = gen_random(PAGE_SIZE * 3, 7);
+    uint64_t page_size;
+    {
+        std::unique_ptr<FilesystemBacking> backing(new MmapBacking());
+        ASSERT_TRUE(backing->open(path, true));
+        ASSERT_TRUE(BasicFilesystem::Format(backing));
+        BasicFilesystem fs(std::move(backing));
+        page_size = fs.page_size();
+
+        // Enough to need the mapping to grow a few times
+        auto handle = fs.open("file1", true);
+        auto handle2 = fs.open("file2", true);
+        handle.write(source1.data(), source1.size());
+        handle2.write(source2.data(), source2.size());
+    }
+
+    // The file is trimmed back to the pages actually written, which includes page headers, each
+    // stream's page map, and the parts of file1's last extent that come before file2's pages
+    ASSERT_EQ(std::filesystem::file_size(path) % PAGE_SIZE, 0);
+    ASSERT_LT(std::filesystem::file_size(path), source1.size() + source2.size() + (16 + BasicFilesystem::MaxExtentPages) * PAGE_SIZE);
+
+    std::unique_ptr<FilesystemBacking> backing(new MmapBacking());
+    ASSERT_FALSE(backing->open(path + ".missing", false));
+    ASSERT_TRUE(backing->open(path, false));
+    BasicFilesystem fs(std::move(backing));
+    auto handle = fs.open("file1", false);
+    auto handle2 = fs.open("file2", false);
+    ASSERT_TRUE(handle.is_open() && handle2.is_open());
+
+    // Whole pages can be viewed in place
+    handle.seek(page_size * 3);
+    const char *data = handle.view(page_size);
+    ASSERT_NE(data, nullptr);
+    ASSERT_EQ(std::string(data, page_size), source1.substr(page_size * 3, page_size));
+
+    std::string sink1(source1.size(), '\0'), sink2(source2.size(), '\0');
+    handle.seek(0);
+    ASSERT_EQ(handle.read(sink1.data(), sink1.size()), sink1.size());
+    ASSERT_EQ(handle2.read(sink2.data(), sink2.size()), sink2.size());
+    ASSERT_EQ(sink1, source1);
+    ASSERT_EQ(sink2, source2);
+    std::filesystem::remove(path);
+}
+
+TEST(FilesystemTest, test_mmap_backing_unclean_close)
+{
+    const auto path = (std::filesystem::temp_directory_path() / "frsql_mmap_crash_test.db").string();
+    const uint64_t os_page = sysconf(_SC_PAGESIZE);
+    auto source = gen_random(PAGE_SIZE * 3 + 10, 7);
+    {
+        MmapBacking backing;
+        ASSERT_TRUE(backing.open(path, true));
+        ASSERT_TRUE(backing.write_at(0, source.data(), source.size()));
+
+        // While it's still open, as it would be left by a crash, the file only reaches the last OS page written
+        ASSERT_EQ(std::filesystem::file_size(path), (source.size() + os_page - 1) / os_page * os_page);
+    }
+    ASSERT_EQ(std::filesystem::file_size(path), source.size());
+    std::filesystem::remove(path);
+}
+
+TEST(FilesystemTest, test_overwrite_across_pages)
+{
+    DEF_FS
+    auto source = gen_random(PAGE_SIZE * 3, 10);
+    auto handle = fs.open("file1", true);
+    handle.write(source.data(), source.size());
+
+    // Overwrite a range spanning a page boundary, which shouldn't disturb the pages after it
+    const uint64_t pos = handle.page_size() - 100;
+    std::string patch(300, 'x');
+    ASSERT_EQ(handle.seek(pos), pos);
+    handle.write(patch.data(), patch.size());
+    ASSERT_EQ(handle.tell(), pos + patch.size());
+    source.replace(pos, patch.size(), patch);
+
+    std::string sink(source.size(), '\0');
+    ASSERT_EQ(handle.seek(0), 0);
+    ASSERT_EQ(handle.read(sink.data(), sink.size()), source.size());
+    ASSERT_EQ(handle.tell(), source.size());
+    ASSERT_EQ(sink, source);
+
+    // Seeking relative to where reads left us
+    ASSERT_EQ(handle.seek(handle.page_size() * 2 + 5), handle.page_size() * 2 + 5);
+    char c;
+    ASSERT_EQ(handle.read(&c, 1), 1);
+    ASSERT_EQ(c, source[handle.page_size() * 2 + 5]);
+}
+
+TEST(FilesystemTest, test_posix_backing)
+{
+    const auto path = (std::filesystem::temp_directory_path() / "frsql_posix_test.db").string();
+    auto source = gen_random(PAGE_SIZE * 20 + 123, 9);
+    {
+        std::unique_ptr<FilesystemBacking> backing(new PosixBacking());
+        ASSERT_TRUE(backing->open(path, true));
+        ASSERT_TRUE(BasicFilesystem::Format(backing));
+
+        // Positional calls leave the cursor alone
+        ASSERT_TRUE(backing->write_at(PAGE_SIZE, source.data(), PAGE_SIZE));
+        ASSERT_EQ(backing->size(), 2 * PAGE_SIZE);
+        ASSERT_EQ(backing->tellg(), 0);
+        char buf[PAGE_SIZE];
+        ASSERT_TRUE(backing->read_at(PAGE_SIZE, buf, PAGE_SIZE));
+        ASSERT_EQ(std::string(buf, PAGE_SIZE), source.substr(0, PAGE_SIZE));
+        ASSERT_FALSE(backing->read_at(PAGE_SIZE, buf, PAGE_SIZE + 1));
+
+        BasicFilesystem fs(std::move(backing));
+        auto handle = fs.open("file1", true);
+        handle.write(source.data(), source.size());
+    }
+
+    std::unique_ptr<FilesystemBacking> backing(new PosixBacking());
+    ASSERT_FALSE(backing->open(path + ".missing", false));
+    ASSERT_TRUE(backing->open(path, false));
+    BasicFilesystem fs(std::move(backing));
+    auto handle = fs.open("file1", false);
+    ASSERT_TRUE(handle.is_open());
+    std::string sink(source.size(), '\0');
+    ASSERT_EQ(handle.read(sink.data(), sink.size()), sink.size());
+    ASSERT_EQ(sink, source);
+    std::filesystem::remove(path);
+}
+
+TEST(FilesystemTest, test_page_pool)
+{
+    auto backing = std::make_unique<MemoryBacking>();
+    auto raw_backing = backing.get();
+    std::unique_ptr<FilesystemBacking> formatted(std::move(backing));
+    BasicFilesystem::Format(formatted);
+
+    // A budget of the minimum number of frames, so writing a few streams has to evict
+    BasicFilesystem fs(std::move(formatted), 0);
+    std::vector<std::string> sources;
+    std::vector<Filesystem::Handle> handles;
+    for(size_t a = 0; a < 3; a++)
+    {
+        sources.emplace_back(gen_random(PAGE_SIZE * 10, 7 + a));
+        handles.emplace_back(fs.open("file" + std::to_string(a), true));
+        handles.back().write(sources.back().data(), sources.back().size());
+    }
+    ASSERT_GT(fs.cache_stats().evictions, 0);
+    ASSERT_GT(fs.cache_stats().writebacks, 0);
+
+    for(size_t a = 0; a < 3; a++)
+    {
+        std::string sink(sources[a].size(), '\0');
+        ASSERT_EQ(handles[a].seek(0), 0);
+        ASSERT_EQ(handles[a].read(sink.data(), sink.size()), sink.size());
+        ASSERT_EQ(sink, sources[a]);
+    }
+
+    // Reading the same page repeatedly is served from the pool
+    char buf[100];
+    handles[0].seek(0);
+    const auto before = fs.cache_stats();
+    for(size_t a = 0; a < 10; a++)
+    {
+        handles[0].seek(0);
+        ASSERT_EQ(handles[0].read(buf, sizeof(buf)), sizeof(buf));
+    }
+    ASSERT_EQ(fs.cache_stats().misses, before.misses);
+    ASSERT_GT(fs.cache_stats().hits, before.hits);
+
+    // New pages only reach the backing once flushed
+    const uint64_t size = raw_backing->size();
+    auto handle = fs.open("file3", true);
+    handle.write(sources[0].data(), 100);
+    ASSERT_EQ(raw_backing->size(), size);
+    fs.flush();
+    ASSERT_GE(raw_backing->size(), size + 2 * PAGE_SIZE);
+}
+
+// Fails every write while 'fail_writes' is set, and records which pages have been written
+class FailingWriteBacking : public MemoryBacking
+{
+public:
+    [[nodiscard]] bool write_at(uint64_t offset, const char *buf, uint64_t buflen) override
+    {
+        if(fail_writes)
+        {
+            return false;
+        }
+        written.emplace_back(offset / PAGE_SIZE);
+        return MemoryBacking::write_at(offset, buf, buflen);
+    }
+
+    bool fail_writes = false;
+    std::vector<uint64_t> written;
+};
+
+TEST(FilesystemTest, test_page_pool_failed_writeback)
+{
+    auto backing = std::make_unique<FailingWriteBacking>();
+    auto raw_backing = backing.get();
+    std::unique_ptr<FilesystemBacking> formatted(std::move(backing));
+    BasicFilesystem::Format(formatted);
+    BasicFilesystem fs(std::move(formatted), 0);
+
+    // Nothing can be written back, so the pool has to hold on to every page rather than evict them
+    raw_backing->fail_writes = true;
+    std::vector<std::string> sources;
+    std::vector<Filesystem::Handle> handles;
+    for(size_t a = 0; a < 3; a++)
+    {
+        sources.emplace_back(gen_random(PAGE_SIZE * 10, 7 + a));
+        handles.emplace_back(fs.open("file" + std::to_string(a), true));
+        handles.back().write(sources.back().data(), sources.back().size());
+    }
+    ASSERT_EQ(fs.cache_stats().writebacks, 0);
+    ASSERT_EQ(fs.cache_stats().evictions, 0);
+
+    // Once the backing recovers, the pages get written back and can be evicted, then read back from it
+    raw_backing->fail_writes = false;
+    ASSERT_TRUE(fs.commit());
+    auto churn = fs.open("churn", true);
+    const auto filler = gen_random(PAGE_SIZE * 20, 3);
+    churn.write(filler.data(), filler.size());
+    ASSERT_GT(fs.cache_stats().evictions, 0);
+
+    const auto misses = fs.cache_stats().misses;
+    for(size_t a = 0; a < 3; a++)
+    {
+        std::string sink(sources[a].size(), '\0');
+        ASSERT_EQ(handles[a].seek(0), 0);
+        ASSERT_EQ(handles[a].read(sink.data(), sink.size()), sink.size());
+        ASSERT_EQ(sink, sources[a]);
+    }
+    ASSERT_GT(fs.cache_stats().misses, misses);
+}
+
+TEST(FilesystemTest, test_flush_retries_failed_writes)
+{
+    auto backing = std::make_unique<FailingWriteBacking>();
+    auto raw_backing = backing.get();
+    std::unique_ptr<FilesystemBacking> formatted(std::move(backing));
+    BasicFilesystem::Format(formatted);
+    BasicFilesystem fs(std::move(formatted));
+
+    auto handle = fs.open("file1", true);
+    const auto source = gen_random(PAGE_SIZE * 10, 7);
+    handle.write(source.data(), source.size());
+
+    // A failed flush leaves the pages dirty, so the next one writes them all again
+    raw_backing->fail_writes = true;
+    ASSERT_FALSE(fs.commit());
+    raw_backing->fail_writes = false;
+    ASSERT_TRUE(fs.commit());
+    ASSERT_GE(raw_backing->written.size(), 10);
+    const auto written = raw_backing->written;
+
+    raw_backing->written.clear();
+    ASSERT_TRUE(fs.commit());
+    ASSERT_TRUE(raw_backing->written.empty());
+
+    // Everything reached the backing, as it reads back the same from a copy of it
+    std::unique_ptr<FilesystemBacking> copy(new MemoryBacking());
+    std::string image(raw_backing->size(), '\0');
+    ASSERT_TRUE(raw_backing->read_at(0, image.data(), image.size()));
+    ASSERT_TRUE(copy->write_at(0, image.data(), image.size()));
+    BasicFilesystem reopened(std::move(copy));
+    auto reopened_handle = reopened.open("file1", false);
+    std::string sink(source.size(), '\0');
+    ASSERT_EQ(reopened_handle.read(sink.data(), sink.size()), sink.size());
+    ASSERT_EQ(sink, source);
+}
+
+TEST(FilesystemTest, test_seek_page_table)
+{
+    const auto path = (std::filesystem::temp_directory_path() / "frsql_page_table_test.db").string();
+
+    // Enough pages that the page map needs more than one map page
+    auto source = gen_random(PAGE_SIZE * 600, 11);
+    uint64_t page_size;
+    {
+        std::unique_ptr<FilesystemBacking> backing(new PosixBacking());
+        ASSERT_TRUE(backing->open(path, true));
+        ASSERT_TRUE(BasicFilesystem::Format(backing));
+        BasicFilesystem fs(std::move(backing));
+        page_size = fs.page_size();
+        auto handle = fs.open("file1", true);
+        handle.write(source.data(), source.size());
+    }
+
+    std::unique_ptr<FilesystemBacking> backing(new PosixBacking());
+    ASSERT_TRUE(backing->open(path, false));
+    BasicFilesystem fs(std::move(backing), 0);
+    auto handle = fs.open("file1", false);
+    ASSERT_TRUE(handle.is_open());
+
+    // Seeking anywhere only needs the page it lands on, however far along the stream that is
+    for(uint64_t position : {source.size() - 1, page_size * 550 + 17, uint64_t(3), page_size * 300, page_size * 300 - 1})
+    {
+        const auto before = fs.cache_stats();
+        ASSERT_EQ(handle.seek(position), position);
+        char c;
+        ASSERT_EQ(handle.read(&c, 1), 1);
+        ASSERT_EQ(c, source[position]);
+        ASSERT_LE(fs.cache_stats().misses - before.misses, 1);
+    }
+
+    // Past the end stops at the end, and appending from there carries on the stream
+    ASSERT_EQ(handle.seek(source.size() + 100), source.size());
+    handle.write("abc", 3);
+    ASSERT_EQ(handle.seek(source.size()), source.size());
+    char buf[3];
+    ASSERT_EQ(handle.read(buf, 3), 3);
+    ASSERT_EQ(std::string(buf, 3), "abc");
+    std::filesystem::remove(path);
+}
+
+TEST(FilesystemTest, test_extent_allocation)
+{
+    auto backing = std::make_unique<MemoryBacking>();
+    auto raw_backing = backing.get();
+    std::unique_ptr<FilesystemBacking> formatted(std::move(backing));
+    BasicFilesystem::Format(formatted);
+    BasicFilesystem fs(std::move(formatted));
+
+    // Grow two streams a page at a time, turn about
+    auto source1 = gen_random(PAGE_SIZE * 300, 7);
+    auto source2 = gen_random(PAGE_SIZE * 300, 13);
+    auto handle1 = fs.open("file1", true);
+    auto handle2 = fs.open("file2", true);
+    for(size_t a = 0; a < source1.size(); a += fs.page_size())
+    {
+        const size_t len = std::min<size_t>(fs.page_size(), source1.size() - a);
+        handle1.write(source1.data() + a, len);
+        handle2.write(source2.data() + a, len);
+    }
+    fs.flush();
+
+    // Follow each page's link to the next page of its stream, straight from the backing. Most
+    // should be to the page right after it, rather than alternating between the streams.
+    size_t links = 0, contiguous = 0;
+    for(uint64_t page = 1; page < raw_backing->size() / PAGE_SIZE; page++)
+    {
+        uint64_t header[4]; // page_length, previous_page, current_page, next_page
+        ASSERT_TRUE(raw_backing->read_at(page * PAGE_SIZE, reinterpret_cast<char*>(header), sizeof(header)));
+        if(header[2] == page && header[3])
+        {
+            links++;
+            contiguous += header[3] == page + 1;
+        }
+    }
+    ASSERT_GT(links, 500);
+    ASSERT_GT(contiguous, links * 9 / 10);
+
+    for(auto [handle, source] : {std::make_pair(&handle1, &source1), std::make_pair(&handle2, &source2)})
+    {
+        std::string sink(source->size(), '\0');
+        ASSERT_EQ(handle->seek(0), 0);
+        ASSERT_EQ(handle->read(sink.data(), sink.size()), sink.size());
+        ASSERT_EQ(sink, *source);
+    }
+}
+
+TEST(FilesystemTest, test_truncate_and_remove)
+{
+    const auto path = (std::filesystem::temp_directory_path() / "frsql_free_space_test.db").string();
+    auto source = gen_random(PAGE_SIZE * 40, 9);
+    uint64_t page_size, file_pages;
+    {
+        std::unique_ptr<FilesystemBacking> backing(new PosixBacking());
+        ASSERT_TRUE(backing->open(path, true));
+        ASSERT_TRUE(BasicFilesystem::Format(backing));
+        BasicFilesystem fs(std::move(backing));
+        page_size = fs.page_size();
+
+        auto handle1 = fs.open("file1", true);
+        auto handle2 = fs.open("file2", true);
+        handle1.write(source.data(), source.size());
+        handle2.write(source.data(), source.size());
+
+        // Can't be truncated or removed from under another handle
+        auto other = fs.open("file1", false);
+        ASSERT_FALSE(handle1.truncate(10));
+        ASSERT_FALSE(fs.remove("file1"));
+        other.close();
+
+        // Truncate to part way through a page, which moves the position back to the new end
+        const uint64_t size = page_size * 5 + 100;
+        ASSERT_TRUE(handle1.truncate(size));
+        ASSERT_EQ(handle1.tell(), size);
+        ASSERT_EQ(handle1.seek(source.size()), size);
+        ASSERT_TRUE(handle1.truncate(size + 1));
+        std::string sink(size, '\0');
+        ASSERT_EQ(handle1.seek(0), 0);
+        ASSERT_EQ(handle1.read(sink.data(), source.size()), size);
+        ASSERT_EQ(sink, source.substr(0, size));
+
+        handle2.close();
+        ASSERT_TRUE(fs.remove("file2"));
+        ASSERT_FALSE(fs.remove("file2"));
+        ASSERT_FALSE(fs.open("file2", false).is_open());
+        fs.flush();
+        file_pages = std::filesystem::file_size(path) / PAGE_SIZE;
+    }
+
+    // Free pages are remembered across reopening, and new streams go in them rather than growing the file
+    std::unique_ptr<FilesystemBacking> backing(new PosixBacking());
+    ASSERT_TRUE(backing->open(path, false));
+    {
+        BasicFilesystem fs(std::move(backing));
+        auto handle3 = fs.open("file3", true);
+        auto handle1 = fs.open("file1", false);
+        handle3.write(source.data(), source.size());
+        handle1.seek(page_size * 5 + 100);
+        handle1.write(source.data() + page_size * 5 + 100, source.size() - page_size * 5 - 100);
+
+        for(auto handle : {&handle1, &handle3})
+        {
+            std::string sink(source.size(), '\0');
+            ASSERT_EQ(handle->seek(0), 0);
+            ASSERT_EQ(handle->read(sink.data(), sink.size()), source.size());
+            ASSERT_EQ(sink, source);
+        }
+    }
+    ASSERT_LE(std::filesystem::file_size(path) / PAGE_SIZE, file_pages);
+    std::filesystem::remove(path);
+}
+
+TEST(FilesystemTest, test_reopen_with_unwritten_free_pages)
+{
+    const auto path = (std::filesystem::temp_directory_path() / "frsql_unwritten_free_test.db").string();
+    auto source = gen_random(PAGE_SIZE * 64, 5);
+    {
+        std::unique_ptr<FilesystemBacking> backing(new PosixBacking());
+        ASSERT_TRUE(backing->open(path, true));
+        ASSERT_TRUE(BasicFilesystem::Format(backing));
+        BasicFilesystem fs(std::move(backing));
+
+        // Freeing something first puts the bitmap page before the pages freed later
+        auto handle1 = fs.open("file1", true);
+        handle1.write(source.data(), fs.page_size() * 3);
+        ASSERT_TRUE(handle1.truncate(fs.page_size()));
+
+        // The last extent of file2 is mostly never written, so it lies past the end of the file
+        // once file2 is removed
+        auto handle2 = fs.open("file2", true);
+        handle2.write(source.data(), fs.page_size() * 33);
+        handle2.close();
+        ASSERT_TRUE(fs.remove("file2"));
+        fs.flush();
+    }
+
+    std::unique_ptr<FilesystemBacking> backing(new PosixBacking());
+    ASSERT_TRUE(backing->open(path, false));
+    {
+        BasicFilesystem fs(std::move(backing));
+        auto handle1 = fs.open("file1", false);
+        auto handle3 = fs.open("file3", true);
+        handle1.seek(fs.page_size());
+        for(size_t a = fs.page_size(); a < source.size(); a += fs.page_size())
+        {
+            const size_t len = std::min<size_t>(fs.page_size(), source.size() - a);
+            handle1.write(source.data() + a, len);
+            handle3.write(source.data() + a - fs.page_size(), len);
+        }
+        handle3.write(source.data() + source.size() - fs.page_size(), fs.page_size());
+
+        // No page was handed to both streams
+        for(auto handle : {&handle1, &handle3})
+        {
+            std::string sink(source.size(), '\0');
+            ASSERT_EQ(handle->seek(0), 0);
+            ASSERT_EQ(handle->read(sink.data(), sink.size()), source.size());
+            ASSERT_EQ(sink, source);
+        }
+    }
+    std::filesystem::remove(path);
+}
+
+TEST(FilesystemTest, test_many_streams)
+{
+    const auto path = (std::filesystem::temp_directory_path() / "frsql_many_streams_test.db").string();
+    const size_t stream_count = 300;
+    auto source = gen_random(PAGE_SIZE * 2, 3);
+    {
+        std::unique_ptr<FilesystemBacking> backing(new PosixBacking());
+        ASSERT_TRUE(backing->open(path, true));
+        ASSERT_TRUE(BasicFilesystem::Format(backing));
+        BasicFilesystem fs(std::move(backing));
+
+        // Far more than fit in the first page
+        for(size_t a = 0; a < stream_count; a++)
+        {
+            auto handle = fs.open("stream" + std::to_string(a), true);
+            ASSERT_TRUE(handle.is_open());
+            handle.write(source.data() + a, source.size() - a);
+        }
+        ASSERT_TRUE(fs.remove("stream200"));
+        fs.flush();
+    }
+
+    std::unique_ptr<FilesystemBacking> backing(new PosixBacking());
+    ASSERT_TRUE(backing->open(path, false));
+    {
+        BasicFilesystem fs(std::move(backing));
+        ASSERT_FALSE(fs.open("stream200", false).is_open());
+        auto reused = fs.open("reused", true);
+        reused.write(source.data(), source.size());
+
+        for(size_t a = 0; a < stream_count; a++)
+        {
+            if(a == 200)
+            {
+                continue;
+            }
+            auto handle = fs.open("stream" + std::to_string(a), false);
+            ASSERT_TRUE(handle.is_open());
+            std::string sink(source.size(), '\0');
+            ASSERT_EQ(handle.read(sink.data(), sink.size()), source.size() - a);
+            ASSERT_EQ(sink.substr(0, source.size() - a), source.substr(a));
+        }
+    }
+    std::filesystem::remove(path);
+}
+
+// Records which pages it's asked to prefetch
+class PrefetchRecordingBacking : public MemoryBacking
+{
+public:
+    void prefetch(uint64_t offset, uint64_t len) override
+    {
+        ASSERT_EQ(offset % PAGE_SIZE, 0);
+        ASSERT_EQ(len % PAGE_SIZE, 0);
+        for(uint64_t page = offset / PAGE_SIZE; page < (offset + len) / PAGE_SIZE; page++)
+        {
+            prefetched.emplace_back(page);
+        }
+    }
+
+    std::vector<uint64_t> prefetched;
+};
+
+TEST(FilesystemTest, test_read_ahead)
+{
+    auto backing = std::make_unique<PrefetchRecordingBacking>();
+    auto raw_backing = backing.get();
+    std::unique_ptr<FilesystemBacking> formatted(std::move(backing));
+    BasicFilesystem::Format(formatted);
+    BasicFilesystem fs(std::move(formatted), 0);
+
+    auto source = gen_random(PAGE_SIZE * 100, 7);
+    auto handle = fs.open("file1", true);
+    handle.write(source.data(), source.size());
+    fs.flush();
+
+    // Reading through the stream in small pieces prefetches pages ahead of it
+    std::string sink(source.size(), '\0');
+    ASSERT_EQ(handle.seek(0), 0);
+    for(size_t a = 0; a < sink.size(); a += 1000)
+    {
+        ASSERT_EQ(handle.read(sink.data() + a, std::min<size_t>(1000, sink.size() - a)), std::min<size_t>(1000, sink.size() - a));
+    }
+    ASSERT_EQ(sink, source);
+    ASSERT_GT(raw_backing->prefetched.size(), 60);
+    ASSERT_GT(fs.cache_stats().prefetched, 60);
+
+    // No page should be asked for twice in one pass
+    auto sorted = raw_backing->prefetched;
+    std::sort(sorted.begin(), sorted.end());
+    ASSERT_EQ(std::adjacent_find(sorted.begin(), sorted.end()), sorted.end());
+
+    // Jumping about doesn't prefetch anything
+    raw_backing->prefetched.clear();
+    for(uint64_t page : {50, 10, 80, 30, 70, 20})
+    {
+        char c;
+        ASSERT_EQ(handle.seek(page * handle.page_size()), page * handle.page_size());
+        ASSERT_EQ(handle.read(&c, 1), 1);
+    }
+    ASSERT_TRUE(raw_backing->prefetched.empty());
+}
+
+TEST(FilesystemTest, test_uring_backing)
+{
+    const auto path = (std::filesystem::temp_directory_path() / "frsql_uring_test.db").string();
+
+    // Batches bigger than the queue, written out of order, and read back in a different order.
+    // If the kernel doesn't have io_uring this still works, one request at a time.
+    {
+        UringBacking backing;
+        ASSERT_TRUE(backing.open(path, true));
+        const size_t count = UringBacking::QueueDepth * 2 + 10;
+        std::vector<std::string> pages(count);
+        std::vector<IoRequest> requests;
+        for(size_t a = 0; a < count; a++)
+        {
+            pages[a] = gen_random(PAGE_SIZE, 3 + a % 50);
+            requests.push_back({((a * 7) % count) * PAGE_SIZE, pages[a].data(), PAGE_SIZE});
+        }
+        ASSERT_TRUE(backing.write_batch(requests.data(), requests.size()));
+        ASSERT_EQ(backing.size(), count * PAGE_SIZE);
+
+        std::vector<std::string> sinks(count, std::string(PAGE_SIZE, '\0'));
+        std::vector<IoRequest> reads;
+        for(size_t a = count; a-- > 0;)
+        {
+            reads.push_back({((a * 7) % count) * PAGE_SIZE, sinks[a].data(), PAGE_SIZE});
+        }
+        ASSERT_TRUE(backing.read_batch(reads.data(), reads.size()));
+        ASSERT_EQ(sinks, pages);
+
+        // Reading past the end fails
+        IoRequest past_end{count * PAGE_SIZE, sinks[0].data(), PAGE_SIZE};
+        ASSERT_FALSE(backing.read_batch(&past_end, 1));
+    }
+
+    // Flushing and read-ahead go through batches
+    auto source = gen_random(PAGE_SIZE * 100, 7);
+    {
+        std::unique_ptr<FilesystemBacking> backing(new UringBacking());
+        ASSERT_TRUE(backing->open(path, true));
+        ASSERT_TRUE(BasicFilesystem::Format(backing));
+        BasicFilesystem fs(std::move(backing));
+        auto handle = fs.open("file1", true);
+        handle.write(source.data(), source.size());
+    }
+
+    std::unique_ptr<FilesystemBacking> backing(new UringBacking());
+    ASSERT_TRUE(backing->open(path, false));
+    BasicFilesystem fs(std::move(backing));
+    auto handle = fs.open("file1", false);
+    std::string sink(source.size(), '\0');
+    ASSERT_EQ(handle.read(sink.data(), sink.size()), sink.size());
+    ASSERT_EQ(sink, source);
+    ASSERT_GT(fs.cache_stats().prefetched, 0);
+    std::filesystem::remove(path);
+}
+
+TEST(FilesystemTest, test_coalesced_writes)
+{
+    DEF_FS
+    {
+        auto handle = fs.open("file1", true);
+    }
+    fs.flush();
+
+    // Lots of small appends only write back the pages they touched, once each
+    auto before = fs.cache_stats();
+    std::string source;
+    {
+        auto handle = fs.open("file1", false);
+        for(uint32_t a = 0; a < 2000; a++)
+        {
+            handle.write(reinterpret_cast<const char*>(&a), sizeof(a));
+            source.append(reinterpret_cast<const char*>(&a), sizeof(a));
+        }
+    }
+    fs.flush();
+    const uint64_t data_pages = (source.size() + fs.page_size() - 1) / fs.page_size();
+
+    // The data pages, plus the page map and the stream table
+    ASSERT_LE(fs.cache_stats().writebacks - before.writebacks, data_pages + 2);
+
+    // Reading the stream back doesn't dirty anything
+    before = fs.cache_stats();
+    {
+        auto handle = fs.open("file1", false);
+        std::string sink(source.size(), '\0');
+        ASSERT_EQ(handle.read(sink.data(), sink.size()), sink.size());
+        ASSERT_EQ(sink, source);
+    }
+    fs.flush();
+    ASSERT_EQ(fs.cache_stats().writebacks, before.writebacks);
+}
+
+TEST(FilesystemTest, test_write_ahead_log_recovery)
+{
+    const auto dir = std::filesystem::temp_directory_path();
+    const auto path = (dir / "frsql_wal_test.db").string();
+    const auto crash_path = (dir / "frsql_wal_test_crash.db").string();
+    const auto torn_path = (dir / "frsql_wal_test_torn.db").string();
+    auto first = gen_random(PAGE_SIZE * 10 + 5, 11);
+    auto second = gen_random(PAGE_SIZE * 3, 13);
+    {
+        std::unique_ptr<FilesystemBacking> backing(new PosixBacking());
+        ASSERT_TRUE(backing->open(path, true));
+        ASSERT_TRUE(BasicFilesystem::Format(backing));
+        std::unique_ptr<FilesystemBacking> log(new PosixBacking());
+        ASSERT_TRUE(log->open(path + "-wal", true));
+        BasicFilesystem fs(std::move(backing), PagePool::DefaultBudget, std::move(log));
+
+        auto handle = fs.open("file1", true);
+        handle.write(first.data(), first.size());
+        ASSERT_TRUE(fs.commit());
+        const auto log_size = std::filesystem::file_size(path + "-wal");
+        handle.write(second.data(), second.size());
+        ASSERT_TRUE(fs.commit());
+        handle.write("uncommitted", 11);
+
+        // Committing only went as far as the log, one sync each
+        ASSERT_EQ(fs.cache_stats().writebacks, 0);
+        ASSERT_EQ(fs.log_stats().commits, 2);
+        ASSERT_EQ(fs.log_stats().syncs, 2);
+
+        // Crash, by copying the files as they are before anything else is written. Another copy
+        // has the second commit torn part way through being logged.
+        for(const auto &copy : {crash_path, torn_path})
+        {
+            std::filesystem::copy_file(path, copy, std::filesystem::copy_options::overwrite_existing);
+            std::filesystem::copy_file(path + "-wal", copy + "-wal", std::filesystem::copy_options::overwrite_existing);
+        }
+        std::filesystem::resize_file(torn_path + "-wal", log_size + PAGE_SIZE);
+    }
+
+    for(const auto &[copy, expected] : {std::make_pair(crash_path, first + second), std::make_pair(torn_path, first)})
+    {
+        {
+            std::unique_ptr<FilesystemBacking> backing(new PosixBacking());
+            ASSERT_TRUE(backing->open(copy, false));
+            std::unique_ptr<FilesystemBacking> log(new PosixBacking());
+            ASSERT_TRUE(log->open(copy + "-wal", false));
+            BasicFilesystem fs(std::move(backing), PagePool::DefaultBudget, std::move(log));
+            auto handle = fs.open("file1", false);
+            ASSERT_TRUE(handle.is_open());
+            std::string sink(first.size() + second.size() + 11, '\0');
+            ASSERT_EQ(handle.read(sink.data(), sink.size()), expected.size());
+            ASSERT_EQ(sink.substr(0, expected.size()), expected);
+        }
+
+        // Recovery wrote the committed pages back, so the log isn't needed any more
+        std::unique_ptr<FilesystemBacking> backing(new PosixBacking());
+        ASSERT_TRUE(backing->open(copy, false));
+        BasicFilesystem fs(std::move(backing));
+        auto handle = fs.open("file1", false);
+        std::string sink(expected.size(), '\0');
+        ASSERT_EQ(handle.read(sink.data(), sink.size()), expected.size());
+        ASSERT_EQ(sink, expected);
+        std::filesystem::remove(copy);
+        std::filesystem::remove(copy + "-wal");
+    }
+    std::filesystem::remove(path);
+    std::filesystem::remove(path + "-wal");
+}
+
+// Takes a while to sync, so that commits pile up behind each other
+class SlowSyncBacking : public MemoryBacking
+{
+public:
+    [[nodiscard]] bool sync() override
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        return true;
+    }
+};
+
+TEST(FilesystemTest, test_group_commit)
+{
+    WriteAheadLog log(std::make_unique<SlowSyncBacking>(), PAGE_SIZE);
+    MemoryBacking target;
+    ASSERT_TRUE(log.recover(target));
+
+    constexpr size_t thread_count = 8;
+    constexpr size_t commits_per_thread = 25;
+    std::atomic<bool> ok = true;
+    std::vector<std::thread> threads;
+    for(size_t t = 0; t < thread_count; t++)
+    {
+        threads.emplace_back([&, t]() {
+            std::string page(PAGE_SIZE, static_cast<char>(t));
+            for(size_t a = 0; a < commits_per_thread; a++)
+            {
+                WriteAheadLog::PageImage image{t, page.data()};
+                auto lsn = log.append(&image, 1);
+                if(!lsn || !log.wait_durable(*lsn))
+                {
+                    ok = false;
+                }
+            }
+        });
+    }
+    for(auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    // Every commit was made durable, but commits waiting at the same time shared a sync
+    ASSERT_TRUE(ok);
+    auto stats = log.stats();
+    ASSERT_EQ(stats.commits, thread_count * commits_per_thread);
+    ASSERT_EQ(stats.pages, thread_count * commits_per_thread);
+    ASSERT_LT(stats.syncs, thread_count * commits_per_thread / 2);
+}
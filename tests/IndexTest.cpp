@@ -0,0 +1,244 @@
+//
+// Created by fred on 19/10/2026.
+//
+
+#include "TestUtils.h"
+#include "filesystem/FilesystemBacking.h"
+#include "filesystem/BasicFilesystem.h"
+
+class IndexTest : public ::testing::Test
+{
+public:
+    IndexTest()
+    {
+        std::unique_ptr<FilesystemBacking> backing = std::make_unique<MemoryBacking>();
+        BasicFilesystem::Format(backing);
+        sql = std::make_unique<Frsql>(std::make_unique<BasicFilesystem>(std::move(backing)));
+
+        sql->exec("CREATE TABLE item (id INT, category INT, price INT);");
+        sql->exec("INSERT INTO item (id, category, price) VALUES (1, 10, 100), (2, 20, 200), (3, 10, 300), (4, 30, 400);");
+    }
+
+    std::vector<row_t> query(std::string_view str)
+    {
+        std::vector<row_t> rows;
+        sql->exec(str, [&](const row_t &row){rows.emplace_back(row);});
+        return rows;
+    }
+
+protected:
+    std::unique_ptr<Frsql> sql;
+};
+
+TEST_F(IndexTest, test_equality_lookup)
+{
+    sql->exec("CREATE INDEX item_category ON item(category);");
+    ASSERT_EQ(query("SELECT id FROM item WHERE category = 10;"), (std::vector<row_t>{{Variable(1)}, {Variable(3)}}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE 20 = category;"), (std::vector<row_t>{{Variable(2)}}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE category = 40;"), (std::vector<row_t>{}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE category IN (30, 20);"), (std::vector<row_t>{{Variable(2)}, {Variable(4)}}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE category = 10 LIMIT 1;"), (std::vector<row_t>{{Variable(1)}}));
+}
+
+TEST_F(IndexTest, test_index_maintained)
+{
+    sql->exec("CREATE INDEX item_category ON item(category);");
+    sql->exec("INSERT INTO item (id, category, price) VALUES (5, 10, 500);");
+    ASSERT_EQ(query("SELECT id FROM item WHERE category = 10;"), (std::vector<row_t>{{Variable(1)}, {Variable(3)}, {Variable(5)}}));
+
+    sql->exec("UPDATE item SET category = 20 WHERE id = 3;");
+    ASSERT_EQ(query("SELECT id FROM item WHERE category = 10;"), (std::vector<row_t>{{Variable(1)}, {Variable(5)}}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE category = 20;"), (std::vector<row_t>{{Variable(2)}, {Variable(3)}}));
+
+    sql->exec("DELETE FROM item WHERE category = 20;");
+    ASSERT_EQ(query("SELECT id FROM item WHERE category = 20;"), (std::vector<row_t>{}));
+    ASSERT_EQ(query("SELECT id FROM item;"), (std::vector<row_t>{{Variable(1)}, {Variable(4)}, {Variable(5)}}));
+}
+
+TEST_F(IndexTest, test_rejects_bad_index)
+{
+    sql->exec("CREATE INDEX item_category ON item(category);");
+    ASSERT_THROW(sql->exec("CREATE INDEX item_category ON item(price);"), SemanticError);
+}
+
+TEST_F(IndexTest, test_between)
+{
+    ASSERT_EQ(query("SELECT id FROM item WHERE price BETWEEN 200 AND 300;"), (std::vector<row_t>{{Variable(2)}, {Variable(3)}}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE price + 50 BETWEEN 100 AND 200;"), (std::vector<row_t>{{Variable(1)}}));
+    ASSERT_THROW(sql->exec("SELECT id FROM item WHERE price BETWEEN 200;"), SyntaxError);
+}
+
+TEST_F(IndexTest, test_range_scan)
+{
+    sql->exec("CREATE INDEX item_price ON item(price);");
+    ASSERT_EQ(query("SELECT id FROM item WHERE price > 200;"), (std::vector<row_t>{{Variable(3)}, {Variable(4)}}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE price < 200;"), (std::vector<row_t>{{Variable(1)}}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE 300 < price;"), (std::vector<row_t>{{Variable(4)}}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE price BETWEEN 200 AND 300;"), (std::vector<row_t>{{Variable(2)}, {Variable(3)}}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE price BETWEEN 300 AND 200;"), (std::vector<row_t>{}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE price > 9223372036854775807;"), (std::vector<row_t>{}));
+
+    sql->exec("DELETE FROM item WHERE price > 250;");
+    ASSERT_EQ(query("SELECT id FROM item;"), (std::vector<row_t>{{Variable(1)}, {Variable(2)}}));
+}
+
+TEST_F(IndexTest, test_and)
+{
+    ASSERT_EQ(query("SELECT id FROM item WHERE category = 10 AND price > 100;"), (std::vector<row_t>{{Variable(3)}}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE price > 100 AND price < 400 AND NOT category = 20;"), (std::vector<row_t>{{Variable(3)}}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE price BETWEEN 100 AND 300 AND category = 10;"), (std::vector<row_t>{{Variable(1)}, {Variable(3)}}));
+}
+
+TEST_F(IndexTest, test_composite_index)
+{
+    sql->exec("INSERT INTO item (id, category, price) VALUES (5, 10, 150), (6, 20, 150), (7, 10, 250);");
+    sql->exec("CREATE INDEX item_category_price ON item(category, price);");
+
+    // Any leading part of the index can be used, with the last column used being a range. A single range
+    // comes back in index order, several are merged into table order.
+    ASSERT_EQ(query("SELECT id FROM item WHERE category = 10;"), (std::vector<row_t>{{Variable(1)}, {Variable(5)}, {Variable(7)}, {Variable(3)}}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE category = 10 AND price = 150;"), (std::vector<row_t>{{Variable(5)}}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE price > 120 AND category = 10;"), (std::vector<row_t>{{Variable(5)}, {Variable(7)}, {Variable(3)}}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE category IN (10, 20) AND price BETWEEN 150 AND 250;"), (std::vector<row_t>{{Variable(2)}, {Variable(5)}, {Variable(6)}, {Variable(7)}}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE category > 10 AND price = 150;"), (std::vector<row_t>{{Variable(6)}}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE price = 150;"), (std::vector<row_t>{{Variable(5)}, {Variable(6)}}));
+
+    sql->exec("UPDATE item SET price = 50 WHERE id = 7;");
+    ASSERT_EQ(query("SELECT id FROM item WHERE category = 10 AND price < 100;"), (std::vector<row_t>{{Variable(7)}}));
+    sql->exec("DELETE FROM item WHERE category = 10 AND price < 200;");
+    ASSERT_EQ(query("SELECT id FROM item WHERE category = 10;"), (std::vector<row_t>{{Variable(3)}}));
+}
+
+TEST_F(IndexTest, test_string_index)
+{
+    sql->exec("CREATE TABLE customer (id INT, email STRING, region INT);");
+    sql->exec(R"(INSERT INTO customer (id, email, region) VALUES (1, "amy@example.com", 1), (2, "bob@example.com", 2), (3, "amy@example.org", 1), (4, "amy@example.com", 2);)");
+    sql->exec("CREATE INDEX customer_email ON customer(email);");
+    sql->exec(R"(INSERT INTO customer (id, email, region) VALUES (5, "bob@example.org", 1);)");
+
+    ASSERT_EQ(query(R"(SELECT id FROM customer WHERE email = "amy@example.com";)"), (std::vector<row_t>{{Variable(1)}, {Variable(4)}}));
+    ASSERT_EQ(query(R"(SELECT id FROM customer WHERE "bob@example.org" = email;)"), (std::vector<row_t>{{Variable(5)}}));
+    ASSERT_EQ(query(R"(SELECT id FROM customer WHERE email = "amy@example";)"), (std::vector<row_t>{}));
+    ASSERT_EQ(query(R"(SELECT id FROM customer WHERE email IN ("bob@example.com", "amy@example.org");)"), (std::vector<row_t>{{Variable(2)}, {Variable(3)}}));
+
+    sql->exec(R"(UPDATE customer SET email = "bob@example.com" WHERE id = 1;)");
+    ASSERT_EQ(query(R"(SELECT id FROM customer WHERE email = "amy@example.com";)"), (std::vector<row_t>{{Variable(4)}}));
+    ASSERT_EQ(query(R"(SELECT id FROM customer WHERE email = "bob@example.com";)"), (std::vector<row_t>{{Variable(1)}, {Variable(2)}}));
+
+    sql->exec(R"(DELETE FROM customer WHERE email = "bob@example.com";)");
+    ASSERT_EQ(query("SELECT id FROM customer;"), (std::vector<row_t>{{Variable(3)}, {Variable(4)}, {Variable(5)}}));
+
+    // Mixed INT and STRING keys work too
+    sql->exec("CREATE INDEX customer_region_email ON customer(region, email);");
+    ASSERT_EQ(query(R"(SELECT id FROM customer WHERE region = 1 AND email = "bob@example.org";)"), (std::vector<row_t>{{Variable(5)}}));
+    ASSERT_EQ(query("SELECT id FROM customer WHERE region = 1;"), (std::vector<row_t>{{Variable(3)}, {Variable(5)}}));
+}
+
+TEST_F(IndexTest, test_string_index_rejects_long_values)
+{
+    sql->exec("CREATE TABLE customer (id INT, email STRING);");
+    sql->exec("CREATE INDEX customer_email ON customer(email);");
+    const std::string email(5000, 'a');
+    ASSERT_THROW(sql->exec(R"(INSERT INTO customer (id, email) VALUES (1, ")" + email + R"(");)"), DatabaseError);
+    ASSERT_EQ(query("SELECT id FROM customer;"), (std::vector<row_t>{}));
+}
+
+TEST_F(IndexTest, test_covering_index)
+{
+    sql->exec("CREATE INDEX item_category ON item(category) INCLUDE (price);");
+    ASSERT_EQ(query("SELECT price FROM item WHERE category = 10;"), (std::vector<row_t>{{Variable(100)}, {Variable(300)}}));
+    ASSERT_EQ(query("SELECT price * 2, category FROM item WHERE category IN (10, 30) AND price > 100;"), (std::vector<row_t>{{Variable(600), Variable(10)}, {Variable(800), Variable(30)}}));
+
+    // Columns outside of the index still come from the row
+    ASSERT_EQ(query("SELECT id, price FROM item WHERE category = 20;"), (std::vector<row_t>{{Variable(2), Variable(200)}}));
+    ASSERT_EQ(query("SELECT * FROM item WHERE category = 20;"), (std::vector<row_t>{{Variable(2), Variable(20), Variable(200)}}));
+
+    // Included columns are kept up to date
+    sql->exec("UPDATE item SET price = 350 WHERE id = 3;");
+    ASSERT_EQ(query("SELECT price FROM item WHERE category = 10;"), (std::vector<row_t>{{Variable(100)}, {Variable(350)}}));
+
+    ASSERT_THROW(sql->exec("CREATE INDEX item_bad ON item(category) INCLUDE (category);"), SemanticError);
+    ASSERT_THROW(sql->exec("CREATE INDEX item_bad ON item(category) INCLUDE price;"), SyntaxError);
+}
+
+TEST_F(IndexTest, test_covering_string_index)
+{
+    sql->exec("CREATE TABLE customer (id INT, email STRING, name STRING);");
+    sql->exec(R"(INSERT INTO customer (id, email, name) VALUES (1, "amy@example.com", "Amy"), (2, "bob@example.com", "Bob");)");
+    sql->exec("CREATE INDEX customer_email ON customer(email) INCLUDE (id, name);");
+
+    ASSERT_EQ(query(R"(SELECT id, name FROM customer WHERE email = "bob@example.com";)"), (std::vector<row_t>{{Variable(2), Variable("Bob")}}));
+    ASSERT_EQ(query(R"(SELECT * FROM customer WHERE email IN ("amy@example.com", "bob@example.com");)"),
+              (std::vector<row_t>{{Variable(1), Variable("amy@example.com"), Variable("Amy")}, {Variable(2), Variable("bob@example.com"), Variable("Bob")}}));
+}
+
+TEST_F(IndexTest, test_range_read_lazily)
+{
+    // Prices go down as ids go up, so index order is the reverse of table order
+    std::string insert = "INSERT INTO item (id, category, price) VALUES ";
+    for(int a = 0; a < 2000; a++)
+    {
+        insert += (a ? ", (" : "(") + std::to_string(a + 10) + ", 50, " + std::to_string(100000 - a) + ")";
+    }
+    sql->exec(insert + ";");
+    sql->exec("CREATE INDEX item_price ON item(price) INCLUDE (id);");
+
+    // The scan stops at the first row rather than finding them all, so it's the lowest price which comes back
+    ASSERT_EQ(query("SELECT id, price FROM item WHERE price > 1000 LIMIT 1;"), (std::vector<row_t>{{Variable(2009), Variable(98001)}}));
+    ASSERT_EQ(query("SELECT id FROM item WHERE price BETWEEN 98001 AND 98002;"), (std::vector<row_t>{{Variable(2009)}, {Variable(2008)}}));
+
+    // Several ranges can find the same row, so they're still merged into table order
+    ASSERT_EQ(query("SELECT id FROM item WHERE price IN (98001, 100000, 98001);"), (std::vector<row_t>{{Variable(10)}, {Variable(2009)}}));
+}
+
+TEST_F(IndexTest, test_many_tables)
+{
+    // Each table and index takes streams of its own, many more than fit in the filesystem's first page
+    for(int a = 0; a < 30; a++)
+    {
+        const auto table = "t" + std::to_string(a);
+        sql->exec("CREATE TABLE " + table + " (id INT, value INT);");
+        sql->exec("CREATE INDEX " + table + "_value ON " + table + "(value);");
+        sql->exec("INSERT INTO " + table + " (id, value) VALUES (1, " + std::to_string(a) + "), (2, 100);");
+    }
+    for(int a = 0; a < 30; a++)
+    {
+        const auto table = "t" + std::to_string(a);
+        ASSERT_EQ(query("SELECT id FROM " + table + " WHERE value = " + std::to_string(a) + ";"), (std::vector<row_t>{{Variable(1)}}));
+    }
+}
+
+TEST(RowStorageTest, test_string_space_reused)
+{
+    std::unique_ptr<FilesystemBacking> backing = std::make_unique<MemoryBacking>();
+    BasicFilesystem::Format(backing);
+    BasicFilesystem fs(std::move(backing));
+    TableMetadata meta(0, "person", {{0, "id", Variable::Type::INT, {}}, {1, "name", Variable::Type::STRING, {}}});
+    RowStorage rows(meta, fs.open("person.index", true), fs.open("person.data", true), fs.open("person.str", true));
+    auto heap = fs.open("person.str", false);
+
+    const std::string long_name(100, 'x');
+    const auto first = rows.store({Variable(1), Variable("Amy")});
+    const auto second = rows.store({Variable(2), Variable(long_name)});
+    const uint64_t heap_size = heap.seek(std::numeric_limits<uint64_t>::max());
+
+    // Changing a string to one which fits reuses its slot, however many times it's done
+    for(int a = 0; a < 50; a++)
+    {
+        rows.update(first, {Variable(1), Variable(a % 2 ? "Bea" : "Cy")});
+    }
+    ASSERT_EQ(heap.seek(std::numeric_limits<uint64_t>::max()), heap_size);
+
+    // Outgrown and erased strings leave slots which new strings of the same size take
+    rows.update(first, {Variable(1), Variable(std::string_view(long_name).substr(0, 50))});
+    rows.erase(second);
+    const uint64_t grown_size = heap.seek(std::numeric_limits<uint64_t>::max());
+    const auto third = rows.store({Variable(3), Variable("Dee")});
+    const auto fourth = rows.store({Variable(4), Variable(long_name)});
+    ASSERT_EQ(heap.seek(std::numeric_limits<uint64_t>::max()), grown_size);
+
+    StringPool pool;
+    ASSERT_EQ(rows.load(first, pool), (row_t{Variable(1), Variable(std::string_view(long_name).substr(0, 50))}));
+    ASSERT_EQ(rows.load(third, pool), (row_t{Variable(3), Variable("Dee")}));
+    ASSERT_EQ(rows.load(fourth, pool), (row_t{Variable(4), Variable(long_name)}));
+}
@@ -108,19 +108,20 @@ INSTANTIATE_TEST_SUITE_P(
         SelectFromTable,
         SelectTest,
         ::testing::Values(
-                Expected("SELECT id FROM user;", { {Variable(3) }, {Variable(2)}, {Variable(1)} }),
-                Expected("SELECT id, name FROM user;", { {Variable(3), Variable("Larry") }, {Variable(2), Variable("Barry")}, {Variable(1), Variable("Garry")} }),
-                Expected("SELECT name FROM user WHERE id IN (SELECT user_id FROM admin);", { {Variable("Larry")}, {Variable("Barry")} }),
-                Expected("SELECT * FROM user LIMIT 1;", { {Variable(3), Variable("Larry"), Variable(5)} }),
-                Expected("SELECT id + 1 FROM user LIMIT 1;", { {Variable(4)} })
+                Expected("SELECT id FROM user;", { {Variable(1) }, {Variable(2)}, {Variable(3)} }),
+                Expected("SELECT id, name FROM user;", { {Variable(1), Variable("Garry") }, {Variable(2), Variable("Barry")}, {Variable(3), Variable("Larry")} }),
+                Expected("SELECT name FROM user WHERE id IN (SELECT user_id FROM admin);", { {Variable("Barry")}, {Variable("Larry")} }),
+                Expected("SELECT * FROM user LIMIT 1;", { {Variable(1), Variable("Garry"), Variable(10)} }),
+                Expected("SELECT id + 1 FROM user LIMIT 1;", { {Variable(2)} }),
+                Expected("SELECT * FROM (SELECT id, age FROM user WHERE age > 5);", { {Variable(1), Variable(10)}, {Variable(2), Variable(15)} })
     ));
 
 INSTANTIATE_TEST_SUITE_P(
         SelectLIMIT,
         SelectTest,
         ::testing::Values(
-                Expected("SELECT id FROM user LIMIT 200;", { {Variable(3)}, {Variable(2)}, {Variable(1)} }),
-                Expected("SELECT id FROM user LIMIT 1;", { {Variable(3)} }),
+                Expected("SELECT id FROM user LIMIT 200;", { {Variable(1)}, {Variable(2)}, {Variable(3)} }),
+                Expected("SELECT id FROM user LIMIT 1;", { {Variable(1)} }),
                 Expected("SELECT id FROM user LIMIT 0;", {})
         ));
 
@@ -129,4 +130,4 @@ INSTANTIATE_TEST_SUITE_P(
         SelectTest,
         ::testing::Values(
 
-        ));
\ No newline at end of file
+        ));
\ No newline at end of file